@@ -0,0 +1,109 @@
+#include "radix_sort.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static constexpr std::size_t RADIX_BITS   = 11;
+static constexpr std::size_t RADIX_SIZE   = std::size_t(1) << RADIX_BITS;
+static constexpr std::size_t RADIX_PASSES = (64 + RADIX_BITS - 1) / RADIX_BITS;
+
+// Below that size the histograms cost more than the comparisons
+static constexpr std::size_t RADIX_MIN_VALUES = 4096;
+
+namespace Ozzy::LibFS
+{
+    // Flip the bits so the unsigned order of the keys is the order of the doubles: the
+    // negatives are reversed completely, the positives get the sign bit set
+    static std::uint64_t to_key(const std::uint64_t bits) noexcept
+    {
+        return bits & (1ULL << 63) ? ~bits : bits | (1ULL << 63);
+    }
+
+    static std::uint64_t from_key(const std::uint64_t key) noexcept
+    {
+        return key & (1ULL << 63) ? key & ~(1ULL << 63) : ~key;
+    }
+
+    // The keys are kept in the double buffers, memcpy keeps the access well defined
+    static std::uint64_t load_key(const double *value) noexcept
+    {
+        std::uint64_t key;
+        std::memcpy(&key, value, sizeof(key));
+        return key;
+    }
+
+    static void store_key(double *value, const std::uint64_t key) noexcept
+    {
+        std::memcpy(value, &key, sizeof(key));
+    }
+
+    void radix_sort(double *begin, double *end)
+    {
+        const std::size_t size = end - begin;
+        if (size < RADIX_MIN_VALUES)
+        {
+            std::sort(begin, end);
+            return;
+        }
+
+        // The keys replace the values in place, so the scratch is the only extra buffer
+        std::vector<double> scratch(size);
+
+        // All the histograms are counted with one pass over the data
+        std::vector<std::array<std::size_t, RADIX_SIZE>> histograms(RADIX_PASSES);
+        for (auto &histogram: histograms)
+        {
+            histogram.fill(0);
+        }
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            const std::uint64_t key = to_key(load_key(begin + i));
+            store_key(begin + i, key);
+
+            for (std::size_t pass = 0; pass < RADIX_PASSES; ++pass)
+            {
+                ++histograms[pass][(key >> (pass * RADIX_BITS)) & (RADIX_SIZE - 1)];
+            }
+        }
+
+        double *source      = begin;
+        double *destination = scratch.data();
+
+        for (std::size_t pass = 0; pass < RADIX_PASSES; ++pass)
+        {
+            auto &histogram = histograms[pass];
+            const std::size_t shift = pass * RADIX_BITS;
+
+            // Every key has the same digit, the pass would not move anything
+            if (histogram[(load_key(source) >> shift) & (RADIX_SIZE - 1)] == size)
+            {
+                continue;
+            }
+
+            std::size_t offset = 0;
+            for (auto &count: histogram)
+            {
+                const std::size_t bucket_size = count;
+                count   = offset;
+                offset += bucket_size;
+            }
+
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                const std::uint64_t key = load_key(source + i);
+                store_key(destination + histogram[(key >> shift) & (RADIX_SIZE - 1)]++, key);
+            }
+            std::swap(source, destination);
+        }
+
+        // The skipped passes may leave the keys in either buffer, converting them in place is fine
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            store_key(begin + i, from_key(load_key(source + i)));
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef __OZZY_RADIX_SORT__
+#define __OZZY_RADIX_SORT__
+
+#include <cstddef>
+
+namespace Ozzy::LibFS
+{
+    // LSD radix sort of the doubles by their bit patterns, 11 bits per pass. The keys are
+    // sorted in place, so it takes one more buffer of the same size(the scratch).
+    //
+    // The order is the same as std::sort gives: negatives, then -0.0 before +0.0(they
+    // are equal for std::sort, so any order is fine), then positives. NaNs, that
+    // std::sort can't order at all, go to the ends by their sign bit.
+    void radix_sort(double *begin, double *end);
+}
+
+#endif // __OZZY_RADIX_SORT__
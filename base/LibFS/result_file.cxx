@@ -0,0 +1,504 @@
+#include "result_file.h"
+#include "protocol.h"
+#include "LibLog/logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static constexpr const char* LOGGING_NAME = "[Ozzy::ResultFile] ";
+
+static constexpr std::uint64_t DIRECTORY_PAGE_BYTES = sizeof(Ozzy::LibFS::ResultDirectoryPage) +
+    Ozzy::LibFS::RESULT_DIRECTORY_PAGE_ENTRIES * sizeof(Ozzy::LibFS::ResultDirectoryEntry);
+
+namespace
+{
+    bool write_at(const int descriptor, const void *data, const std::size_t size, const std::uint64_t offset)
+    {
+        const auto *bytes   = static_cast<const char*>(data);
+        std::size_t written = 0;
+
+        while (written < size)
+        {
+            const ssize_t result = ::pwrite(descriptor, bytes + written, size - written,
+                                            static_cast<off_t>(offset + written));
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                return false;
+            }
+            written += result;
+        }
+        return true;
+    }
+
+    bool read_at(const int descriptor, void *data, const std::size_t size, const std::uint64_t offset)
+    {
+        auto       *bytes = static_cast<char*>(data);
+        std::size_t read  = 0;
+
+        while (read < size)
+        {
+            const ssize_t result = ::pread(descriptor, bytes + read, size - read, static_cast<off_t>(offset + read));
+            if (result < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (result <= 0)
+            {
+                return false;
+            }
+            read += result;
+        }
+        return true;
+    }
+
+    std::uint64_t zones_checksum(const std::vector<Ozzy::LibFS::ResultZone> &zones)
+    {
+        return Ozzy::Proto::calculate_payload_checksum(Ozzy::Proto::v3::CHECKSUM_CRC32C,
+                                                       reinterpret_cast<const double*>(zones.data()),
+                                                       zones.size() * sizeof(Ozzy::LibFS::ResultZone) / sizeof(double));
+    }
+}
+
+namespace Ozzy::LibFS
+{
+    ResultRegion::ResultRegion(const std::uint64_t values_count, const std::string &filename)
+    {
+        m_descriptor = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (m_descriptor < 0)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to open output file " + filename);
+            return;
+        }
+
+        // The region starts at the current end of the file, the lock is held only to move
+        // the end and take the directory entry(other client processes may write to the same
+        // file too)
+        ::flock(m_descriptor, LOCK_EX);
+        const bool reserved = reserve(values_count);
+        ::flock(m_descriptor, LOCK_UN);
+
+        if (!reserved)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to reserve the region of the output file " + filename);
+            ::close(m_descriptor);
+            m_descriptor = -1;
+            return;
+        }
+
+        m_zones.reserve(m_entry.zones_count);
+        m_offset = m_entry.values_offset;
+        m_end    = m_entry.values_offset + values_count * sizeof(double);
+    }
+
+    bool ResultRegion::reserve(const std::uint64_t values_count)
+    {
+        struct stat file_stat{};
+        if (::fstat(m_descriptor, &file_stat) != 0)
+        {
+            return false;
+        }
+
+        std::uint64_t    file_end = static_cast<std::uint64_t>(file_stat.st_size);
+        ResultFileHeader header;
+
+        // Write the header of the file and the first directory page, if it's the first time
+        // its processed
+        if (file_end == 0)
+        {
+            header.directory_offset = sizeof(ResultFileHeader);
+
+            const std::vector<char> page(DIRECTORY_PAGE_BYTES, 0);
+            if (!write_at(m_descriptor, &header, sizeof(header), 0) ||
+                !write_at(m_descriptor, page.data(), page.size(), header.directory_offset))
+            {
+                return false;
+            }
+            file_end = header.directory_offset + DIRECTORY_PAGE_BYTES;
+        }
+        else if (!read_at(m_descriptor, &header, sizeof(header), 0) ||
+                 header.magic != RESULT_FILE_MAGIC || header.version != RESULT_FILE_VERSION ||
+                 header.page_entries != RESULT_DIRECTORY_PAGE_ENTRIES)
+        {
+            LibLog::log_print(LOGGING_NAME, "Output file is not the version 2 result file, convert it with "
+                                            "ozzy_result_convert or remove it");
+            return false;
+        }
+
+        // Find the directory page of the new session, the full pages are followed by the new one
+        const std::uint64_t slot        = header.sessions_count;
+        std::uint64_t       page_offset = header.directory_offset;
+
+        for (std::uint64_t page = 0; page < slot / RESULT_DIRECTORY_PAGE_ENTRIES; ++page)
+        {
+            ResultDirectoryPage directory_page;
+            if (!read_at(m_descriptor, &directory_page, sizeof(directory_page), page_offset))
+            {
+                return false;
+            }
+
+            if (directory_page.next_page == 0)
+            {
+                directory_page.next_page = file_end;
+
+                const std::vector<char> new_page(DIRECTORY_PAGE_BYTES, 0);
+                if (!write_at(m_descriptor, new_page.data(), new_page.size(), file_end) ||
+                    !write_at(m_descriptor, &directory_page, sizeof(directory_page), page_offset))
+                {
+                    return false;
+                }
+                file_end += DIRECTORY_PAGE_BYTES;
+            }
+            page_offset = directory_page.next_page;
+        }
+
+        m_entry_offset = page_offset + sizeof(ResultDirectoryPage) +
+                         (slot % RESULT_DIRECTORY_PAGE_ENTRIES) * sizeof(ResultDirectoryEntry);
+
+        m_entry.values_offset   = file_end;
+        m_entry.count           = values_count;
+        m_entry.zones_count     = static_cast<std::uint32_t>((values_count + RESULT_ZONE_VALUES - 1) / RESULT_ZONE_VALUES);
+        m_entry.zone_map_offset = file_end + values_count * sizeof(double);
+
+        // Allocate the blocks up front, so the concurrent writes don't fragment the file.
+        // Not every file system can do that, moving the end is enough for the reservation.
+        const std::uint64_t region_size = values_count * sizeof(double) + m_entry.zones_count * sizeof(ResultZone);
+        if (region_size > 0 &&
+            ::fallocate(m_descriptor, 0, static_cast<off_t>(file_end), static_cast<off_t>(region_size)) != 0 &&
+            ::ftruncate(m_descriptor, static_cast<off_t>(file_end + region_size)) != 0)
+        {
+            return false;
+        }
+
+        ++header.sessions_count;
+        return write_at(m_descriptor, &m_entry, sizeof(m_entry), m_entry_offset) &&
+               write_at(m_descriptor, &header, sizeof(header), 0);
+    }
+
+    ResultRegion::~ResultRegion()
+    {
+        if (m_descriptor >= 0)
+        {
+            ::close(m_descriptor);
+        }
+    }
+
+    void ResultRegion::add_zone(const double *values, const std::size_t count)
+    {
+        const auto [min, max] = std::minmax_element(values, values + count);
+
+        ResultZone zone;
+        zone.min      = *min;
+        zone.max      = *max;
+        zone.checksum = Proto::calculate_payload_checksum(Proto::v3::CHECKSUM_CRC32C, values, count);
+
+        if (m_zones.empty())
+        {
+            m_entry.min = zone.min;
+            m_entry.max = zone.max;
+        }
+        m_entry.min = std::min(m_entry.min, zone.min);
+        m_entry.max = std::max(m_entry.max, zone.max);
+
+        m_zones.push_back(zone);
+    }
+
+    bool ResultRegion::write(const double *values, const std::size_t count)
+    {
+        const std::size_t size = count * sizeof(double);
+        if (m_descriptor < 0 || m_offset + size > m_end || !write_at(m_descriptor, values, size, m_offset))
+        {
+            return false;
+        }
+        m_offset += size;
+
+        // Zones are taken right from the written values, only the block that is split
+        // between the writes is copied
+        for (std::size_t position = 0; position < count;)
+        {
+            if (m_block.empty() && count - position >= RESULT_ZONE_VALUES)
+            {
+                add_zone(values + position, RESULT_ZONE_VALUES);
+                position += RESULT_ZONE_VALUES;
+                continue;
+            }
+
+            const std::size_t take = std::min<std::size_t>(count - position, RESULT_ZONE_VALUES - m_block.size());
+            m_block.insert(m_block.end(), values + position, values + position + take);
+            position += take;
+
+            if (m_block.size() == RESULT_ZONE_VALUES)
+            {
+                add_zone(m_block.data(), m_block.size());
+                m_block.clear();
+            }
+        }
+
+        return true;
+    }
+
+    bool ResultRegion::finish()
+    {
+        if (m_descriptor < 0)
+        {
+            return false;
+        }
+
+        // The last block is the shorter one
+        if (!m_block.empty())
+        {
+            add_zone(m_block.data(), m_block.size());
+            m_block.clear();
+        }
+
+        const bool complete = m_offset == m_end;
+        if (!complete)
+        {
+            LibLog::log_print(LOGGING_NAME, "Session has written " + std::to_string((m_end - m_offset) / sizeof(double)) +
+                                            " values less than reserved");
+        }
+
+        // The entry is written last, the readers see the session once everything is in place
+        m_entry.checksum = zones_checksum(m_zones);
+        m_entry.state    = complete ? RESULT_SESSION_COMPLETE : RESULT_SESSION_RESERVED;
+
+        const bool written = write_at(m_descriptor, m_zones.data(), m_zones.size() * sizeof(ResultZone),
+                                      m_entry.zone_map_offset) &&
+                             write_at(m_descriptor, &m_entry, sizeof(m_entry), m_entry_offset);
+
+        ::close(m_descriptor);
+        m_descriptor = -1;
+        return complete && written;
+    }
+
+    ResultFileReader::ResultFileReader(const std::string &filename)
+    {
+        m_descriptor = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_descriptor < 0)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to open result file " + filename);
+            return;
+        }
+
+        if (!read_at(m_descriptor, &m_header, sizeof(m_header), 0) || m_header.magic != RESULT_FILE_MAGIC ||
+            m_header.version != RESULT_FILE_VERSION || m_header.page_entries == 0 || m_header.zone_values == 0)
+        {
+            LibLog::log_print(LOGGING_NAME, "File " + filename + " is not the version 2 result file");
+            ::close(m_descriptor);
+            m_descriptor = -1;
+            return;
+        }
+
+        // Load the whole directory, page by page
+        m_sessions.resize(m_header.sessions_count);
+
+        std::uint64_t page_offset = m_header.directory_offset;
+        for (std::uint64_t first = 0; first < m_header.sessions_count; first += m_header.page_entries)
+        {
+            ResultDirectoryPage directory_page;
+            const std::uint64_t count = std::min<std::uint64_t>(m_header.page_entries, m_header.sessions_count - first);
+
+            if (page_offset == 0 ||
+                !read_at(m_descriptor, &directory_page, sizeof(directory_page), page_offset) ||
+                !read_at(m_descriptor, m_sessions.data() + first, count * sizeof(ResultDirectoryEntry),
+                         page_offset + sizeof(ResultDirectoryPage)))
+            {
+                LibLog::log_print(LOGGING_NAME, "Directory of the result file " + filename + " is truncated");
+                m_sessions.resize(first);
+                break;
+            }
+            page_offset = directory_page.next_page;
+        }
+    }
+
+    ResultFileReader::~ResultFileReader()
+    {
+        if (m_descriptor >= 0)
+        {
+            ::close(m_descriptor);
+        }
+    }
+
+    bool ResultFileReader::read_session(const std::size_t session, std::vector<double> &values) const
+    {
+        if (session >= m_sessions.size())
+        {
+            return false;
+        }
+
+        const ResultDirectoryEntry &entry = m_sessions[session];
+        values.resize(entry.count);
+        return read_at(m_descriptor, values.data(), entry.count * sizeof(double), entry.values_offset);
+    }
+
+    bool ResultFileReader::read_zone_map(const std::size_t session, std::vector<ResultZone> &zones) const
+    {
+        if (session >= m_sessions.size())
+        {
+            return false;
+        }
+
+        const ResultDirectoryEntry &entry = m_sessions[session];
+        zones.resize(entry.zones_count);
+        return read_at(m_descriptor, zones.data(), zones.size() * sizeof(ResultZone), entry.zone_map_offset);
+    }
+
+    bool ResultFileReader::read_range(const std::size_t session, const double low, const double high,
+                                      std::vector<double> &values) const
+    {
+        std::vector<ResultZone> zones;
+        if (!read_zone_map(session, zones))
+        {
+            return false;
+        }
+
+        const ResultDirectoryEntry &entry = m_sessions[session];
+        values.clear();
+
+        std::vector<double> block;
+        for (std::size_t i = 0; i < zones.size(); ++i)
+        {
+            if (zones[i].max < low || zones[i].min > high)
+            {
+                continue;
+            }
+
+            const std::uint64_t first_value = static_cast<std::uint64_t>(i) * m_header.zone_values;
+            block.resize(std::min<std::uint64_t>(m_header.zone_values, entry.count - first_value));
+
+            if (!read_at(m_descriptor, block.data(), block.size() * sizeof(double),
+                         entry.values_offset + first_value * sizeof(double)))
+            {
+                return false;
+            }
+
+            std::copy_if(block.begin(), block.end(), std::back_inserter(values), [low, high](const double value)
+            {
+                return value >= low && value <= high;
+            });
+        }
+
+        return true;
+    }
+
+    bool ResultFileReader::verify_session(const std::size_t session) const
+    {
+        std::vector<ResultZone> zones;
+        if (!read_zone_map(session, zones))
+        {
+            return false;
+        }
+
+        const ResultDirectoryEntry &entry = m_sessions[session];
+        if (entry.state != RESULT_SESSION_COMPLETE || zones_checksum(zones) != entry.checksum)
+        {
+            return false;
+        }
+
+        std::vector<double> block;
+        for (std::size_t i = 0; i < zones.size(); ++i)
+        {
+            const std::uint64_t first_value = static_cast<std::uint64_t>(i) * m_header.zone_values;
+            block.resize(std::min<std::uint64_t>(m_header.zone_values, entry.count - first_value));
+
+            if (!read_at(m_descriptor, block.data(), block.size() * sizeof(double),
+                         entry.values_offset + first_value * sizeof(double)) ||
+                Proto::calculate_payload_checksum(Proto::v3::CHECKSUM_CRC32C, block.data(), block.size()) !=
+                zones[i].checksum)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool convert_result_file_v1(const std::string &v1_filename, const std::string &v2_filename)
+    {
+        const int descriptor = ::open(v1_filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to open result file " + v1_filename);
+            return false;
+        }
+
+        struct stat file_stat{};
+        ::fstat(descriptor, &file_stat);
+        const auto file_size = static_cast<std::size_t>(file_stat.st_size);
+
+        // The version 1 file is scanned front to back, nothing is copied but the sessions values
+        void *mapping = file_size > 0 ? ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+        ::close(descriptor);
+
+        if (mapping == MAP_FAILED)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to map the result file " + v1_filename);
+            return false;
+        }
+        ::madvise(mapping, file_size, MADV_SEQUENTIAL);
+
+        const auto *bytes = static_cast<const std::uint8_t*>(mapping);
+        auto word_at = [bytes, file_size](const std::size_t position) -> std::uint32_t
+        {
+            std::uint32_t word = 0;
+            if (position + sizeof(word) <= file_size)
+            {
+                std::memcpy(&word, bytes + position, sizeof(word));
+            }
+            return word;
+        };
+
+        if (word_at(0) != RESULT_FILE_MAGIC || word_at(sizeof(std::uint32_t)) != RESULT_FILE_V1_START)
+        {
+            LibLog::log_print(LOGGING_NAME, "File " + v1_filename + " is not the version 1 result file");
+            ::munmap(mapping, file_size);
+            return false;
+        }
+
+        // The session ends with the END marker followed by the next START marker or the end of
+        // the file(the marker alone may be the part of the double)
+        bool          converted = true;
+        std::size_t   position  = sizeof(std::uint32_t);
+        std::uint64_t sessions  = 0;
+
+        while (converted && position + sizeof(std::uint32_t) <= file_size && word_at(position) == RESULT_FILE_V1_START)
+        {
+            const std::size_t first = position + sizeof(std::uint32_t);
+
+            position = first;
+            while (position + sizeof(std::uint32_t) <= file_size &&
+                   !(word_at(position) == RESULT_FILE_V1_END &&
+                     (position + sizeof(std::uint32_t) == file_size ||
+                      word_at(position + sizeof(std::uint32_t)) == RESULT_FILE_V1_START)))
+            {
+                position += sizeof(double);
+            }
+
+            // Values are 8-byte aligned in the file, so they are written right from the mapping
+            const std::size_t count = (std::min(position, file_size) - first) / sizeof(double);
+
+            ResultRegion region(count, v2_filename);
+            converted = region.write(reinterpret_cast<const double*>(bytes + first), count) && region.finish();
+
+            position += sizeof(std::uint32_t);
+            ++sessions;
+        }
+
+        ::munmap(mapping, file_size);
+
+        LibLog::log_print(LOGGING_NAME, "Converted " + std::to_string(sessions) + " sessions of " + v1_filename +
+                                        " to " + v2_filename);
+        return converted;
+    }
+}
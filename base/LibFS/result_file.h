@@ -0,0 +1,174 @@
+#ifndef __OZZY_RESULT_FILE__
+#define __OZZY_RESULT_FILE__
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace Ozzy::LibFS
+{
+    constexpr const char   *RESULT_FILE_NAME    = "result.bin";
+    constexpr std::uint32_t RESULT_FILE_MAGIC   = 0x595A5A4F; // OZZY :)
+    constexpr std::uint32_t RESULT_FILE_VERSION = 2;
+
+    // Markers of the version 1 file, which is the stream of the sessions values guarded by them
+    constexpr std::uint32_t RESULT_FILE_V1_START = 0xDEADBEEF;
+    constexpr std::uint32_t RESULT_FILE_V1_END   = 0xC0FFEE;
+
+    // Values of the session are split into the blocks of that size, and every block has its
+    // min/max(zone) and checksum in the zone map of the session
+    constexpr std::uint32_t RESULT_ZONE_VALUES = 65536;
+
+    // Sessions directory is stored with the pages of that much entries, linked one to another
+    constexpr std::uint32_t RESULT_DIRECTORY_PAGE_ENTRIES = 256;
+
+    // Version 2 file layout(everything is in the host byte order):
+    //
+    //   ResultFileHeader | directory page | session regions(and the next directory pages)...
+    //
+    // The session region is its values followed by its zone map, the directory entry of the
+    // session points to both, so any session is reached with one read of the directory.
+    struct ResultFileHeader
+    {
+        std::uint32_t magic            = RESULT_FILE_MAGIC;
+        std::uint32_t version          = RESULT_FILE_VERSION;
+        std::uint32_t zone_values      = RESULT_ZONE_VALUES;
+        std::uint32_t page_entries     = RESULT_DIRECTORY_PAGE_ENTRIES;
+        std::uint64_t sessions_count   = 0;
+        std::uint64_t directory_offset = 0;
+        std::uint64_t reserved[4]      = {};
+    };
+
+    struct ResultDirectoryPage
+    {
+        std::uint64_t next_page   = 0;
+        std::uint64_t reserved[7] = {};
+    };
+
+    enum ResultSessionState : std::uint32_t
+    {
+        RESULT_SESSION_RESERVED = 0, // Region is reserved, but the session is still writing it(or has died)
+        RESULT_SESSION_COMPLETE = 1,
+    };
+
+    struct ResultDirectoryEntry
+    {
+        std::uint64_t values_offset   = 0;
+        std::uint64_t count           = 0;
+        double        min             = 0.0;
+        double        max             = 0.0;
+
+        // CRC-32C of the zone map, which holds the CRC-32C of every block
+        std::uint64_t checksum        = 0;
+        std::uint64_t zone_map_offset = 0;
+        std::uint32_t zones_count     = 0;
+        std::uint32_t state           = RESULT_SESSION_RESERVED;
+        std::uint64_t reserved        = 0;
+    };
+
+    struct ResultZone
+    {
+        double        min      = 0.0;
+        double        max      = 0.0;
+        std::uint64_t checksum = 0;
+    };
+
+    static_assert(sizeof(ResultFileHeader)     == 64);
+    static_assert(sizeof(ResultDirectoryPage)  == 64);
+    static_assert(sizeof(ResultDirectoryEntry) == 64);
+    static_assert(sizeof(ResultZone)           == 24);
+
+    // Part of the result file that belongs to one session: its directory entry, the values and
+    // the zone map. The region is reserved in full before anything is written, so the sessions
+    // write their values at once, each one to its own place, without holding a lock for the
+    // whole sort.
+    class ResultRegion
+    {
+    public:
+        // Reserve the place for `values_count` values at the end of the result file
+        explicit ResultRegion(std::uint64_t values_count, const std::string &filename = RESULT_FILE_NAME);
+
+        ResultRegion(const ResultRegion&) = delete;
+
+        ResultRegion &operator=(const ResultRegion&) = delete;
+
+        ~ResultRegion();
+
+        bool is_open() const noexcept
+        {
+            return m_descriptor >= 0;
+        }
+
+        // Write the values right after the ones written before
+        bool write(const double *values, std::size_t count);
+
+        // Write the zone map and mark the session as complete, false if less values than
+        // reserved were written(the rest of the region is left zeroed)
+        bool finish();
+
+    private:
+        bool reserve(std::uint64_t values_count);
+
+        // Fill the zone of the next block, the values are the whole block
+        void add_zone(const double *values, std::size_t count);
+
+    private:
+        int                     m_descriptor   = -1;
+        std::uint64_t           m_entry_offset = 0;
+        std::uint64_t           m_offset       = 0;
+        std::uint64_t           m_end          = 0;
+
+        ResultDirectoryEntry    m_entry;
+        std::vector<ResultZone> m_zones;
+
+        // Tail of the values that doesn't make the whole block yet
+        std::vector<double>     m_block;
+    };
+
+    // Reads the version 2 result file, the directory is loaded once, so every session is
+    // reached without scanning the ones before it
+    class ResultFileReader
+    {
+    public:
+        explicit ResultFileReader(const std::string &filename = RESULT_FILE_NAME);
+
+        ResultFileReader(const ResultFileReader&) = delete;
+
+        ResultFileReader &operator=(const ResultFileReader&) = delete;
+
+        ~ResultFileReader();
+
+        bool is_open() const noexcept
+        {
+            return m_descriptor >= 0;
+        }
+
+        const std::vector<ResultDirectoryEntry> &sessions() const noexcept
+        {
+            return m_sessions;
+        }
+
+        bool read_session(std::size_t session, std::vector<double> &values) const;
+
+        // Read the values of the session that are within [low, high], the blocks which zones
+        // don't intersect the range are not read at all
+        bool read_range(std::size_t session, double low, double high, std::vector<double> &values) const;
+
+        bool read_zone_map(std::size_t session, std::vector<ResultZone> &zones) const;
+
+        // Check the zone map and every block of the session against their checksums
+        bool verify_session(std::size_t session) const;
+
+    private:
+        int                               m_descriptor = -1;
+        ResultFileHeader                  m_header;
+        std::vector<ResultDirectoryEntry> m_sessions;
+    };
+
+    // Write every session of the version 1 file to the version 2 file, the sessions are
+    // appended if the version 2 file already exists
+    bool convert_result_file_v1(const std::string &v1_filename, const std::string &v2_filename);
+}
+
+#endif // __OZZY_RESULT_FILE__
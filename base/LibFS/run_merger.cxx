@@ -0,0 +1,206 @@
+#include "run_merger.h"
+#include "LibLog/logging.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+static constexpr const char* LOGGING_NAME = "[Ozzy::RunMerger] ";
+
+// All the run read buffers together take this much memory, but each run gets
+// at least MIN and at most MAX bytes(the more runs, the smaller the blocks)
+static constexpr std::size_t MERGE_READ_BUFFERS_BYTES = 64 * 1024 * 1024;
+static constexpr std::size_t MERGE_MIN_BLOCK_BYTES    = 64 * 1024;
+static constexpr std::size_t MERGE_MAX_BLOCK_BYTES    = 4 * 1024 * 1024;
+
+// Output is handed to the sink with blocks of that size
+static constexpr std::size_t MERGE_WRITE_BUFFER_BYTES = 4 * 1024 * 1024;
+
+namespace Ozzy::LibFS
+{
+    RunReader::RunReader(const Run &run, const std::size_t block_values)
+        : m_offset(run.first_value * sizeof(double)), m_buffer(block_values)
+    {
+        m_remaining  = run.count > std::numeric_limits<std::uint64_t>::max() / sizeof(double)
+                       ? std::numeric_limits<std::uint64_t>::max()
+                       : run.count * sizeof(double);
+        m_descriptor = ::open(run.filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_descriptor < 0)
+        {
+            return;
+        }
+
+        // Runs are read front to back, let the kernel read ahead aggressively
+        ::posix_fadvise(m_descriptor, static_cast<off_t>(m_offset), 0, POSIX_FADV_SEQUENTIAL);
+        refill();
+    }
+
+    RunReader::RunReader(RunReader &&other) noexcept
+        : m_descriptor(std::exchange(other.m_descriptor, -1)), m_offset(other.m_offset), m_remaining(other.m_remaining),
+          m_buffer(std::move(other.m_buffer)), m_position(other.m_position), m_size(other.m_size)
+    {
+        other.m_position = other.m_size = 0;
+    }
+
+    RunReader::~RunReader()
+    {
+        if (m_descriptor >= 0)
+        {
+            ::close(m_descriptor);
+        }
+    }
+
+    void RunReader::advance()
+    {
+        if (++m_position == m_size)
+        {
+            refill();
+        }
+    }
+
+    void RunReader::refill()
+    {
+        m_position = m_size = 0;
+        if (m_descriptor < 0)
+        {
+            return;
+        }
+
+        auto *bytes = reinterpret_cast<char*>(m_buffer.data());
+        const std::size_t capacity = std::min<std::uint64_t>(m_buffer.size() * sizeof(double), m_remaining);
+
+        std::size_t filled = 0;
+        while (filled < capacity)
+        {
+            const ssize_t received = ::pread(m_descriptor, bytes + filled, capacity - filled,
+                                             static_cast<off_t>(m_offset + filled));
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (received <= 0)
+            {
+                break;
+            }
+            filled += received;
+        }
+
+        // Trailing bytes of the half-written double are dropped, as the stream reader did
+        m_size       = filled / sizeof(double);
+        m_offset    += m_size * sizeof(double);
+        m_remaining -= m_size * sizeof(double);
+
+        // Start reading the next block while this one is merged
+        if (m_size > 0 && m_remaining > 0)
+        {
+            ::posix_fadvise(m_descriptor, static_cast<off_t>(m_offset), static_cast<off_t>(capacity), POSIX_FADV_WILLNEED);
+        }
+    }
+
+    RunMerger::RunMerger(const std::vector<Run> &runs)
+    {
+        const std::size_t block_bytes = std::clamp(MERGE_READ_BUFFERS_BYTES / std::max<std::size_t>(1, runs.size()),
+                                                   MERGE_MIN_BLOCK_BYTES, MERGE_MAX_BLOCK_BYTES);
+
+        m_readers.reserve(runs.size());
+        for (const auto &run: runs)
+        {
+            m_readers.emplace_back(run, block_bytes / sizeof(double));
+
+            if (!m_readers.back().is_open())
+            {
+                LibLog::log_print(LOGGING_NAME, "Unable to open the run " + run.filename + ", skipping it");
+                m_readers.pop_back();
+            }
+        }
+    }
+
+    bool RunMerger::goes_before(const std::size_t a, const std::size_t b) const noexcept
+    {
+        if (m_readers[a].exhausted())
+        {
+            return false;
+        }
+        if (m_readers[b].exhausted())
+        {
+            return true;
+        }
+
+        // Equal values are taken from the earlier run first
+        const double value_a = m_readers[a].current();
+        const double value_b = m_readers[b].current();
+        return value_a < value_b || (!(value_b < value_a) && a < b);
+    }
+
+    std::size_t RunMerger::build(const std::size_t node)
+    {
+        const std::size_t runs = m_readers.size();
+        if (node >= runs)
+        {
+            return node - runs;
+        }
+
+        const std::size_t left  = build(2 * node);
+        const std::size_t right = build(2 * node + 1);
+
+        if (goes_before(right, left))
+        {
+            m_losers[node] = left;
+            return right;
+        }
+
+        m_losers[node] = right;
+        return left;
+    }
+
+    bool RunMerger::merge(const sink_t &sink)
+    {
+        const std::size_t runs = m_readers.size();
+        if (runs == 0)
+        {
+            return true;
+        }
+
+        // m_losers[0] is the overall winner
+        m_losers.assign(runs, 0);
+        m_losers[0] = runs == 1 ? 0 : build(1);
+
+        std::vector<double> output;
+        output.reserve(MERGE_WRITE_BUFFER_BYTES / sizeof(double));
+
+        for (;;)
+        {
+            std::size_t winner = m_losers[0];
+            if (m_readers[winner].exhausted())
+            {
+                break;
+            }
+
+            output.push_back(m_readers[winner].current());
+            if (output.size() == output.capacity())
+            {
+                if (!sink(output.data(), output.size()))
+                {
+                    return false;
+                }
+                output.clear();
+            }
+
+            // Replay the matches on the path from the winner's leaf to the root
+            m_readers[winner].advance();
+            for (std::size_t node = (winner + runs) / 2; node > 0; node /= 2)
+            {
+                if (goes_before(m_losers[node], winner))
+                {
+                    std::swap(m_losers[node], winner);
+                }
+            }
+            m_losers[0] = winner;
+        }
+
+        return output.empty() || sink(output.data(), output.size());
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef __OZZY_RUN_MERGER__
+#define __OZZY_RUN_MERGER__
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <limits>
+
+namespace Ozzy::LibFS
+{
+    // Sorted values stored in the file, either the whole file or its part
+    struct Run
+    {
+        std::string   filename;
+        std::uint64_t first_value = 0;
+        std::uint64_t count       = std::numeric_limits<std::uint64_t>::max();
+    };
+
+    // Reads one sorted run(file with the raw doubles) with the large blocks instead
+    // of the one double per call
+    class RunReader
+    {
+    public:
+        RunReader(const Run &run, std::size_t block_values);
+
+        RunReader(RunReader &&other) noexcept;
+
+        RunReader(const RunReader&) = delete;
+
+        RunReader &operator=(const RunReader&) = delete;
+
+        ~RunReader();
+
+        bool is_open() const noexcept
+        {
+            return m_descriptor >= 0;
+        }
+
+        bool exhausted() const noexcept
+        {
+            return m_position == m_size;
+        }
+
+        double current() const noexcept
+        {
+            return m_buffer[m_position];
+        }
+
+        // Move to the next value, reads the next block when the current one is over
+        void advance();
+
+    private:
+        void refill();
+
+    private:
+        int                 m_descriptor = -1;
+        std::uint64_t       m_offset     = 0;
+        std::uint64_t       m_remaining  = 0;
+        std::vector<double> m_buffer;
+        std::size_t         m_position   = 0;
+        std::size_t         m_size       = 0;
+    };
+
+    // K-way merge of the sorted runs with the loser(tournament) tree, so each output value
+    // costs log2(k) comparisons and no system calls. The output is handed to the `sink` with
+    // the large blocks.
+    class RunMerger
+    {
+    public:
+        using sink_t = std::function<bool(const double *values, std::size_t count)>;
+
+        explicit RunMerger(const std::vector<Run> &runs);
+
+        // False if the sink has failed, the runs that can't be opened are skipped
+        bool merge(const sink_t &sink);
+
+    private:
+        // Whether the run `a` has to go before the run `b`, the exhausted runs go last
+        bool goes_before(std::size_t a, std::size_t b) const noexcept;
+
+        std::size_t build(std::size_t node);
+
+    private:
+        std::vector<RunReader>   m_readers;
+
+        // Internal nodes of the tree keep the losers of their matches, the leaf of the run
+        // `i` is the node `k + i`
+        std::vector<std::size_t> m_losers;
+    };
+}
+
+#endif // __OZZY_RUN_MERGER__
@@ -0,0 +1,90 @@
+#include "sort_pool.h"
+#include "radix_sort.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Arrays below that size are not worth splitting between the threads
+static constexpr std::size_t PARALLEL_SORT_MIN_VALUES = 1 << 16;
+
+namespace Ozzy::LibFS
+{
+    std::size_t sort_threads_count() noexcept
+    {
+        std::size_t threads_count = OZZY_SORT_THREADS;
+        if (threads_count == 0)
+        {
+            threads_count = std::max(1u, std::thread::hardware_concurrency());
+        }
+        return threads_count;
+    }
+
+    boost::asio::thread_pool &sort_pool()
+    {
+        static boost::asio::thread_pool pool(sort_threads_count());
+        return pool;
+    }
+
+    void sort_values(double *begin, double *end)
+    {
+#if OZZY_USE_RADIX_SORT
+        radix_sort(begin, end);
+#else
+        std::sort(begin, end);
+#endif
+    }
+
+    void parallel_sort(double *begin, double *end)
+    {
+        const std::size_t size = end - begin;
+        const std::size_t parts_count = std::min(sort_threads_count(), size / PARALLEL_SORT_MIN_VALUES);
+
+        if (parts_count < 2)
+        {
+            sort_values(begin, end);
+            return;
+        }
+
+        // 1. Sort the equal parts on their own
+        std::vector<double*> bounds(parts_count + 1);
+        for (std::size_t i = 0; i <= parts_count; ++i)
+        {
+            bounds[i] = begin + size * i / parts_count;
+        }
+
+        std::vector<std::future<void>> pending;
+        for (std::size_t i = 0; i < parts_count; ++i)
+        {
+            pending.push_back(post_sort_task([first = bounds[i], last = bounds[i + 1]]
+            {
+                sort_values(first, last);
+            }));
+        }
+        for (auto &task: pending)
+        {
+            task.get();
+        }
+
+        // 2. Merge the neighbour parts pairwise until one part is left
+        for (std::size_t step = 1; step < parts_count; step *= 2)
+        {
+            pending.clear();
+            for (std::size_t i = 0; i + step < parts_count; i += 2 * step)
+            {
+                double *first  = bounds[i];
+                double *middle = bounds[i + step];
+                double *last   = bounds[std::min(i + 2 * step, parts_count)];
+
+                pending.push_back(post_sort_task([first, middle, last]
+                {
+                    std::inplace_merge(first, middle, last);
+                }));
+            }
+            for (auto &task: pending)
+            {
+                task.get();
+            }
+        }
+    }
+}
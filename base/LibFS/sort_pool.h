@@ -0,0 +1,61 @@
+#ifndef __OZZY_SORT_POOL__
+#define __OZZY_SORT_POOL__
+
+#include <utility>
+#include <cstddef>
+#include <memory>
+#include <future>
+#include <type_traits>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+
+// How much threads are sorting the session data in the whole process(the runs of all
+// sessions share them). By default(0) there is one thread per hardware core.
+#ifndef OZZY_SORT_THREADS
+#   define OZZY_SORT_THREADS 0
+#else
+#   if OZZY_SORT_THREADS < 0
+#       error "Invalid value set for OZZY_SORT_THREADS"
+#   endif
+#endif
+
+// Sort the chunks with the LSD radix sort(look at radix_sort.h) instead of std::sort,
+// which is faster on the large arenas, but takes 2x more memory per arena
+#ifndef OZZY_USE_RADIX_SORT
+#   define OZZY_USE_RADIX_SORT 0
+#endif
+
+namespace Ozzy::LibFS
+{
+    // Process-wide pool the sorting work is posted to, created on the first use
+    boost::asio::thread_pool &sort_pool();
+
+    std::size_t sort_threads_count() noexcept;
+
+    // Run the function on the sort pool, the future gets its result
+    template<typename Function>
+    auto post_sort_task(Function function) -> std::future<std::invoke_result_t<Function>>
+    {
+        // asio treats the packaged_task handler in a special way(takes its future), so the
+        // task is wrapped into the plain handler
+        using result_t = std::invoke_result_t<Function>;
+        auto task = std::make_shared<std::packaged_task<result_t()>>(std::move(function));
+
+        std::future<result_t> result = task->get_future();
+        boost::asio::post(sort_pool(), [task]
+        {
+            (*task)();
+        });
+
+        return result;
+    }
+
+    // Sort the values on the calling thread with the configured algorithm
+    void sort_values(double *begin, double *end);
+
+    // Sort the values with all the sort pool threads. Waits for the pool, so it must not
+    // be called from the sort pool threads themselves.
+    void parallel_sort(double *begin, double *end);
+}
+
+#endif // __OZZY_SORT_POOL__
@@ -1,4 +1,6 @@
 #include "thread_cache_file.h"
+#include "sort_pool.h"
+#include "result_file.h"
 #include "LibLog/logging.h"
 
 #include <string>
@@ -7,6 +9,11 @@
 #include <filesystem>
 #include <iostream>
 
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
 // Size that server will reserve(or not :) look at the defines below)
 // for the processing of the each chunk
 //
@@ -26,35 +33,37 @@
 #   endif
 #endif
 
-// The idea is that we don't reserve huge memory arenas if we
-// specified large size for the chunk container.
-//
-// However if the user is really wants and thinks that
-// each chunk is indeed will be provided size, we should
-// support that also
-//
-// Another question is reallocating this monstrous memory arenas.. but
-// if we are not sure(and we are, because of UDP), i thought this approach
-// will be preferable
-#ifndef OZZY_USE_LARGE_CHUNK_MEMORY_ARENAS
-#   define OZZY_LESS_CHUNK_RESERVE_VALUE 250000000
-#else
-#   define OZZY_LESS_CHUNK_RESERVE_VALUE OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES
+// Sort the chunks of the spilled sessions right inside the thread cache file, each arena-sized
+// window of it is mapped into memory and sorted in place. There are no chunk files, and the
+// memory taken by the sort is bounded by the arena size(per sort thread).
+#ifndef OZZY_USE_MMAP_SORT
+#   define OZZY_USE_MMAP_SORT 0
 #endif
 
-#define OZZY_LARGE_MEMORY_ARENA_SIZE 500000000
+// Build the sorted runs of the spilled sessions on the sort pool while the frames are still
+// arriving, so only the merge is left when the transmission ends. Otherwise the received data
+// is written to the cache file as is and sorted after the transmission.
+#ifndef OZZY_OVERLAP_SORT_WITH_RECEIVE
+#   define OZZY_OVERLAP_SORT_WITH_RECEIVE 1
+#endif
+
+// How much bytes of the session data is kept in memory and sorted in place, without
+// touching the disk. Sessions that receive more are spilled to the cache file and
+// sorted externally(look above), 0 means always sort externally.
+#ifndef OZZY_IN_MEMORY_SORT_BUDGET_BYTES
+#   define OZZY_IN_MEMORY_SORT_BUDGET_BYTES 67108864
+#else
+#   if OZZY_IN_MEMORY_SORT_BUDGET_BYTES < 0
+#       error "Invalid value for the OZZY_IN_MEMORY_SORT_BUDGET_BYTES"
+#   endif
+#endif
 
 static constexpr const char* LOGGING_NAME     = "[Ozzy::ThreadCacheFileWriter] ";
 static const std::string THREAD_CACHE_CHARSET = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
 
-static std::uint32_t THREAD_CACHE_MAGIC   = 0x595A5A4F; // OZZY :)
-static std::uint32_t THREAD_CACHE_START_H = 0xDEADBEEF; // Current cache start marker
-static std::uint32_t THREAD_CACHE_END_H   = 0xC0FFEE;   // Current cache end marker
-
 static thread_local std::random_device random_device;
 static thread_local std::mt19937 random_generator(random_device());
 static thread_local std::uniform_int_distribution<std::size_t> distribution(0, THREAD_CACHE_CHARSET.size() - 1);
-static std::mutex result_file_locked;
 
 namespace Ozzy::LibFS
 {
@@ -92,148 +101,260 @@ namespace Ozzy::LibFS
         m_init_success = true;
     }
 
-    void ThreadCacheFile::write_frame(const Proto::Frame &frame)
+    void ThreadCacheFile::write_payload(const double *payload, const std::size_t count)
     {
-        m_cache_file.write(reinterpret_cast<const char*>(frame.payload), frame.length * sizeof(double));
-    }
+        constexpr std::size_t budget_values = OZZY_IN_MEMORY_SORT_BUDGET_BYTES / sizeof(double);
 
-    bool ThreadCacheFile::merge_and_delete_chunk_caches(const std::vector<std::string> &chunk_files)
-    {
-        LibLog::log_print(LOGGING_NAME, "Start merging thread cache chunks");
+#if OZZY_OVERLAP_SORT_WITH_RECEIVE
+        constexpr std::size_t run_values = std::max<std::size_t>(1, OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES);
 
-        std::vector<std::ifstream> chunk_readers;
-        chunk_readers.reserve(chunk_files.size());
+        if (!m_spilled && m_memory_values.size() + count > budget_values)
+        {
+            // Session turned out to be large, the values we already have become the first runs
+            m_spilled = true;
 
-        // We create so-called `chunk readers` for each chunk file, to later
-        // find minimal element among all chunks and write to the main output
-        // file
-        for (const auto &chunk_filename: chunk_files)
+            std::vector<double> memory_values = std::move(m_memory_values);
+            m_memory_values = std::vector<double>();
+
+            write_payload(memory_values.data(), memory_values.size());
+        }
+
+        if (!m_spilled)
         {
-            chunk_readers.emplace_back(chunk_filename, std::ios::binary);
+            m_memory_values.insert(m_memory_values.end(), payload, payload + count);
+            return;
+        }
 
-            if (!chunk_readers.back().is_open())
+        for (std::size_t written = 0; written < count;)
+        {
+            if (!m_run_values)
             {
-                LibLog::log_print(LOGGING_NAME,
-                                  "Unable to create the chunk reader for chunk cache file " + chunk_filename);
-                chunk_readers.pop_back();
+                m_run_values = run_arenas().acquire();
+                m_run_values->clear();
+                m_run_values->reserve(run_values);
             }
+
+            const std::size_t take = std::min(count - written, run_values - m_run_values->size());
+            m_run_values->insert(m_run_values->end(), payload + written, payload + written + take);
+            written += take;
+
+            if (m_run_values->size() == run_values)
+            {
+                post_run(std::move(m_run_values));
+            }
+        }
+#else
+        if (!m_spilled && m_memory_values.size() + count > budget_values)
+        {
+            // Session turned out to be large, everything goes to the disk from now on
+            m_cache_file.write(reinterpret_cast<const char*>(m_memory_values.data()),
+                               m_memory_values.size() * sizeof(double));
+
+            std::vector<double>().swap(m_memory_values);
+            m_spilled = true;
         }
 
-        std::ofstream output_file("result.bin", std::ios::binary | std::ios::app);
-        if (!output_file)
+        if (m_spilled)
         {
-            LibLog::log_print(LOGGING_NAME, "Unable to open output file output.bin");
-            return false;
+            m_cache_file.write(reinterpret_cast<const char*>(payload), count * sizeof(double));
+        }
+        else
+        {
+            m_memory_values.insert(m_memory_values.end(), payload, payload + count);
+        }
+#endif
+    }
+
+    Component::SlabPool<std::vector<double>> &ThreadCacheFile::run_arenas()
+    {
+        // Every session keeps up to sort_threads_count() + 1 runs in flight and fills one more
+        static Component::SlabPool<std::vector<double>> pool(2 * sort_threads_count() + 2);
+        return pool;
+    }
+
+    void ThreadCacheFile::post_run(run_arena_t values)
+    {
+        // Don't let the receive run away from the sort, the memory is bounded by the
+        // runs that are in flight
+        while (m_pending_runs.size() - m_completed_runs > sort_threads_count())
+        {
+            if (!m_pending_runs[m_completed_runs++].get())
+            {
+                LibLog::log_print(LOGGING_NAME, "Failed sorting the chunk, its data is lost");
+            }
         }
 
-        // Write the header of the file, if it's the first time its processed
-        output_file.seekp(0, std::ios::end);
-        std::streampos file_size = output_file.tellp();
+        const std::uint64_t first_value = m_runs_values;
+        m_runs.push_back(Run{m_cache_file_name, first_value, values->size()});
+        m_runs_values += values->size();
+
+        // The arena is released together with the task, right after the run is written
+        m_pending_runs.push_back(post_sort_task(
+            [cache_file_name = m_cache_file_name, first_value, values = std::move(values)]() mutable
+            {
+                return sort_and_write_run(cache_file_name, first_value, *values);
+            }));
+    }
+
+    bool ThreadCacheFile::sort_and_write_run(const std::string &cache_file_name, const std::uint64_t first_value,
+                                             std::vector<double> &values)
+    {
+        sort_values(values.data(), values.data() + values.size());
 
-        if (file_size == 0)
+        const int descriptor = ::open(cache_file_name.c_str(), O_WRONLY | O_CLOEXEC);
+        if (descriptor < 0)
         {
-            output_file.write(reinterpret_cast<char*>(&THREAD_CACHE_MAGIC), sizeof(std::uint32_t));
+            LibLog::log_print(LOGGING_NAME, "Unable to open the cache file for the run");
+            return false;
         }
-        output_file.write(reinterpret_cast<char*>(&THREAD_CACHE_START_H), sizeof(std::uint32_t));
 
-        std::vector<double> values;
-#if OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES < OZZY_LARGE_MEMORY_ARENA_SIZE
-        values.reserve(OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES);
-#else
-        values.reserve(OZZY_LESS_CHUNK_RESERVE_VALUE);
-#endif
+        // Runs are written by the different threads, each one to its own place
+        const auto  *bytes   = reinterpret_cast<const char*>(values.data());
+        const std::size_t size = values.size() * sizeof(double);
+        const off_t  offset  = static_cast<off_t>(first_value * sizeof(double));
 
-        while (!chunk_readers.empty())
+        std::size_t written = 0;
+        while (written < size)
         {
-            std::ptrdiff_t minimal_reader_index = -1;
-            double minimal_value = std::numeric_limits<double>::max();
-
-            // Works only on sorted chunks!
-            //
-            // Find minimal value among all chunk files(readers) at the same file pointer position
-            // and write it to the result output file(thread-safely)
-            //
-            // Like, image we have 2 chunks('^' means file pointer):
-            //
-            //  -- Iteration 0 --
-            //   [0, 1, 2]
-            //    ^
-            //   [1, 1, 2]
-            //    ^
-            //
-            //  -- Iteration 1 --
-            //   [0, 1, 2]
-            //       ^       -> Wrote `0` to result file, iterate 1'st chunk from index 1, second from index 0
-            //   [1, 1, 2]
-            //    ^
-            //
-            //  -- Iteration 3 --
-            //   [0, 1, 2]
-            //       ^       -> Wrote `1` to result file, iterate 2'nd chunk from index 1, second from index 1
-            //   [1, 1, 2]
-            //       ^
-            for (std::size_t i = 0; i < chunk_readers.size(); ++i)
+            const ssize_t result = ::pwrite(descriptor, bytes + written, size - written, offset + written);
+            if (result < 0 && errno == EINTR)
             {
-                const std::streampos previous_file_pointer = chunk_readers[i].tellg();
-                double value;
-
-                if (!chunk_readers[i].eof())
-                {
-                    if (chunk_readers[i].read(reinterpret_cast<char*>(&value), sizeof(double)))
-                    {
-                        if (value <= minimal_value)
-                        {
-                            // If we found other minimals before, the previous reader's file pointers are moved,
-                            // so.. handle it
-                            if (minimal_reader_index != -1)
-                            {
-                                chunk_readers[minimal_reader_index].seekg(
-                                    -static_cast<std::streamoff>(sizeof(double)), std::ios::cur);
-                            }
-
-                            minimal_value = value;
-                            minimal_reader_index = i;
-                        }
-                        else
-                        {
-                            // As soon as we read the file, file pointer moved +sizeof(double) bits,
-                            // we need to move it back, to later iterate it again.
-                            chunk_readers[i].seekg(previous_file_pointer);
-                        }
-                    }
-                }
-                else
-                {
-                    // All data in current chunk has been processed, need to substract i by one
-                    // to avoid out-of-bounds memory access
-                    chunk_readers[i].close();
-                    chunk_readers.erase(chunk_readers.begin() + i);
-                    --i;
-                }
+                continue;
             }
-
-            if (minimal_reader_index != -1)
+            if (result <= 0)
             {
-                output_file.write(reinterpret_cast<char*>(&minimal_value), sizeof(double));
+                break;
             }
+            written += result;
+        }
+
+        ::close(descriptor);
+        return written == size;
+    }
+
+    void ThreadCacheFile::write_frame(const Proto::Frame &frame)
+    {
+        write_payload(frame.payload, frame.length);
+    }
+
+    void ThreadCacheFile::write_frame(const Proto::v3::Frame &frame)
+    {
+        write_payload(frame.payload, frame.length);
+    }
+
+    void ThreadCacheFile::write_values(const double *values, const std::size_t count)
+    {
+        write_payload(values, count);
+    }
+
+    bool ThreadCacheFile::sort_and_write_memory(std::vector<double> &values)
+    {
+        LibLog::log_print(LOGGING_NAME, "Sorting " + std::to_string(values.size()) + " values in memory");
+
+        parallel_sort(values.data(), values.data() + values.size());
+
+        ResultRegion region(values.size());
+        return region.write(values.data(), values.size()) && region.finish();
+    }
+
+    bool ThreadCacheFile::merge_runs(const std::vector<Run> &runs, const std::uint64_t values_count)
+    {
+        LibLog::log_print(LOGGING_NAME, "Start merging " + std::to_string(runs.size()) + " thread cache chunks");
+
+        // Works only on sorted chunks! Each chunk is read with the large blocks, and the
+        // minimal value among all chunks is picked by the loser tree(log2 of the chunks count
+        // comparisons instead of looking at every chunk)
+        RunMerger merger(runs);
+
+        // The other sessions merge into their own regions at the same time
+        ResultRegion region(values_count);
+        if (!region.is_open())
+        {
+            return false;
+        }
+
+        const bool merged = merger.merge([&region](const double *values, const std::size_t count)
+        {
+            return region.write(values, count);
+        });
+
+        if (!merged)
+        {
+            LibLog::log_print(LOGGING_NAME, "Failed merging thread cache chunks");
         }
 
         // Finish up
-        output_file.write(reinterpret_cast<char*>(&THREAD_CACHE_END_H), sizeof(std::uint32_t));
-        output_file.close();
+        region.finish();
+
+        LibLog::log_print(LOGGING_NAME, "Finish merging thread cache chunks");
+        return merged;
+    }
+
+    bool ThreadCacheFile::merge_and_delete_chunk_caches(const std::vector<std::string> &chunk_files,
+                                                        const std::uint64_t values_count)
+    {
+        std::vector<Run> runs;
+        runs.reserve(chunk_files.size());
+
+        for (const auto &chunk_filename: chunk_files)
+        {
+            runs.push_back(Run{chunk_filename});
+        }
+
+        const bool merged = merge_runs(runs, values_count);
 
         for (auto &chunk_filename: chunk_files)
         {
             std::remove(chunk_filename.c_str());
         }
 
-        LibLog::log_print(LOGGING_NAME, "Finish merging thread cache chunks");
+        return merged;
+    }
+
+    bool ThreadCacheFile::sort_mapped_chunk(const std::string &cache_file_name, const std::uint64_t first_value,
+                                            const std::size_t count)
+    {
+        const int descriptor = ::open(cache_file_name.c_str(), O_RDWR | O_CLOEXEC);
+        if (descriptor < 0)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to open the cache file for the sorting");
+            return false;
+        }
+
+        // Mapping has to start at the page boundary, the window is not aligned to it
+        const std::uint64_t page_size   = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+        const std::uint64_t byte_offset = first_value * sizeof(double);
+        const std::uint64_t map_offset  = byte_offset & ~(page_size - 1);
+        const std::size_t   map_length  = byte_offset - map_offset + count * sizeof(double);
+
+        void *mapping = ::mmap(nullptr, map_length, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor,
+                               static_cast<off_t>(map_offset));
+        ::close(descriptor);
+
+        if (mapping == MAP_FAILED)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to map the cache file window for the sorting");
+            return false;
+        }
+
+        // The whole window is sorted at once, read it in with the large requests instead of
+        // faulting it in page by page
+        ::madvise(mapping, map_length, MADV_WILLNEED);
+
+        auto *values = reinterpret_cast<double*>(static_cast<std::uint8_t*>(mapping) + (byte_offset - map_offset));
+        sort_values(values, values + count);
+
+        // Sorted window goes back to the page cache, where the merge reads it from
+        ::munmap(mapping, map_length);
         return true;
     }
 
-    bool ThreadCacheFile::sort_and_write_chunk(std::ifstream &input_file, std::string &temp_filename_out)
+    bool ThreadCacheFile::sort_and_write_chunk(const std::string &cache_file_name, const std::uint64_t first_value,
+                                               const std::size_t count, std::string &temp_filename_out)
     {
         temp_filename_out = generate_filename(128, "_thread_chunk.bin");
+
+        std::ifstream input_file(cache_file_name, std::ios::binary);
         std::ofstream temp_file(temp_filename_out, std::ios::binary);
 
         if (!input_file.is_open() || !temp_file.is_open())
@@ -242,68 +363,113 @@ namespace Ozzy::LibFS
             return false;
         }
 
-        std::vector<double> chunk;
-#if OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES < OZZY_LARGE_MEMORY_ARENA_SIZE
-        chunk.reserve(OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES);
-#else
-        chunk.reserve(OZZY_LESS_CHUNK_RESERVE_VALUE);
-#endif
+        // Every chunk is read with one call, the amount of values totally depends on
+        // system specs(look at OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES)
+        std::vector<double> chunk(count);
 
-        {
-            // Read chunk file until it's eof'ed. The amount of bits that we read
-            // totally depends on system specs
-            double value;
+        input_file.seekg(static_cast<std::streamoff>(first_value * sizeof(double)));
+        input_file.read(reinterpret_cast<char*>(chunk.data()), static_cast<std::streamsize>(count * sizeof(double)));
+        chunk.resize(input_file.gcount() / sizeof(double));
 
-            for (int i = 0; !input_file.eof() && i < OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES; ++i)
-            {
-                if (input_file.read(reinterpret_cast<char*>(&value), sizeof(value)))
-                {
-                    chunk.push_back(value);
-                }
-            }
+        // Other chunks are sorted by the other pool threads at the same time
+        sort_values(chunk.data(), chunk.data() + chunk.size());
+
+        temp_file.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size() * sizeof(double)));
+        temp_file.close();
+
+        return static_cast<bool>(temp_file);
+    }
+
+    void ThreadCacheFile::sort_file()
+    {
+        // Whole session fits into memory, no need for the chunks
+        if (!m_spilled)
+        {
+            sort_and_write_memory(m_memory_values);
+            std::vector<double>().swap(m_memory_values);
+            return;
         }
 
-        if (!chunk.empty())
+#if OZZY_OVERLAP_SORT_WITH_RECEIVE
+        // Most of the runs are already sorted, only the tail and the merge are left
+        if (m_run_values && !m_run_values->empty())
         {
-            std::sort(chunk.begin(), chunk.end());
+            post_run(std::move(m_run_values));
+        }
 
-            for (auto &element: chunk)
+        for (; m_completed_runs < m_pending_runs.size(); ++m_completed_runs)
+        {
+            if (!m_pending_runs[m_completed_runs].get())
             {
-                temp_file.write(reinterpret_cast<const char*>(&element), sizeof(double));
+                LibLog::log_print(LOGGING_NAME, "Failed sorting the chunk, its data is lost");
             }
         }
 
-        temp_file.close();
-        return input_file.eof();
-    }
+        merge_runs(m_runs, m_runs_values);
+#else
+        m_cache_file.flush();
 
-    void ThreadCacheFile::sort_file()
-    {
-        m_cache_file.seekp(0);
+        std::error_code error_code;
+        const std::uint64_t values_count = std::filesystem::file_size(m_cache_file_name, error_code) / sizeof(double);
+        if (error_code)
+        {
+            LibLog::log_print(LOGGING_NAME, "Unable to get the size of the cache file: " + error_code.message());
+            return;
+        }
 
-        const std::string output_name = "output.bin";
-        std::vector<std::string> chunk_files;
-        std::string temp_filename;
+        // Chunks are sorted on the shared pool, so up to sort_threads_count() arenas are
+        // in memory at once
+        const std::uint64_t chunk_values = std::max<std::uint64_t>(1, OZZY_CHUNK_MEMORY_ARENA_SIZE_BYTES);
+        const std::uint64_t chunks_count = (values_count + chunk_values - 1) / chunk_values;
 
-        std::ifstream input_file(m_cache_file_name, std::ios::binary);
+        std::vector<std::string>       chunk_files(chunks_count);
+        std::vector<Run>               runs;
+        std::vector<std::future<bool>> pending;
+        pending.reserve(chunks_count);
 
-        for (;;)
+        for (std::uint64_t i = 0; i < chunks_count; ++i)
         {
-            bool chunk_processing_should_end = sort_and_write_chunk(input_file, temp_filename);
-            chunk_files.push_back(temp_filename);
+            const std::uint64_t first_value = i * chunk_values;
+            const std::size_t   count       = std::min(chunk_values, values_count - first_value);
 
-            if (chunk_processing_should_end)
+#if OZZY_USE_MMAP_SORT
+            runs.push_back(Run{m_cache_file_name, first_value, count});
+            pending.push_back(post_sort_task([this, first_value, count]
             {
-                break;
+                return sort_mapped_chunk(m_cache_file_name, first_value, count);
+            }));
+#else
+            pending.push_back(post_sort_task([this, first_value, count, &chunk_file = chunk_files[i]]
+            {
+                return sort_and_write_chunk(m_cache_file_name, first_value, count, chunk_file);
+            }));
+#endif
+        }
+
+        for (auto &chunk: pending)
+        {
+            if (!chunk.get())
+            {
+                LibLog::log_print(LOGGING_NAME, "Failed sorting the chunk, its data is lost");
             }
         }
 
-        std::lock_guard<std::mutex> lock(result_file_locked);
-        merge_and_delete_chunk_caches(chunk_files);
+#if OZZY_USE_MMAP_SORT
+        merge_runs(runs, values_count);
+#else
+        merge_and_delete_chunk_caches(chunk_files, values_count);
+#endif
+#endif
     }
 
     ThreadCacheFile::~ThreadCacheFile()
     {
+        // Transmission has failed before sort_file(), the runs are still being written
+        for (; m_completed_runs < m_pending_runs.size(); ++m_completed_runs)
+        {
+            m_pending_runs[m_completed_runs].wait();
+        }
+
         if (m_cache_file.is_open())
         {
             m_cache_file.close();
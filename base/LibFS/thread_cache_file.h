@@ -2,8 +2,11 @@
 #define __OZZY_THREAD_CACHE_FILE__
 
 #include "protocol.h"
+#include "run_merger.h"
+#include "LibTT/slab_pool.h"
 #include <fstream>
 #include <vector>
+#include <future>
 
 namespace Ozzy::LibFS
 {
@@ -16,6 +19,11 @@ namespace Ozzy::LibFS
 
         void write_frame(const Proto::Frame &frame);
 
+        void write_frame(const Proto::v3::Frame &frame);
+
+        // Values decoded from the coded frame(Proto::v3::FRAME_FLAG_CODED)
+        void write_values(const double *values, std::size_t count);
+
         void sort_file();
 
         bool initialized_sucessfully() const
@@ -23,17 +31,64 @@ namespace Ozzy::LibFS
             return m_init_success;
         }
 
+        // Steps of the chunked sort, they are measured on their own by the ozzy_bench
+        //
+        // Read `count` values starting from the `first_value` of the cache file, sort them and
+        // write to the new chunk file. Runs on the sort pool, many chunks at once.
+        static bool sort_and_write_chunk(const std::string &cache_file_name, std::uint64_t first_value,
+                                         std::size_t count, std::string &temp_filename_out);
+
+        // Merge the sorted chunk files into the result file and remove them
+        static bool merge_and_delete_chunk_caches(const std::vector<std::string> &chunk_files,
+                                                  std::uint64_t values_count);
+
     private:
+        // Run buffer, which goes back to run_arenas() once the run is written
+        using run_arena_t = Component::SlabPool<std::vector<double>>::handle_t;
+
+        // Run buffers of the written runs, the next runs take them over with their memory
+        static Component::SlabPool<std::vector<double>> &run_arenas();
+
         static std::string generate_filename(std::uint32_t count, const std::string& postfix);
 
-        static bool sort_and_write_chunk(std::ifstream &input_file, std::string &temp_filename_out);
+        // Keep the payload in memory until it exceeds the budget, then spill everything to
+        // the cache file and continue with the external sort
+        void write_payload(const double *payload, std::size_t count);
 
-        static bool merge_and_delete_chunk_caches(const std::vector<std::string> &chunk_files);
+        // Hand the full run buffer to the sort pool, it is sorted and written to the cache
+        // file while the next frames are received(OZZY_OVERLAP_SORT_WITH_RECEIVE)
+        void post_run(run_arena_t values);
+
+        // Sort the values and write them at the `first_value` of the cache file
+        static bool sort_and_write_run(const std::string &cache_file_name, std::uint64_t first_value,
+                                       std::vector<double> &values);
+
+        // Sort the values and write them to the result file, when they all fit in memory
+        static bool sort_and_write_memory(std::vector<double> &values);
+
+        // Sort `count` values starting from the `first_value` right inside the cache file, the
+        // window is mapped into memory, so nothing is copied(OZZY_USE_MMAP_SORT)
+        static bool sort_mapped_chunk(const std::string &cache_file_name, std::uint64_t first_value, std::size_t count);
+
+        // Merge the sorted runs with `values_count` values in total into the result file
+        static bool merge_runs(const std::vector<Run> &runs, std::uint64_t values_count);
 
     private:
-        std::string   m_cache_file_name;
-        std::ofstream m_cache_file;
-        bool          m_init_success;
+        std::string         m_cache_file_name;
+        std::ofstream       m_cache_file;
+        bool                m_init_success;
+
+        // Values received so far, while they fit into OZZY_IN_MEMORY_SORT_BUDGET_BYTES
+        std::vector<double> m_memory_values;
+        bool                m_spilled = false;
+
+        // Sorted runs of the spilled session that are built while receiving, the runs are
+        // stored one after another in the cache file
+        run_arena_t                    m_run_values;
+        std::vector<Run>               m_runs;
+        std::vector<std::future<bool>> m_pending_runs;
+        std::size_t                    m_completed_runs = 0;
+        std::uint64_t                  m_runs_values    = 0;
     };
 }
 
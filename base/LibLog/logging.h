@@ -2,6 +2,7 @@
 #define __OZZY_LOGGING_H__
 
 #include <string>
+#include <utility>
 #include <boost/asio.hpp>
 
 namespace Ozzy::LibLog
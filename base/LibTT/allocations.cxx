@@ -0,0 +1,47 @@
+#include <LibTT/allocations.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<std::uint64_t> allocations_count{0};
+}
+
+#if OZZY_COUNT_ALLOCATIONS
+// Only the plain and the aligned allocation functions are replaced, the array and nothrow ones
+// call them, and the default deallocation functions release what malloc gives
+void *operator new(const std::size_t size)
+{
+    allocations_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *pointer = std::malloc(size == 0 ? 1 : size))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(const std::size_t size, const std::align_val_t alignment)
+{
+    allocations_count.fetch_add(1, std::memory_order_relaxed);
+
+    const auto        align   = static_cast<std::size_t>(alignment);
+    const std::size_t rounded = (std::max<std::size_t>(size, 1) + align - 1) / align * align;
+    if (void *pointer = std::aligned_alloc(align, rounded))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+#endif
+
+namespace Ozzy::Component
+{
+    std::uint64_t heap_allocations() noexcept
+    {
+        return allocations_count.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef __OZZY_COMPONENT_ALLOCATIONS__
+#define __OZZY_COMPONENT_ALLOCATIONS__
+
+#include <cstdint>
+
+// Count every heap allocation of the process(the global operator new is replaced), so the
+// sessions are able to report how much the hot path has allocated
+#ifndef OZZY_COUNT_ALLOCATIONS
+#   define OZZY_COUNT_ALLOCATIONS 0
+#endif
+
+namespace Ozzy::Component
+{
+    // Heap allocations made by the whole process so far, always 0 without OZZY_COUNT_ALLOCATIONS
+    std::uint64_t heap_allocations() noexcept;
+}
+
+#endif // __OZZY_COMPONENT_ALLOCATIONS__
@@ -0,0 +1,87 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+namespace Ozzy::Component
+{
+    std::size_t LatencyHistogram::bucket_index(const std::uint64_t value) noexcept
+    {
+        if (value < SUB_BUCKET_COUNT)
+        {
+            return static_cast<std::size_t>(value);
+        }
+
+        // The top SUB_BUCKET_BITS bits of the value pick the bucket inside its power of two,
+        // they are always [HALF, COUNT)
+        const std::size_t shift = std::bit_width(value) - SUB_BUCKET_BITS;
+        return shift * SUB_BUCKET_HALF + static_cast<std::size_t>(value >> shift);
+    }
+
+    std::uint64_t LatencyHistogram::bucket_upper_bound(const std::size_t index) noexcept
+    {
+        if (index < SUB_BUCKET_COUNT)
+        {
+            return index;
+        }
+
+        const std::size_t   shift      = index / SUB_BUCKET_HALF - 1;
+        const std::uint64_t sub_bucket = index - shift * SUB_BUCKET_HALF;
+
+        // The last bucket ends right at 2^64 - 1
+        return ((sub_bucket + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(const std::uint64_t value) noexcept
+    {
+        ++m_counts[bucket_index(value)];
+        ++m_count;
+        m_min  = std::min(m_min, value);
+        m_max  = std::max(m_max, value);
+        m_sum += static_cast<double>(value);
+    }
+
+    void LatencyHistogram::merge(const LatencyHistogram &other) noexcept
+    {
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+
+        m_count += other.m_count;
+        m_min    = std::min(m_min, other.m_min);
+        m_max    = std::max(m_max, other.m_max);
+        m_sum   += other.m_sum;
+    }
+
+    double LatencyHistogram::mean() const noexcept
+    {
+        return m_count == 0 ? 0.0 : m_sum / static_cast<double>(m_count);
+    }
+
+    std::uint64_t LatencyHistogram::percentile(const double percentile) const noexcept
+    {
+        if (m_count == 0)
+        {
+            return 0;
+        }
+
+        // Rank of the value, the first one for the 0th percentile
+        const double        fraction = std::clamp(percentile, 0.0, 100.0) / 100.0;
+        const std::uint64_t rank     = std::max<std::uint64_t>(
+            1, static_cast<std::uint64_t>(std::ceil(fraction * static_cast<double>(m_count))));
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            seen += m_counts[i];
+            if (seen >= rank)
+            {
+                return std::clamp(bucket_upper_bound(i), min(), m_max);
+            }
+        }
+
+        return m_max;
+    }
+}
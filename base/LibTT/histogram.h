@@ -0,0 +1,65 @@
+#ifndef __OZZY_COMPONENT_HISTOGRAM__
+#define __OZZY_COMPONENT_HISTOGRAM__
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace Ozzy::Component
+{
+    // Histogram of the latencies with the HDR(high dynamic range) layout: every power of two is
+    // split into the same count of the linear buckets, so any value up to 2^64 is kept with under
+    // 2% error in the fixed memory. The histograms of the threads are merged by adding the counts.
+    class LatencyHistogram
+    {
+    public:
+        void record(std::uint64_t value) noexcept;
+
+        void merge(const LatencyHistogram &other) noexcept;
+
+        std::uint64_t count() const noexcept
+        {
+            return m_count;
+        }
+
+        // Both are zero when nothing is recorded
+        std::uint64_t min() const noexcept
+        {
+            return m_count == 0 ? 0 : m_min;
+        }
+
+        std::uint64_t max() const noexcept
+        {
+            return m_max;
+        }
+
+        double mean() const noexcept;
+
+        // The value, which `percentile`(0..100) of the recorded values are at or below, as the
+        // upper bound of its bucket(never above the max)
+        std::uint64_t percentile(double percentile) const noexcept;
+
+    private:
+        // 2^7 buckets for the values below 128, and 64 buckets per every power of two above
+        static constexpr std::size_t SUB_BUCKET_BITS  = 7;
+        static constexpr std::size_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static constexpr std::size_t SUB_BUCKET_HALF  = SUB_BUCKET_COUNT / 2;
+        static constexpr std::size_t BUCKET_COUNT     = (64 - SUB_BUCKET_BITS + 2) * SUB_BUCKET_HALF;
+
+        static std::size_t bucket_index(std::uint64_t value) noexcept;
+
+        static std::uint64_t bucket_upper_bound(std::size_t index) noexcept;
+
+    private:
+        std::array<std::uint64_t, BUCKET_COUNT> m_counts{};
+        std::uint64_t                           m_count = 0;
+        std::uint64_t                           m_min   = std::numeric_limits<std::uint64_t>::max();
+        std::uint64_t                           m_max   = 0;
+
+        // Sum of the values for the mean, in double so it never overflows
+        double                                  m_sum   = 0.0;
+    };
+}
+
+#endif // __OZZY_COMPONENT_HISTOGRAM__
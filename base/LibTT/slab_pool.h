@@ -0,0 +1,204 @@
+#ifndef __OZZY_COMPONENT_SLAB_POOL__
+#define __OZZY_COMPONENT_SLAB_POOL__
+
+#include <utility>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace Ozzy::Component
+{
+    // Free list of the objects that are too expensive to create per session(the large buffers,
+    // which pages are already faulted in). The released object comes back as it was left, the
+    // new owner resets it without giving the memory away.
+    template<typename T>
+    class SlabPool
+    {
+    public:
+        struct Releaser
+        {
+            SlabPool *pool = nullptr;
+
+            void operator()(T *object) const noexcept
+            {
+                pool->release(object);
+            }
+        };
+
+        using handle_t = std::unique_ptr<T, Releaser>;
+
+        // Keeps up to `capacity` released objects, the ones above are destroyed
+        explicit SlabPool(const std::size_t capacity)
+            : m_capacity(capacity)
+        {
+            m_free.reserve(capacity);
+        }
+
+        SlabPool(const SlabPool&) = delete;
+
+        SlabPool &operator=(const SlabPool&) = delete;
+
+        ~SlabPool()
+        {
+            for (T *object: m_free)
+            {
+                delete object;
+            }
+        }
+
+        handle_t acquire()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                if (!m_free.empty())
+                {
+                    T *object = m_free.back();
+                    m_free.pop_back();
+
+                    m_reused.fetch_add(1, std::memory_order_relaxed);
+                    return handle_t(object, Releaser{this});
+                }
+            }
+
+            m_created.fetch_add(1, std::memory_order_relaxed);
+            return handle_t(new T(), Releaser{this});
+        }
+
+        // Objects created by the pool, and the ones given out again
+        std::uint64_t created() const noexcept
+        {
+            return m_created.load(std::memory_order_relaxed);
+        }
+
+        std::uint64_t reused() const noexcept
+        {
+            return m_reused.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void release(T *object) noexcept
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_free.size() < m_capacity)
+                {
+                    m_free.push_back(object);
+                    return;
+                }
+            }
+            delete object;
+        }
+
+    private:
+        const std::size_t          m_capacity;
+        std::mutex                 m_mutex;
+        std::vector<T*>            m_free;
+
+        std::atomic<std::uint64_t> m_created{0};
+        std::atomic<std::uint64_t> m_reused {0};
+    };
+
+    // Free list of the memory blocks of one size, the blocks above `capacity` go back to the heap
+    class BlockPool
+    {
+    public:
+        BlockPool(const std::size_t block_size, const std::size_t alignment, const std::size_t capacity)
+            : m_block_size(block_size), m_alignment(alignment), m_capacity(capacity)
+        {
+            m_free.reserve(capacity);
+        }
+
+        void *allocate()
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                if (!m_free.empty())
+                {
+                    void *block = m_free.back();
+                    m_free.pop_back();
+                    return block;
+                }
+            }
+            return ::operator new(m_block_size, std::align_val_t(m_alignment));
+        }
+
+        void deallocate(void *block) noexcept
+        {
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_free.size() < m_capacity)
+                {
+                    m_free.push_back(block);
+                    return;
+                }
+            }
+            ::operator delete(block, std::align_val_t(m_alignment));
+        }
+
+    private:
+        const std::size_t  m_block_size;
+        const std::size_t  m_alignment;
+        const std::size_t  m_capacity;
+        std::mutex         m_mutex;
+        std::vector<void*> m_free;
+    };
+
+    // How much blocks of every size PoolAllocator keeps
+    constexpr std::size_t POOL_ALLOCATOR_CAPACITY = 1024;
+
+    // Process-wide pool of the blocks of that size. It's never destroyed, the objects released
+    // by the static destructors of the other libraries still need it.
+    template<std::size_t Size, std::size_t Alignment>
+    BlockPool &block_pool()
+    {
+        static BlockPool *pool = new BlockPool(Size, Alignment, POOL_ALLOCATOR_CAPACITY);
+        return *pool;
+    }
+
+    // Allocator of the single objects from the block_pool() of their size. With std::allocate_shared
+    // the object and its control block take one recycled block, so the per session objects cost
+    // no heap allocation once the pool is warm.
+    template<typename T>
+    struct PoolAllocator
+    {
+        using value_type = T;
+
+        PoolAllocator() noexcept = default;
+
+        template<typename U>
+        PoolAllocator(const PoolAllocator<U>&) noexcept
+        {
+        }
+
+        T *allocate(const std::size_t count)
+        {
+            if (count != 1)
+            {
+                return std::allocator<T>().allocate(count);
+            }
+            return static_cast<T*>(block_pool<sizeof(T), alignof(T)>().allocate());
+        }
+
+        void deallocate(T *pointer, const std::size_t count) noexcept
+        {
+            if (count != 1)
+            {
+                std::allocator<T>().deallocate(pointer, count);
+                return;
+            }
+            block_pool<sizeof(T), alignof(T)>().deallocate(pointer);
+        }
+
+        template<typename U>
+        bool operator==(const PoolAllocator<U>&) const noexcept
+        {
+            return true;
+        }
+    };
+}
+
+#endif // __OZZY_COMPONENT_SLAB_POOL__
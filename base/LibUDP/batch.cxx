@@ -0,0 +1,534 @@
+#include "batch.h"
+#include "impairment.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__linux__)
+#   include <sys/socket.h>
+#   include <sys/uio.h>
+#   include <netinet/in.h>
+#   include <netinet/udp.h>
+#   include <linux/errqueue.h>
+#endif
+
+namespace Ozzy::LibUDP
+{
+    BatchStatistics &send_batch_statistics() noexcept
+    {
+        static BatchStatistics statistics;
+        return statistics;
+    }
+
+    BatchStatistics &receive_batch_statistics() noexcept
+    {
+        static BatchStatistics statistics;
+        return statistics;
+    }
+
+    static void account(BatchStatistics &statistics, const std::size_t datagrams) noexcept
+    {
+        if (datagrams > 0)
+        {
+            statistics.calls    .fetch_add(1,         std::memory_order_relaxed);
+            statistics.datagrams.fetch_add(datagrams, std::memory_order_relaxed);
+        }
+    }
+
+#if defined(__linux__)
+    // Largest payload of one UDP datagram over IPv4, the segmented buffer must fit into it
+    static constexpr std::size_t MAX_SEGMENTED_BYTES = 65507;
+
+    // Kernel limit of the segments per one segmented buffer(UDP_MAX_SEGMENTS)
+    static constexpr std::size_t MAX_SEGMENTS = 64;
+
+    Offload enable_offload(udp::socket &socket, const Offload requested) noexcept
+    {
+        Offload enabled;
+        const int fd  = socket.native_handle();
+        const int one = 1;
+
+#if defined(UDP_SEGMENT)
+        // Segment size is passed with every send call, here we only check that it is known
+        int segment_size = 0;
+        enabled.segmentation = requested.segmentation &&
+                               ::setsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment_size, sizeof(segment_size)) == 0;
+#endif
+
+#if defined(UDP_GRO)
+        enabled.coalescing = requested.coalescing && ::setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+#endif
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+        // Zero copy is only worth it for the large segmented buffers
+        enabled.zero_copy = requested.zero_copy && enabled.segmentation &&
+                            ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#endif
+
+        static_cast<void>(one);
+        return enabled;
+    }
+
+    void reap_zero_copy(udp::socket &socket, ZeroCopyCompletions &completions) noexcept
+    {
+        for (;;)
+        {
+            alignas(cmsghdr) std::uint8_t control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+
+            msghdr message{};
+            message.msg_control    = control;
+            message.msg_controllen = sizeof(control);
+
+            if (::recvmsg(socket.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            {
+                return;
+            }
+
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (!(header->cmsg_level == SOL_IP   && header->cmsg_type == IP_RECVERR) &&
+                    !(header->cmsg_level == SOL_IPV6 && header->cmsg_type == IPV6_RECVERR))
+                {
+                    continue;
+                }
+
+                sock_extended_err error;
+                std::memcpy(&error, CMSG_DATA(header), sizeof(error));
+                if (error.ee_errno != 0 || error.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    continue;
+                }
+
+                // Notification covers the send calls from `ee_info` to `ee_data`, they are
+                // completed in order for one socket
+                completions.completed = std::max(completions.completed, error.ee_data + 1);
+                if (error.ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                {
+                    ++completions.copied;
+                }
+            }
+        }
+    }
+
+    // Plain path, every datagram is a message of its own
+    static std::size_t send_datagrams(udp::socket &socket, const udp::endpoint &endpoint, const std::uint8_t *bytes,
+                                      const std::size_t datagram_size, const std::size_t count,
+                                      boost::system::error_code &error_code)
+    {
+        std::array<mmsghdr, OZZY_UDP_BATCH_SIZE> messages;
+        std::array<iovec,   OZZY_UDP_BATCH_SIZE> vectors;
+
+        std::size_t sent_total = 0;
+
+        error_code.clear();
+        while (sent_total < count)
+        {
+            const std::size_t batch = std::min<std::size_t>(count - sent_total, OZZY_UDP_BATCH_SIZE);
+
+            for (std::size_t i = 0; i < batch; ++i)
+            {
+                vectors[i].iov_base = const_cast<std::uint8_t*>(bytes + (sent_total + i) * datagram_size);
+                vectors[i].iov_len  = datagram_size;
+
+                std::memset(&messages[i], 0, sizeof(mmsghdr));
+                messages[i].msg_hdr.msg_name    = const_cast<sockaddr*>(endpoint.data());
+                messages[i].msg_hdr.msg_namelen = static_cast<socklen_t>(endpoint.size());
+                messages[i].msg_hdr.msg_iov     = &vectors[i];
+                messages[i].msg_hdr.msg_iovlen  = 1;
+            }
+
+            const int sent = ::sendmmsg(socket.native_handle(), messages.data(), static_cast<unsigned>(batch), MSG_DONTWAIT);
+            if (sent < 0)
+            {
+                error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+                break;
+            }
+
+            account(send_batch_statistics(), sent);
+            sent_total += sent;
+
+            if (static_cast<std::size_t>(sent) < batch)
+            {
+                error_code = boost::asio::error::would_block;
+                break;
+            }
+        }
+
+        return sent_total;
+    }
+
+#if defined(UDP_SEGMENT)
+    // Segmented path, each message carries up to MAX_SEGMENTS datagrams in one buffer and
+    // the kernel(or the device) cuts it into the datagrams of `datagram_size` bytes
+    static std::size_t send_segmented(udp::socket &socket, const udp::endpoint &endpoint, const std::uint8_t *bytes,
+                                      const std::size_t datagram_size, const std::size_t count,
+                                      boost::system::error_code &error_code, const bool zero_copy,
+                                      ZeroCopyCompletions &completions)
+    {
+        using control_t = std::array<std::uint8_t, CMSG_SPACE(sizeof(std::uint16_t))>;
+
+        std::array<mmsghdr,   OZZY_UDP_BATCH_SIZE> messages;
+        std::array<iovec,     OZZY_UDP_BATCH_SIZE> vectors;
+        alignas(cmsghdr) std::array<control_t, OZZY_UDP_BATCH_SIZE> controls;
+
+        const std::size_t segments_per_message = std::min(MAX_SEGMENTS, MAX_SEGMENTED_BYTES / datagram_size);
+        const int         flags                = MSG_DONTWAIT | (zero_copy ? MSG_ZEROCOPY : 0);
+
+        std::size_t sent_total = 0;
+
+        error_code.clear();
+        while (sent_total < count)
+        {
+            std::size_t batch    = 0;
+            std::size_t assigned = sent_total;
+
+            for (; batch < OZZY_UDP_BATCH_SIZE && assigned < count; ++batch)
+            {
+                const std::size_t segments = std::min(segments_per_message, count - assigned);
+
+                vectors[batch].iov_base = const_cast<std::uint8_t*>(bytes + assigned * datagram_size);
+                vectors[batch].iov_len  = segments * datagram_size;
+
+                std::memset(&messages[batch], 0, sizeof(mmsghdr));
+                messages[batch].msg_hdr.msg_name    = const_cast<sockaddr*>(endpoint.data());
+                messages[batch].msg_hdr.msg_namelen = static_cast<socklen_t>(endpoint.size());
+                messages[batch].msg_hdr.msg_iov     = &vectors[batch];
+                messages[batch].msg_hdr.msg_iovlen  = 1;
+
+                // Single datagram goes as is
+                if (segments > 1)
+                {
+                    messages[batch].msg_hdr.msg_control    = controls[batch].data();
+                    messages[batch].msg_hdr.msg_controllen = controls[batch].size();
+
+                    cmsghdr *header = CMSG_FIRSTHDR(&messages[batch].msg_hdr);
+                    header->cmsg_level = SOL_UDP;
+                    header->cmsg_type  = UDP_SEGMENT;
+                    header->cmsg_len   = CMSG_LEN(sizeof(std::uint16_t));
+
+                    const auto segment_size = static_cast<std::uint16_t>(datagram_size);
+                    std::memcpy(CMSG_DATA(header), &segment_size, sizeof(segment_size));
+                }
+
+                assigned += segments;
+            }
+
+            const int sent = ::sendmmsg(socket.native_handle(), messages.data(), static_cast<unsigned>(batch), flags);
+            if (sent < 0)
+            {
+                error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+                break;
+            }
+
+            std::size_t datagrams = 0;
+            for (int i = 0; i < sent; ++i)
+            {
+                datagrams += vectors[i].iov_len / datagram_size;
+            }
+
+            // Every message is a separate zero copy send call
+            if (zero_copy)
+            {
+                completions.issued += sent;
+            }
+
+            account(send_batch_statistics(), datagrams);
+            sent_total += datagrams;
+
+            if (static_cast<std::size_t>(sent) < batch)
+            {
+                error_code = boost::asio::error::would_block;
+                break;
+            }
+        }
+
+        return sent_total;
+    }
+#endif
+
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           const std::size_t datagram_size, const std::size_t count, boost::system::error_code &error_code,
+                           Offload &offload, ZeroCopyCompletions &zero_copy)
+    {
+        // The emulated link gets everything(and no offloads), see impairment.h
+        if (impaired_link().enabled())
+        {
+            const std::size_t sent = impaired_link().send(socket, endpoint, data, datagram_size, count, error_code);
+            account(send_batch_statistics(), sent);
+            return sent;
+        }
+
+        const auto *bytes = static_cast<const std::uint8_t*>(data);
+
+#if defined(UDP_SEGMENT)
+        if (offload.segmentation && count > 1 && datagram_size * 2 <= MAX_SEGMENTED_BYTES)
+        {
+            const std::size_t sent = send_segmented(socket, endpoint, bytes, datagram_size, count, error_code,
+                                                    offload.zero_copy, zero_copy);
+
+            // Zero copy notifications are limited by the socket option memory, the data
+            // may still go with the copy
+            if (sent == 0 && error_code == boost::system::errc::no_buffer_space && offload.zero_copy)
+            {
+                offload.zero_copy = false;
+                return send_batch(socket, endpoint, data, datagram_size, count, error_code, offload, zero_copy);
+            }
+
+            // The device is not able to segment the buffer, use the plain path from now on
+            if (sent == 0 && error_code == boost::system::errc::io_error)
+            {
+                offload.segmentation = false;
+                offload.zero_copy    = false;
+                return send_datagrams(socket, endpoint, bytes, datagram_size, count, error_code);
+            }
+
+            return sent;
+        }
+#else
+        static_cast<void>(offload);
+        static_cast<void>(zero_copy);
+#endif
+
+        return send_datagrams(socket, endpoint, bytes, datagram_size, count, error_code);
+    }
+
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           const std::size_t datagram_size, const std::size_t count, boost::system::error_code &error_code)
+    {
+        // The emulated link gets everything(and no offloads), see impairment.h
+        if (impaired_link().enabled())
+        {
+            const std::size_t sent = impaired_link().send(socket, endpoint, data, datagram_size, count, error_code);
+            account(send_batch_statistics(), sent);
+            return sent;
+        }
+
+        return send_datagrams(socket, endpoint, static_cast<const std::uint8_t*>(data), datagram_size, count, error_code);
+    }
+
+#if defined(UDP_GRO)
+    // Coalesced path, one call may return many datagrams of the same sender in one buffer,
+    // which are split back into the slots
+    static std::size_t receive_coalesced(udp::socket &socket, std::uint8_t *bytes, const std::size_t slot_size,
+                                         const std::size_t count, std::size_t *sizes, udp::endpoint *endpoints,
+                                         boost::system::error_code &error_code)
+    {
+        std::size_t received_total = 0;
+        std::size_t calls          = 0;
+
+        error_code.clear();
+
+        // Every call except the first one needs the room for the largest coalesced buffer,
+        // otherwise its tail is lost
+        while (received_total < count &&
+               (received_total == 0 || (count - received_total) * slot_size >= COALESCED_RECEIVE_BYTES))
+        {
+            alignas(cmsghdr) std::uint8_t control[CMSG_SPACE(sizeof(int))];
+            sockaddr_storage address;
+
+            iovec vector;
+            vector.iov_base = bytes + received_total * slot_size;
+            vector.iov_len  = (count - received_total) * slot_size;
+
+            msghdr message{};
+            message.msg_name       = &address;
+            message.msg_namelen    = sizeof(address);
+            message.msg_iov        = &vector;
+            message.msg_iovlen     = 1;
+            message.msg_control    = control;
+            message.msg_controllen = sizeof(control);
+
+            const ssize_t received = ::recvmsg(socket.native_handle(), &message, MSG_DONTWAIT);
+            if (received < 0)
+            {
+                if (received_total == 0)
+                {
+                    error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+                }
+                break;
+            }
+            ++calls;
+
+            std::size_t segment_size = static_cast<std::size_t>(received);
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_UDP && header->cmsg_type == UDP_GRO)
+                {
+                    int gso_size;
+                    std::memcpy(&gso_size, CMSG_DATA(header), sizeof(gso_size));
+                    segment_size = static_cast<std::size_t>(gso_size);
+                }
+            }
+
+            udp::endpoint sender;
+            std::memcpy(sender.data(), &address, message.msg_namelen);
+            sender.resize(message.msg_namelen);
+
+            // Datagrams of the other size can't be told apart, the caller will skip the
+            // whole buffer
+            if (segment_size == 0 || (segment_size != slot_size && static_cast<std::size_t>(received) > segment_size))
+            {
+                const std::size_t slots_used = std::max<std::size_t>(1, (received + slot_size - 1) / slot_size);
+                for (std::size_t i = 0; i < slots_used && received_total < count; ++i, ++received_total)
+                {
+                    sizes    [received_total] = 0;
+                    endpoints[received_total] = sender;
+                }
+                continue;
+            }
+
+            for (std::size_t offset = 0; offset < static_cast<std::size_t>(received) && received_total < count;
+                 offset += segment_size, ++received_total)
+            {
+                sizes    [received_total] = std::min<std::size_t>(segment_size, received - offset);
+                endpoints[received_total] = sender;
+            }
+        }
+
+        if (calls > 0)
+        {
+            receive_batch_statistics().calls    .fetch_add(calls,          std::memory_order_relaxed);
+            receive_batch_statistics().datagrams.fetch_add(received_total, std::memory_order_relaxed);
+        }
+        return received_total;
+    }
+#endif
+
+    std::size_t receive_batch(udp::socket &socket, void *data, const std::size_t slot_size, const std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code,
+                              const Offload &offload)
+    {
+#if defined(UDP_GRO)
+        if (offload.coalescing)
+        {
+            return receive_coalesced(socket, static_cast<std::uint8_t*>(data), slot_size, count, sizes, endpoints,
+                                     error_code);
+        }
+#else
+        static_cast<void>(offload);
+#endif
+
+        return receive_batch(socket, data, slot_size, count, sizes, endpoints, error_code);
+    }
+
+    std::size_t receive_batch(udp::socket &socket, void *data, const std::size_t slot_size, const std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code)
+    {
+        std::array<mmsghdr,          OZZY_UDP_BATCH_SIZE> messages;
+        std::array<iovec,            OZZY_UDP_BATCH_SIZE> vectors;
+        std::array<sockaddr_storage, OZZY_UDP_BATCH_SIZE> addresses;
+
+        auto *bytes = static_cast<std::uint8_t*>(data);
+        const std::size_t batch = std::min<std::size_t>(count, OZZY_UDP_BATCH_SIZE);
+
+        for (std::size_t i = 0; i < batch; ++i)
+        {
+            vectors[i].iov_base = bytes + i * slot_size;
+            vectors[i].iov_len  = slot_size;
+
+            std::memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_name    = &addresses[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+            messages[i].msg_hdr.msg_iov     = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen  = 1;
+        }
+
+        error_code.clear();
+        const int received = ::recvmmsg(socket.native_handle(), messages.data(), static_cast<unsigned>(batch),
+                                        MSG_DONTWAIT, nullptr);
+        if (received < 0)
+        {
+            error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+            return 0;
+        }
+
+        for (int i = 0; i < received; ++i)
+        {
+            sizes[i] = messages[i].msg_len;
+
+            std::memcpy(endpoints[i].data(), &addresses[i], messages[i].msg_hdr.msg_namelen);
+            endpoints[i].resize(messages[i].msg_hdr.msg_namelen);
+        }
+
+        account(receive_batch_statistics(), received);
+        return received;
+    }
+#else
+    // No offloads on the other systems
+    Offload enable_offload(udp::socket&, Offload) noexcept
+    {
+        return Offload{};
+    }
+
+    void reap_zero_copy(udp::socket&, ZeroCopyCompletions&) noexcept
+    {
+    }
+
+    // One datagram per call on the systems without sendmmsg/recvmmsg
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           const std::size_t datagram_size, const std::size_t count, boost::system::error_code &error_code)
+    {
+        // The emulated link gets everything(and no offloads), see impairment.h
+        if (impaired_link().enabled())
+        {
+            const std::size_t sent = impaired_link().send(socket, endpoint, data, datagram_size, count, error_code);
+            account(send_batch_statistics(), sent);
+            return sent;
+        }
+
+        const auto *bytes = static_cast<const std::uint8_t*>(data);
+        std::size_t sent_total = 0;
+
+        error_code.clear();
+        for (; sent_total < count; ++sent_total)
+        {
+            socket.send_to(boost::asio::buffer(bytes + sent_total * datagram_size, datagram_size), endpoint, 0, error_code);
+            if (error_code)
+            {
+                break;
+            }
+            account(send_batch_statistics(), 1);
+        }
+
+        return sent_total;
+    }
+
+    std::size_t receive_batch(udp::socket &socket, void *data, const std::size_t slot_size, const std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code)
+    {
+        error_code.clear();
+        if (count == 0 || socket.available(error_code) == 0 || error_code)
+        {
+            if (!error_code)
+            {
+                error_code = boost::asio::error::would_block;
+            }
+            return 0;
+        }
+
+        sizes[0] = socket.receive_from(boost::asio::buffer(data, slot_size), endpoints[0], 0, error_code);
+        if (error_code)
+        {
+            return 0;
+        }
+
+        account(receive_batch_statistics(), 1);
+        return 1;
+    }
+
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           const std::size_t datagram_size, const std::size_t count, boost::system::error_code &error_code,
+                           Offload&, ZeroCopyCompletions&)
+    {
+        return send_batch(socket, endpoint, data, datagram_size, count, error_code);
+    }
+
+    std::size_t receive_batch(udp::socket &socket, void *data, const std::size_t slot_size, const std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code,
+                              const Offload&)
+    {
+        return receive_batch(socket, data, slot_size, count, sizes, endpoints, error_code);
+    }
+#endif
+}
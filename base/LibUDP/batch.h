@@ -0,0 +1,102 @@
+#ifndef __OZZY_NETWORKING_BATCH__
+#define __OZZY_NETWORKING_BATCH__
+
+#include <atomic>
+#include <utility>
+#include <boost/asio.hpp>
+
+// How much datagrams are sent or received by one system call
+#ifndef OZZY_UDP_BATCH_SIZE
+#   define OZZY_UDP_BATCH_SIZE 32
+#else
+#   if OZZY_UDP_BATCH_SIZE < 1 || OZZY_UDP_BATCH_SIZE > 1024
+#       error "Invalid value set for OZZY_UDP_BATCH_SIZE"
+#   endif
+#endif
+
+namespace Ozzy::LibUDP
+{
+    using boost::asio::ip::udp;
+
+    // Process-wide counters of the batched calls, to see how full the batches are
+    struct BatchStatistics
+    {
+        std::atomic<std::uint64_t> calls     {0};
+        std::atomic<std::uint64_t> datagrams {0};
+
+        // Average count of the datagrams per call
+        double average_fill() const noexcept
+        {
+            const std::uint64_t calls_total = calls.load(std::memory_order_relaxed);
+            return calls_total == 0 ? 0.0 : static_cast<double>(datagrams.load(std::memory_order_relaxed)) / calls_total;
+        }
+    };
+
+    BatchStatistics &send_batch_statistics() noexcept;
+
+    BatchStatistics &receive_batch_statistics() noexcept;
+
+    // Linux offloads of the batched calls. Each of them is only a hint, the calls fall back
+    // to the plain path when the kernel(or the device) does not support it.
+    struct Offload
+    {
+        // Hand the kernel one buffer with many equally sized datagrams(UDP_SEGMENT, GSO)
+        bool segmentation = false;
+
+        // Receive many datagrams of the same sender coalesced into one buffer(UDP_GRO)
+        bool coalescing   = false;
+
+        // Don't copy the segmented send buffers into the kernel(MSG_ZEROCOPY), the buffer
+        // must not be touched until the kernel reports the completion
+        bool zero_copy    = false;
+    };
+
+    // The coalesced datagrams are truncated(and lost) when they don't fit into the receive
+    // buffer, so in the coalescing mode receive_batch() needs at least that much room
+    constexpr std::size_t COALESCED_RECEIVE_BYTES = 65536;
+
+    // Progress of the MSG_ZEROCOPY sends of one socket, each send call gets the next id
+    struct ZeroCopyCompletions
+    {
+        // Id of the next zero copy send call
+        std::uint32_t issued    = 0;
+
+        // Every send call with the id below is completed, the buffer can be reused
+        std::uint32_t completed = 0;
+
+        // Completions for which the kernel has copied the data anyway(loopback does this)
+        std::uint64_t copied    = 0;
+    };
+
+    // Enable requested offloads on the socket, returns the ones that are really available
+    Offload enable_offload(udp::socket &socket, Offload requested) noexcept;
+
+    // Read the MSG_ZEROCOPY completion notifications from the socket error queue, never blocks
+    void reap_zero_copy(udp::socket &socket, ZeroCopyCompletions &completions) noexcept;
+
+    // Send `count` datagrams of `datagram_size` bytes, that are laid out one after another
+    // in the `data`, to the `endpoint`. Never blocks, returns how much datagrams were sent,
+    // `error_code` is `would_block` when the socket send buffer is full. The offloads that
+    // turn out to be unsupported on the way are cleared in the `offload`.
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           std::size_t datagram_size, std::size_t count, boost::system::error_code &error_code,
+                           Offload &offload, ZeroCopyCompletions &zero_copy);
+
+    std::size_t send_batch(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                           std::size_t datagram_size, std::size_t count, boost::system::error_code &error_code);
+
+    // Receive up to `count` datagrams into the slots of `slot_size` bytes, that are laid out
+    // one after another in the `data`. Never blocks, the size and the sender of the i'th
+    // datagram are written to `sizes[i]` and `endpoints[i]`.
+    //
+    // In the coalescing mode the datagrams are split back into the slots, which works only
+    // when the sender's segment size is equal to the `slot_size`.
+    std::size_t receive_batch(udp::socket &socket, void *data, std::size_t slot_size, std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code,
+                              const Offload &offload);
+
+    std::size_t receive_batch(udp::socket &socket, void *data, std::size_t slot_size, std::size_t count,
+                              std::size_t *sizes, udp::endpoint *endpoints, boost::system::error_code &error_code);
+}
+
+#endif // __OZZY_NETWORKING_BATCH__
@@ -0,0 +1,146 @@
+#include "byteswap.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define OZZY_BYTESWAP_X86 1
+#else
+#   define OZZY_BYTESWAP_X86 0
+#endif
+
+namespace Ozzy::LibUDP
+{
+    namespace
+    {
+        using byteswap_kernel_t = void(*)(std::uint8_t *data, std::size_t count);
+
+        struct ByteswapKernels
+        {
+            byteswap_kernel_t swap_64;
+            byteswap_kernel_t swap_32;
+            const char       *name;
+        };
+
+        // The words are not aligned inside the packed messages, so they are always
+        // loaded with memcpy
+        void swap_64_scalar(std::uint8_t *data, const std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::uint64_t word;
+                std::memcpy(&word, data + i * sizeof(word), sizeof(word));
+                word = __builtin_bswap64(word);
+                std::memcpy(data + i * sizeof(word), &word, sizeof(word));
+            }
+        }
+
+        void swap_32_scalar(std::uint8_t *data, const std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                std::uint32_t word;
+                std::memcpy(&word, data + i * sizeof(word), sizeof(word));
+                word = __builtin_bswap32(word);
+                std::memcpy(data + i * sizeof(word), &word, sizeof(word));
+            }
+        }
+
+#if OZZY_BYTESWAP_X86
+        // Shuffle masks that reverse every 8(or 4) bytes of the 16 byte lane
+        constexpr std::int8_t reverse_64_mask[16] = {7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8};
+        constexpr std::int8_t reverse_32_mask[16] = {3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12};
+
+        __attribute__((target("ssse3")))
+        std::size_t shuffle_ssse3(std::uint8_t *data, const std::size_t size, const std::int8_t *mask_bytes)
+        {
+            const __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_bytes));
+
+            std::size_t offset = 0;
+            for (; offset + sizeof(__m128i) <= size; offset += sizeof(__m128i))
+            {
+                auto *lane = reinterpret_cast<__m128i*>(data + offset);
+                _mm_storeu_si128(lane, _mm_shuffle_epi8(_mm_loadu_si128(lane), mask));
+            }
+            return offset;
+        }
+
+        __attribute__((target("avx2")))
+        std::size_t shuffle_avx2(std::uint8_t *data, const std::size_t size, const std::int8_t *mask_bytes)
+        {
+            // vpshufb shuffles each 16 byte half on its own, so the mask is just repeated
+            const __m256i mask = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask_bytes)));
+
+            std::size_t offset = 0;
+            for (; offset + sizeof(__m256i) <= size; offset += sizeof(__m256i))
+            {
+                auto *lane = reinterpret_cast<__m256i*>(data + offset);
+                _mm256_storeu_si256(lane, _mm256_shuffle_epi8(_mm256_loadu_si256(lane), mask));
+            }
+            return offset + shuffle_ssse3(data + offset, size - offset, mask_bytes);
+        }
+
+        void swap_64_ssse3(std::uint8_t *data, const std::size_t count)
+        {
+            const std::size_t done = shuffle_ssse3(data, count * sizeof(std::uint64_t), reverse_64_mask);
+            swap_64_scalar(data + done, count - done / sizeof(std::uint64_t));
+        }
+
+        void swap_32_ssse3(std::uint8_t *data, const std::size_t count)
+        {
+            const std::size_t done = shuffle_ssse3(data, count * sizeof(std::uint32_t), reverse_32_mask);
+            swap_32_scalar(data + done, count - done / sizeof(std::uint32_t));
+        }
+
+        void swap_64_avx2(std::uint8_t *data, const std::size_t count)
+        {
+            const std::size_t done = shuffle_avx2(data, count * sizeof(std::uint64_t), reverse_64_mask);
+            swap_64_scalar(data + done, count - done / sizeof(std::uint64_t));
+        }
+
+        void swap_32_avx2(std::uint8_t *data, const std::size_t count)
+        {
+            const std::size_t done = shuffle_avx2(data, count * sizeof(std::uint32_t), reverse_32_mask);
+            swap_32_scalar(data + done, count - done / sizeof(std::uint32_t));
+        }
+#endif
+
+        ByteswapKernels select_kernels() noexcept
+        {
+#if OZZY_BYTESWAP_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return {swap_64_avx2, swap_32_avx2, "avx2"};
+            }
+            if (__builtin_cpu_supports("ssse3"))
+            {
+                return {swap_64_ssse3, swap_32_ssse3, "ssse3"};
+            }
+#endif
+            return {swap_64_scalar, swap_32_scalar, "scalar"};
+        }
+
+        const ByteswapKernels &kernels() noexcept
+        {
+            static const ByteswapKernels selected = select_kernels();
+            return selected;
+        }
+    }
+
+    void byteswap_64(void *data, const std::size_t count) noexcept
+    {
+        kernels().swap_64(static_cast<std::uint8_t*>(data), count);
+    }
+
+    void byteswap_32(void *data, const std::size_t count) noexcept
+    {
+        kernels().swap_32(static_cast<std::uint8_t*>(data), count);
+    }
+
+    const char *byteswap_kernel_name() noexcept
+    {
+        return kernels().name;
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef __OZZY_NETWORKING_BYTESWAP__
+#define __OZZY_NETWORKING_BYTESWAP__
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Ozzy::LibUDP
+{
+    // Reverse the bytes of every 8 byte word in place, the words are taken by the bit
+    // pattern(doubles stay the same doubles on the other side). Uses the widest
+    // shuffle(AVX2, SSSE3) this CPU has, picked once at the start.
+    void byteswap_64(void *data, std::size_t count) noexcept;
+
+    // Same as above for the 4 byte words
+    void byteswap_32(void *data, std::size_t count) noexcept;
+
+    // Name of the kernel byteswap_64() runs with, for the logs
+    const char *byteswap_kernel_name() noexcept;
+}
+
+#endif // __OZZY_NETWORKING_BYTESWAP__
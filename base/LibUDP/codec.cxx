@@ -0,0 +1,411 @@
+#include "codec.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+namespace Ozzy::LibUDP
+{
+    namespace
+    {
+        using Proto::v3::codec_max_values;
+
+        // Deltas of the frame being encoded(or decoded), the frames of the large datagrams carry
+        // tens of thousands of values, which is too much for the stack
+        std::uint64_t *deltas_scratch(const std::size_t count)
+        {
+            thread_local std::vector<std::uint64_t> deltas;
+            if (deltas.size() < count)
+            {
+                deltas.resize(count);
+            }
+            return deltas.data();
+        }
+
+        class IdentityCodec final : public PayloadCodec
+        {
+        public:
+            const char *name() const noexcept override
+            {
+                return "identity";
+            }
+
+            std::size_t encode(const std::span<const double> values, const std::span<std::uint8_t> output,
+                               std::size_t &size) const noexcept override
+            {
+                const std::size_t count = std::min(values.size(), output.size() / sizeof(double));
+                std::memcpy(output.data(), values.data(), count * sizeof(double));
+
+                size = count * sizeof(double);
+                return count;
+            }
+
+            bool decode(const std::span<const std::uint8_t> input, const std::span<double> values) const noexcept override
+            {
+                if (values.size() * sizeof(double) > input.size())
+                {
+                    return false;
+                }
+
+                std::memcpy(values.data(), input.data(), values.size() * sizeof(double));
+                return true;
+            }
+        };
+
+        // The first value is stored as is, every next one is XOR-ed with the previous one and
+        // split into 8 byte planes(the plane `p` has the byte `p` of every value). The plane is
+        // stored as
+        //
+        //   [0][n raw bytes]  or  [d][d dictionary bytes][n indices of 0, 1, 2 or 4 bits]
+        //
+        // For the bounded values the sign/exponent planes have a few distinct bytes, so they
+        // take 2-4 bits per value instead of 8(and nothing at all when they are the same).
+        class ShuffleXorCodec final : public PayloadCodec
+        {
+        public:
+            const char *name() const noexcept override
+            {
+                return "shuffle-xor";
+            }
+
+            std::size_t encode(const std::span<const double> values, const std::span<std::uint8_t> output,
+                               std::size_t &size) const noexcept override
+            {
+                const std::size_t limit = std::min(values.size(), codec_max_values(output.size() / sizeof(double)));
+                if (limit == 0 || output.size() < sizeof(double) + PLANES)
+                {
+                    size = 0;
+                    return 0;
+                }
+
+                std::uint64_t *deltas = deltas_scratch(limit);
+
+                // Index of the byte in the plane dictionary plus one, zero if the byte is not seen yet
+                std::array<std::array<std::uint8_t, 256>, PLANES> indices{};
+                std::array<std::array<std::uint8_t, MAX_DICTIONARY>, PLANES> dictionaries;
+                std::array<std::size_t, PLANES> distinct{};
+
+                // Planes that may still take the dictionary, the rest are stored raw for sure
+                std::array<std::size_t, PLANES> tracked;
+                std::size_t                     tracked_count = PLANES;
+                for (std::size_t plane = 0; plane < PLANES; ++plane)
+                {
+                    tracked[plane] = plane;
+                }
+
+                // Take the values while the encoded planes still fit into the output, `count` is
+                // the count of the deltas(the values after the first one)
+                //
+                // The plane grows by one byte per value at most, unless its dictionary grows, so the
+                // exact size is calculated only when the dictionary grows or the output is almost full
+                std::size_t   count    = 0;
+                std::size_t   bound    = sizeof(double) + PLANES;
+                std::uint64_t previous = std::bit_cast<std::uint64_t>(values[0]);
+
+                for (; count + 1 < limit; ++count)
+                {
+                    const std::uint64_t bits  = std::bit_cast<std::uint64_t>(values[count + 1]);
+                    const std::uint64_t delta = bits ^ previous;
+
+                    bool dictionary_grows = false;
+                    for (std::size_t i = 0; i < tracked_count; ++i)
+                    {
+                        const std::size_t  plane = tracked[i];
+                        const std::uint8_t byte  = static_cast<std::uint8_t>(delta >> (plane * 8));
+                        dictionary_grows |= indices[plane][byte] == 0;
+                    }
+
+                    if (dictionary_grows || bound + PLANES > output.size())
+                    {
+                        std::size_t encoded_size = sizeof(double) + (PLANES - tracked_count) * (1 + count + 1);
+                        for (std::size_t i = 0; i < tracked_count; ++i)
+                        {
+                            const std::size_t  plane = tracked[i];
+                            const std::uint8_t byte  = static_cast<std::uint8_t>(delta >> (plane * 8));
+                            encoded_size += plane_size(count + 1, distinct[plane] + (indices[plane][byte] == 0));
+                        }
+
+                        if (encoded_size > output.size())
+                        {
+                            break;
+                        }
+                        bound = encoded_size;
+                    }
+                    else
+                    {
+                        bound += PLANES;
+                    }
+
+                    for (std::size_t i = 0; i < tracked_count;)
+                    {
+                        const std::size_t  plane = tracked[i];
+                        const std::uint8_t byte  = static_cast<std::uint8_t>(delta >> (plane * 8));
+                        if (indices[plane][byte] != 0)
+                        {
+                            ++i;
+                            continue;
+                        }
+
+                        // Planes with too much distinct bytes are stored raw, and are not tracked anymore
+                        if (distinct[plane] == MAX_DICTIONARY)
+                        {
+                            distinct[plane] = MAX_DICTIONARY + 1;
+                            tracked [i]     = tracked[--tracked_count];
+                            continue;
+                        }
+
+                        dictionaries[plane][distinct[plane]] = byte;
+                        indices     [plane][byte]            = static_cast<std::uint8_t>(++distinct[plane]);
+                        ++i;
+                    }
+
+                    deltas[count] = delta;
+                    previous      = bits;
+                }
+
+                // The stream is the same on every host, so the first value goes least significant byte first
+                std::uint8_t *out   = output.data();
+                std::uint64_t first = std::bit_cast<std::uint64_t>(values[0]);
+                for (std::size_t i = 0; i < sizeof(double); ++i, first >>= 8)
+                {
+                    *out++ = static_cast<std::uint8_t>(first);
+                }
+
+                for (std::size_t plane = 0; plane < PLANES; ++plane)
+                {
+                    const std::size_t shift = plane * 8;
+
+                    if (!use_dictionary(count, distinct[plane]))
+                    {
+                        *out++ = 0;
+                        for (std::size_t i = 0; i < count; ++i)
+                        {
+                            out[i] = static_cast<std::uint8_t>(deltas[i] >> shift);
+                        }
+                        out += count;
+                        continue;
+                    }
+
+                    *out++ = static_cast<std::uint8_t>(distinct[plane]);
+                    std::memcpy(out, dictionaries[plane].data(), distinct[plane]);
+                    out += distinct[plane];
+
+                    const std::size_t width = index_width(distinct[plane]);
+                    if (width == 0)
+                    {
+                        continue;
+                    }
+
+                    switch (width)
+                    {
+                        case 1:  out += pack<1>(deltas, count, shift, indices[plane].data(), out); break;
+                        case 2:  out += pack<2>(deltas, count, shift, indices[plane].data(), out); break;
+                        default: out += pack<4>(deltas, count, shift, indices[plane].data(), out); break;
+                    }
+                }
+
+                size = static_cast<std::size_t>(out - output.data());
+                return count + 1;
+            }
+
+            bool decode(const std::span<const std::uint8_t> input, const std::span<double> values) const noexcept override
+            {
+                if (values.empty())
+                {
+                    return true;
+                }
+
+                if (values.size() > codec_max_values(input.size() / sizeof(double)) || input.size() < sizeof(double))
+                {
+                    return false;
+                }
+
+                const std::size_t count = values.size() - 1;
+
+                std::uint64_t *deltas = deltas_scratch(count);
+                std::fill_n(deltas, count, 0);
+
+                std::uint64_t previous = 0;
+                for (std::size_t i = 0; i < sizeof(double); ++i)
+                {
+                    previous |= static_cast<std::uint64_t>(input[i]) << (i * 8);
+                }
+
+                const std::uint8_t *in  = input.data() + sizeof(double);
+                const std::uint8_t *end = input.data() + input.size();
+
+                for (std::size_t plane = 0; plane < PLANES; ++plane)
+                {
+                    const std::size_t shift = plane * 8;
+                    if (in == end)
+                    {
+                        return false;
+                    }
+
+                    const std::size_t dictionary_size = *in++;
+                    if (dictionary_size == 0)
+                    {
+                        if (static_cast<std::size_t>(end - in) < count)
+                        {
+                            return false;
+                        }
+
+                        for (std::size_t i = 0; i < count; ++i)
+                        {
+                            deltas[i] |= static_cast<std::uint64_t>(in[i]) << shift;
+                        }
+                        in += count;
+                        continue;
+                    }
+
+                    if (dictionary_size > MAX_DICTIONARY)
+                    {
+                        return false;
+                    }
+
+                    const std::size_t width    = index_width(dictionary_size);
+                    const std::size_t per_byte = width == 0 ? 0 : 8 / width;
+                    const std::size_t packed   = width == 0 ? 0 : (count + per_byte - 1) / per_byte;
+
+                    if (static_cast<std::size_t>(end - in) < dictionary_size + packed)
+                    {
+                        return false;
+                    }
+
+                    const std::uint8_t *dictionary = in;
+                    in += dictionary_size;
+
+                    if (width == 0)
+                    {
+                        const std::uint64_t byte = static_cast<std::uint64_t>(dictionary[0]) << shift;
+                        for (std::size_t i = 0; i < count; ++i)
+                        {
+                            deltas[i] |= byte;
+                        }
+                        continue;
+                    }
+
+                    // Indices that point past the dictionary take zero, the checksum has already
+                    // passed, so that is never the case for the valid sender
+                    std::array<std::uint64_t, 1 << MAX_INDEX_WIDTH> plane_bytes{};
+                    for (std::size_t i = 0; i < dictionary_size; ++i)
+                    {
+                        plane_bytes[i] = static_cast<std::uint64_t>(dictionary[i]) << shift;
+                    }
+
+                    switch (width)
+                    {
+                        case 1:  unpack<1>(in, count, plane_bytes.data(), deltas); break;
+                        case 2:  unpack<2>(in, count, plane_bytes.data(), deltas); break;
+                        default: unpack<4>(in, count, plane_bytes.data(), deltas); break;
+                    }
+                    in += packed;
+                }
+
+                values[0] = std::bit_cast<double>(previous);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    previous     ^= deltas[i];
+                    values[i + 1] = std::bit_cast<double>(previous);
+                }
+                return true;
+            }
+
+        private:
+            static constexpr std::size_t PLANES          = sizeof(double);
+            static constexpr std::size_t MAX_DICTIONARY  = 16;
+            static constexpr std::size_t MAX_INDEX_WIDTH = 4;
+
+            // Pack the dictionary indices of the plane bytes, returns the count of the bytes written
+            template<std::size_t Width>
+            static std::size_t pack(const std::uint64_t *deltas, const std::size_t count, const std::size_t shift,
+                                    const std::uint8_t *indices, std::uint8_t *out) noexcept
+            {
+                constexpr std::size_t per_byte = 8 / Width;
+
+                const std::size_t packed = (count + per_byte - 1) / per_byte;
+                for (std::size_t i = 0; i < packed; ++i)
+                {
+                    std::uint8_t byte = 0;
+                    for (std::size_t j = 0; j < per_byte && i * per_byte + j < count; ++j)
+                    {
+                        const std::uint8_t index = indices[static_cast<std::uint8_t>(deltas[i * per_byte + j] >> shift)] - 1;
+                        byte |= static_cast<std::uint8_t>(index << (j * Width));
+                    }
+                    out[i] = byte;
+                }
+                return packed;
+            }
+
+            template<std::size_t Width>
+            static void unpack(const std::uint8_t *in, const std::size_t count, const std::uint64_t *plane_bytes,
+                               std::uint64_t *deltas) noexcept
+            {
+                constexpr std::size_t  per_byte = 8 / Width;
+                constexpr std::uint8_t mask     = (1u << Width) - 1;
+
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    deltas[i] |= plane_bytes[(in[i / per_byte] >> ((i % per_byte) * Width)) & mask];
+                }
+            }
+
+            // Indices never cross the byte boundary
+            static constexpr std::size_t index_width(const std::size_t distinct) noexcept
+            {
+                return distinct <= 1 ? 0 : distinct <= 2 ? 1 : distinct <= 4 ? 2 : 4;
+            }
+
+            static constexpr std::size_t dictionary_plane_size(const std::size_t count, const std::size_t distinct) noexcept
+            {
+                return distinct + (count * index_width(distinct) + 7) / 8;
+            }
+
+            static constexpr bool use_dictionary(const std::size_t count, const std::size_t distinct) noexcept
+            {
+                return distinct <= MAX_DICTIONARY && dictionary_plane_size(count, distinct) < count;
+            }
+
+            static constexpr std::size_t plane_size(const std::size_t count, const std::size_t distinct) noexcept
+            {
+                return 1 + (use_dictionary(count, distinct) ? dictionary_plane_size(count, distinct) : count);
+            }
+        };
+
+        const IdentityCodec   identity_codec;
+        const ShuffleXorCodec shuffle_xor_codec;
+    }
+
+    const PayloadCodec &payload_codec(const Proto::v3::Codec codec) noexcept
+    {
+        switch (codec)
+        {
+            case Proto::v3::CODEC_SHUFFLE_XOR:
+                return shuffle_xor_codec;
+
+            default:
+                return identity_codec;
+        }
+    }
+
+    std::uint8_t supported_codecs() noexcept
+    {
+#if OZZY_USE_PAYLOAD_CODEC
+        return Proto::v3::codec_bit(Proto::v3::CODEC_IDENTITY) | Proto::v3::codec_bit(Proto::v3::CODEC_SHUFFLE_XOR);
+#else
+        return Proto::v3::codec_bit(Proto::v3::CODEC_IDENTITY);
+#endif
+    }
+
+    Proto::v3::Codec pick_codec(const std::uint8_t local, const std::uint8_t remote) noexcept
+    {
+        const std::uint8_t common = local & remote;
+        if (common & Proto::v3::codec_bit(Proto::v3::CODEC_SHUFFLE_XOR))
+        {
+            return Proto::v3::CODEC_SHUFFLE_XOR;
+        }
+        return Proto::v3::CODEC_IDENTITY;
+    }
+}
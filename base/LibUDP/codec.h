@@ -0,0 +1,44 @@
+#ifndef __OZZY_NETWORKING_CODEC__
+#define __OZZY_NETWORKING_CODEC__
+
+#include "protocol.h"
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+// Offer the compressing payload codecs in the handshake. With 0 only the identity codec
+// is offered, and the frames carry the raw doubles as before.
+#ifndef OZZY_USE_PAYLOAD_CODEC
+#   define OZZY_USE_PAYLOAD_CODEC 1
+#endif
+
+namespace Ozzy::LibUDP
+{
+    // Packs the values into the payload bytes of the frame, the frame carries as many
+    // values as the codec manages to fit
+    class PayloadCodec
+    {
+    public:
+        virtual ~PayloadCodec() = default;
+
+        virtual const char *name() const noexcept = 0;
+
+        // Encode the values from the front of `values` into the `output`, returns how much
+        // values are encoded, `size` gets the count of the bytes written
+        virtual std::size_t encode(std::span<const double> values, std::span<std::uint8_t> output,
+                                   std::size_t &size) const noexcept = 0;
+
+        // Decode `values.size()` values from the `input`, false if the input is malformed
+        virtual bool decode(std::span<const std::uint8_t> input, std::span<double> values) const noexcept = 0;
+    };
+
+    const PayloadCodec &payload_codec(Proto::v3::Codec codec) noexcept;
+
+    // Bitmask of the codecs we offer(v3::codec_bit)
+    std::uint8_t supported_codecs() noexcept;
+
+    // The densest codec from both bitmasks, CODEC_IDENTITY if there is nothing in common
+    Proto::v3::Codec pick_codec(std::uint8_t local, std::uint8_t remote) noexcept;
+}
+
+#endif // __OZZY_NETWORKING_CODEC__
@@ -0,0 +1,196 @@
+#include "demux.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+namespace Ozzy::LibUDP
+{
+    SessionInbox::SessionInbox(session_strand_t executor, const std::uint32_t id)
+        : m_executor(std::move(executor)), m_signal(m_executor), m_id(id)
+    {
+        m_signal.expires_at(std::chrono::steady_clock::time_point::max());
+    }
+
+    void SessionInbox::deliver(const std::shared_ptr<SessionInbox> &inbox, const std::uint8_t *data,
+                               const std::size_t size)
+    {
+        // The handler memory is recycled by asio, so the delivery doesn't touch the heap
+        Datagram datagram;
+        datagram.size = std::min(size, MAX_DATAGRAM_SIZE);
+        std::memcpy(datagram.data.data(), data, datagram.size);
+
+        boost::asio::post(inbox->m_executor, [inbox, datagram]
+        {
+            if (inbox->m_closed || inbox->m_queued == MAX_QUEUED_DATAGRAMS)
+            {
+                return;
+            }
+
+            inbox->m_datagrams[(inbox->m_first + inbox->m_queued) % MAX_QUEUED_DATAGRAMS] = datagram;
+            ++inbox->m_queued;
+            inbox->m_signal.cancel();
+        });
+    }
+
+    boost::asio::awaitable<bool> SessionInbox::async_wait(const std::chrono::steady_clock::time_point deadline)
+    {
+        // The delivery runs on the same strand, so it never slips in between the check and the wait
+        while (m_queued == 0)
+        {
+            if (m_closed || std::chrono::steady_clock::now() >= deadline)
+            {
+                co_return false;
+            }
+
+            boost::system::error_code error_code;
+            m_signal.expires_at(deadline);
+            co_await m_signal.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error_code));
+        }
+
+        co_return true;
+    }
+
+    void SessionInbox::close()
+    {
+        m_closed = true;
+        m_queued = 0;
+        m_signal.cancel();
+    }
+
+    SessionTable::SessionTable(const std::size_t capacity)
+        : m_mask(std::bit_ceil(std::max<std::size_t>(capacity * 2, 16)) - 1),
+          m_slots(std::make_unique<Slot[]>(m_mask + 1))
+    {
+    }
+
+    std::uint64_t SessionTable::endpoint_key(const udp::endpoint &endpoint) noexcept
+    {
+        if (!endpoint.address().is_v4())
+        {
+            return EMPTY;
+        }
+
+        // The bit above the address keeps the key away from EMPTY and TOMBSTONE
+        return 1ULL << 48 | static_cast<std::uint64_t>(endpoint.address().to_v4().to_uint()) << 16 | endpoint.port();
+    }
+
+    std::size_t SessionTable::home_slot(const std::uint64_t key) const noexcept
+    {
+        // Fibonacci hashing, the ports of one client differ only in the low bits
+        return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & m_mask;
+    }
+
+    bool SessionTable::insert(const udp::endpoint &endpoint, std::shared_ptr<SessionInbox> inbox)
+    {
+        const std::uint64_t key = endpoint_key(endpoint);
+        if (key == EMPTY)
+        {
+            return false;
+        }
+
+        std::lock_guard lock(m_writers_mutex);
+
+        // The key may be anywhere up to the empty slot, so the first tombstone is only remembered
+        Slot *free_slot = nullptr;
+        for (std::size_t probe = 0, index = home_slot(key); probe <= m_mask; ++probe, index = (index + 1) & m_mask)
+        {
+            Slot &slot = m_slots[index];
+
+            const std::uint64_t current = slot.key.load(std::memory_order_acquire);
+            if (current == key)
+            {
+                return false;
+            }
+
+            if (current == TOMBSTONE && !free_slot)
+            {
+                free_slot = &slot;
+            }
+            else if (current == EMPTY)
+            {
+                free_slot = free_slot ? free_slot : &slot;
+                break;
+            }
+        }
+
+        if (!free_slot)
+        {
+            return false;
+        }
+
+        // The inbox is published after the key, find() treats the slot without it as a miss
+        free_slot->key.store(key, std::memory_order_release);
+        free_slot->inbox.store(std::move(inbox), std::memory_order_release);
+        return true;
+    }
+
+    std::shared_ptr<SessionInbox> SessionTable::find(const udp::endpoint &endpoint) const
+    {
+        const std::uint64_t key = endpoint_key(endpoint);
+        if (key == EMPTY)
+        {
+            return nullptr;
+        }
+
+        for (std::size_t probe = 0, index = home_slot(key); probe <= m_mask; ++probe, index = (index + 1) & m_mask)
+        {
+            const std::uint64_t current = m_slots[index].key.load(std::memory_order_acquire);
+            if (current == key)
+            {
+                return m_slots[index].inbox.load(std::memory_order_acquire);
+            }
+
+            if (current == EMPTY)
+            {
+                break;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void SessionTable::erase(const udp::endpoint &endpoint, const std::uint32_t id)
+    {
+        const std::uint64_t key = endpoint_key(endpoint);
+        if (key == EMPTY)
+        {
+            return;
+        }
+
+        std::lock_guard lock(m_writers_mutex);
+
+        for (std::size_t probe = 0, index = home_slot(key); probe <= m_mask; ++probe, index = (index + 1) & m_mask)
+        {
+            Slot &slot = m_slots[index];
+
+            const std::uint64_t current = slot.key.load(std::memory_order_acquire);
+            if (current == EMPTY)
+            {
+                return;
+            }
+
+            const std::shared_ptr<SessionInbox> inbox = current == key ? slot.inbox.load(std::memory_order_acquire)
+                                                                       : nullptr;
+            if (!inbox || inbox->id() != id)
+            {
+                continue;
+            }
+
+            slot.inbox.store(nullptr, std::memory_order_release);
+            slot.key.store(TOMBSTONE, std::memory_order_release);
+
+            // The tombstones right before the empty slot end no probe chain, so they are emptied
+            // back, otherwise the misses(every new handshake is one) would walk the whole table.
+            // No insert runs meanwhile, so nothing is claimed behind them, and find() never
+            // looks past the empty slot anyway.
+            while (m_slots[index].key.load(std::memory_order_acquire) == TOMBSTONE &&
+                   m_slots[(index + 1) & m_mask].key.load(std::memory_order_acquire) == EMPTY)
+            {
+                m_slots[index].key.store(EMPTY, std::memory_order_release);
+                index = (index - 1) & m_mask;
+            }
+            return;
+        }
+    }
+}
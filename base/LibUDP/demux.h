@@ -0,0 +1,129 @@
+#ifndef __OZZY_NETWORKING_DEMUX__
+#define __OZZY_NETWORKING_DEMUX__
+
+#include <utility>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <boost/asio.hpp>
+
+// Run the server sessions on the listener sockets instead of opening the socket per session, the
+// datagrams of the clients are routed to the sessions by the SessionTable
+#ifndef OZZY_USE_SHARED_SESSION_SOCKET
+#   define OZZY_USE_SHARED_SESSION_SOCKET 0
+#endif
+
+namespace Ozzy::LibUDP
+{
+    using boost::asio::ip::udp;
+
+    using session_strand_t = boost::asio::strand<boost::asio::io_context::executor_type>;
+
+    // Datagrams of the client routed to the session that shares the listener socket. The inbox
+    // belongs to the session strand, everything but deliver() must be called on it.
+    class SessionInbox
+    {
+    public:
+        // The client sends only the small control messages to the session(the handshake answers
+        // and the acknowledgements), the longer datagrams are truncated
+        static constexpr std::size_t MAX_DATAGRAM_SIZE = 256;
+
+        // Datagrams above that are dropped, just like the full socket buffer would do
+        static constexpr std::size_t MAX_QUEUED_DATAGRAMS = 64;
+
+        struct Datagram
+        {
+            std::size_t                                size = 0;
+            std::array<std::uint8_t, MAX_DATAGRAM_SIZE> data;
+        };
+
+        SessionInbox(session_strand_t executor, std::uint32_t id);
+
+        // Queue the copy of the datagram on the session strand, safe to call from any thread
+        static void deliver(const std::shared_ptr<SessionInbox> &inbox, const std::uint8_t *data, std::size_t size);
+
+        // Wait for the datagram until the `deadline`, false on timeout or when the inbox is closed
+        boost::asio::awaitable<bool> async_wait(std::chrono::steady_clock::time_point deadline);
+
+        // The oldest queued datagram, nullptr if there is none. It stays valid until pop().
+        const Datagram *front() const noexcept
+        {
+            return m_queued == 0 ? nullptr : &m_datagrams[m_first];
+        }
+
+        void pop() noexcept
+        {
+            m_first = (m_first + 1) % MAX_QUEUED_DATAGRAMS;
+            --m_queued;
+        }
+
+        // Drop everything queued and wake the waiting session
+        void close();
+
+        std::uint32_t id() const noexcept
+        {
+            return m_id;
+        }
+
+    private:
+        session_strand_t                      m_executor;
+
+        // Never expires on its own, the delivery cancels the wait
+        boost::asio::steady_timer                         m_signal;
+
+        // Ring of the queued datagrams, the inbox takes no memory after it's created
+        std::array<Datagram, MAX_QUEUED_DATAGRAMS>        m_datagrams;
+        std::size_t                                       m_first  = 0;
+        std::size_t                                       m_queued = 0;
+
+        const std::uint32_t                               m_id;
+        bool                                              m_closed = false;
+    };
+
+    // Inboxes of the sessions by the client endpoint. The listeners look the sessions up without
+    // taking any lock. Insert and erase(once per session) are serialized with the mutex, so no
+    // live key is ever left behind the empty slot of its probe chain. The session id keeps the
+    // finished session from removing the newer one of the same endpoint.
+    class SessionTable
+    {
+    public:
+        // Table for up to `capacity` sessions at once
+        explicit SessionTable(std::size_t capacity);
+
+        // False if the endpoint already has the session, or the table is full
+        bool insert(const udp::endpoint &endpoint, std::shared_ptr<SessionInbox> inbox);
+
+        std::shared_ptr<SessionInbox> find(const udp::endpoint &endpoint) const;
+
+        // Remove the session `id` of the endpoint, if it is still there
+        void erase(const udp::endpoint &endpoint, std::uint32_t id);
+
+    private:
+        static constexpr std::uint64_t EMPTY     = 0;
+        static constexpr std::uint64_t TOMBSTONE = 1;
+
+        struct Slot
+        {
+            std::atomic<std::uint64_t>                 key{EMPTY};
+            std::atomic<std::shared_ptr<SessionInbox>> inbox;
+        };
+
+        // Address and port of the IPv4 endpoint, EMPTY for the others(they are never shared)
+        static std::uint64_t endpoint_key(const udp::endpoint &endpoint) noexcept;
+
+        std::size_t home_slot(std::uint64_t key) const noexcept;
+
+    private:
+        std::size_t             m_mask;
+        std::unique_ptr<Slot[]> m_slots;
+
+        // Held by insert() and erase() only
+        std::mutex              m_writers_mutex;
+    };
+}
+
+#endif // __OZZY_NETWORKING_DEMUX__
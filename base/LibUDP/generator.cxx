@@ -0,0 +1,428 @@
+#include "generator.h"
+#include "LibTT/slab_pool.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <random>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define OZZY_GENERATOR_X86 1
+#else
+#   define OZZY_GENERATOR_X86 0
+#endif
+
+namespace Ozzy::LibUDP
+{
+    namespace
+    {
+        using state_t          = std::uint64_t[4][4];
+        using uniform_kernel_t = void(*)(state_t &state, double *values, std::size_t groups, double low, double span);
+
+        struct UniformKernel
+        {
+            uniform_kernel_t fill;
+            const char      *name;
+        };
+
+        // Bits of 1.0, the top 52 random bits are put under this exponent, which gives the
+        // double from [1, 2), and 1.0 is subtracted
+        constexpr std::uint64_t UNIT_EXPONENT = 0x3FF0000000000000ULL;
+
+        constexpr std::uint64_t rotl(const std::uint64_t value, const int shift) noexcept
+        {
+            return (value << shift) | (value >> (64 - shift));
+        }
+
+        std::uint64_t splitmix64(std::uint64_t &state) noexcept
+        {
+            std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        }
+
+        // Advance the stream of the lane by 2^128 values(the xoshiro256 jump polynomial)
+        void jump(state_t &state, const std::size_t lane) noexcept
+        {
+            constexpr std::uint64_t polynomial[] = {0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+                                                    0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL};
+
+            std::uint64_t jumped[4] = {};
+            for (const std::uint64_t word: polynomial)
+            {
+                for (int bit = 0; bit < 64; ++bit)
+                {
+                    if (word & (1ULL << bit))
+                    {
+                        for (std::size_t i = 0; i < 4; ++i)
+                        {
+                            jumped[i] ^= state[i][lane];
+                        }
+                    }
+
+                    std::uint64_t &s0 = state[0][lane], &s1 = state[1][lane], &s2 = state[2][lane], &s3 = state[3][lane];
+                    const std::uint64_t t = s1 << 17;
+                    s2 ^= s0;
+                    s3 ^= s1;
+                    s1 ^= s2;
+                    s0 ^= s3;
+                    s2 ^= t;
+                    s3  = rotl(s3, 45);
+                }
+            }
+
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                state[i][lane] = jumped[i];
+            }
+        }
+
+        void fill_scalar(state_t &state, double *values, const std::size_t groups, const double low, const double span)
+        {
+            for (std::size_t group = 0; group < groups; ++group)
+            {
+                for (std::size_t lane = 0; lane < 4; ++lane)
+                {
+                    std::uint64_t &s0 = state[0][lane], &s1 = state[1][lane], &s2 = state[2][lane], &s3 = state[3][lane];
+
+                    const std::uint64_t result = rotl(s0 + s3, 23) + s0;
+                    const std::uint64_t t      = s1 << 17;
+                    s2 ^= s0;
+                    s3 ^= s1;
+                    s1 ^= s2;
+                    s0 ^= s3;
+                    s2 ^= t;
+                    s3  = rotl(s3, 45);
+
+                    const double unit = std::bit_cast<double>((result >> 12) | UNIT_EXPONENT) - 1.0;
+                    values[group * 4 + lane] = low + unit * span;
+                }
+            }
+        }
+
+#if OZZY_GENERATOR_X86
+        template<int Shift>
+        __attribute__((target("avx2")))
+        inline __m256i rotl_avx2(const __m256i value) noexcept
+        {
+            return _mm256_or_si256(_mm256_slli_epi64(value, Shift), _mm256_srli_epi64(value, 64 - Shift));
+        }
+
+        // Same as the scalar kernel, the 4 lanes are the 4 streams
+        __attribute__((target("avx2")))
+        void fill_avx2(state_t &state, double *values, const std::size_t groups, const double low, const double span)
+        {
+            __m256i s0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[0]));
+            __m256i s1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[1]));
+            __m256i s2 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[2]));
+            __m256i s3 = _mm256_load_si256(reinterpret_cast<const __m256i*>(state[3]));
+
+            const __m256i exponent = _mm256_set1_epi64x(static_cast<long long>(UNIT_EXPONENT));
+            const __m256d one      = _mm256_set1_pd(1.0);
+            const __m256d lows     = _mm256_set1_pd(low);
+            const __m256d spans    = _mm256_set1_pd(span);
+
+            for (std::size_t group = 0; group < groups; ++group)
+            {
+                const __m256i result = _mm256_add_epi64(rotl_avx2<23>(_mm256_add_epi64(s0, s3)), s0);
+                const __m256i t      = _mm256_slli_epi64(s1, 17);
+                s2 = _mm256_xor_si256(s2, s0);
+                s3 = _mm256_xor_si256(s3, s1);
+                s1 = _mm256_xor_si256(s1, s2);
+                s0 = _mm256_xor_si256(s0, s3);
+                s2 = _mm256_xor_si256(s2, t);
+                s3 = rotl_avx2<45>(s3);
+
+                const __m256d unit = _mm256_sub_pd(
+                    _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(result, 12), exponent)), one);
+                _mm256_storeu_pd(values + group * 4, _mm256_add_pd(lows, _mm256_mul_pd(unit, spans)));
+            }
+
+            _mm256_store_si256(reinterpret_cast<__m256i*>(state[0]), s0);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(state[1]), s1);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(state[2]), s2);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(state[3]), s3);
+        }
+#endif
+
+        // Pick the fastest kernel once, the CPU does not change at runtime
+        UniformKernel select_kernel() noexcept
+        {
+#if OZZY_GENERATOR_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                return {fill_avx2, "xoshiro256++-avx2"};
+            }
+#endif
+            return {fill_scalar, "xoshiro256++-scalar"};
+        }
+
+        const UniformKernel &kernel() noexcept
+        {
+            static const UniformKernel selected = select_kernel();
+            return selected;
+        }
+
+        std::uint64_t random_device_seed()
+        {
+            std::random_device device;
+            return (static_cast<std::uint64_t>(device()) << 32) | device();
+        }
+    }
+
+    UniformGenerator::UniformGenerator()
+        : UniformGenerator(random_device_seed())
+    {
+    }
+
+    UniformGenerator::UniformGenerator(std::uint64_t seed) noexcept
+    {
+        // Every next lane is the previous one jumped ahead, so the lanes never overlap
+        for (std::size_t i = 0; i < 4; ++i)
+        {
+            m_state[i][0] = splitmix64(seed);
+        }
+
+        for (std::size_t lane = 1; lane < LANES; ++lane)
+        {
+            for (std::size_t i = 0; i < 4; ++i)
+            {
+                m_state[i][lane] = m_state[i][lane - 1];
+            }
+            jump(m_state, lane);
+        }
+    }
+
+    void UniformGenerator::fill(double *values, const std::size_t count, const double low, const double high) noexcept
+    {
+        const std::size_t groups = count / LANES;
+        kernel().fill(m_state, values, groups, low, high - low);
+
+        // The lanes of the last group that are not asked for are dropped
+        if (const std::size_t rest = count % LANES; rest > 0)
+        {
+            double tail[LANES];
+            kernel().fill(m_state, tail, 1, low, high - low);
+            std::copy_n(tail, rest, values + groups * LANES);
+        }
+    }
+
+    UniformGenerator UniformGenerator::split() noexcept
+    {
+        UniformGenerator taken = *this;
+        for (std::size_t lane = 0; lane < LANES; ++lane)
+        {
+            for (std::size_t i = 0; i < LANES; ++i)
+            {
+                jump(m_state, lane);
+            }
+        }
+        return taken;
+    }
+
+    const char *uniform_kernel_name() noexcept
+    {
+        return kernel().name;
+    }
+
+    PayloadStream::PayloadStream(UniformGenerator &generator, const std::uint64_t count, const double low,
+                                 const double high)
+        : m_count(count), m_low(low), m_high(high), m_producer(generator.split()), m_consumer(generator.split())
+    {
+    }
+
+    std::size_t PayloadStream::claim(const std::size_t count) noexcept
+    {
+        std::uint64_t claimed = m_claimed.load(std::memory_order_relaxed);
+        std::size_t   taken;
+        do
+        {
+            taken = static_cast<std::size_t>(std::min<std::uint64_t>(count, m_count - claimed));
+            if (taken == 0)
+            {
+                return 0;
+            }
+        }
+        while (!m_claimed.compare_exchange_weak(claimed, claimed + taken, std::memory_order_relaxed));
+
+        return taken;
+    }
+
+    bool PayloadStream::produce() noexcept
+    {
+        // Only this thread moves `m_produced`, the sender releases the block with `m_consumed`
+        const std::uint64_t produced = m_produced.load(std::memory_order_relaxed);
+        if (produced - m_consumed.load(std::memory_order_acquire) >= RING_BLOCKS)
+        {
+            return false;
+        }
+
+        const std::size_t size = claim(BLOCK_VALUES);
+        if (size == 0)
+        {
+            return false;
+        }
+
+        const std::size_t block = produced % RING_BLOCKS;
+        m_producer.fill(m_blocks.data() + block * BLOCK_VALUES, size, m_low, m_high);
+        m_block_sizes[block] = size;
+
+        m_produced.store(produced + 1, std::memory_order_release);
+        return true;
+    }
+
+    void PayloadStream::take(double *values, std::size_t count) noexcept
+    {
+        while (count > 0)
+        {
+            const std::uint64_t consumed = m_consumed.load(std::memory_order_relaxed);
+            if (consumed < m_produced.load(std::memory_order_acquire))
+            {
+                const std::size_t block = consumed % RING_BLOCKS;
+                const std::size_t size  = m_block_sizes[block];
+                const std::size_t taken = std::min(count, size - m_block_offset);
+
+                std::memcpy(values, m_blocks.data() + block * BLOCK_VALUES + m_block_offset, taken * sizeof(double));
+                values         += taken;
+                count          -= taken;
+                m_block_offset += taken;
+
+                if (m_block_offset == size)
+                {
+                    m_block_offset = 0;
+                    m_consumed.store(consumed + 1, std::memory_order_release);
+
+                    if (m_generator)
+                    {
+                        m_generator->wake();
+                    }
+                }
+                continue;
+            }
+
+            // The generator thread is behind, don't wait for it
+            const std::size_t taken = claim(count);
+            if (taken == 0)
+            {
+                // Every value is claimed, the generator is finishing the last block right now
+                std::this_thread::yield();
+                continue;
+            }
+
+            m_consumer.fill(values, taken, m_low, m_high);
+            m_inline_values += taken;
+            values          += taken;
+            count           -= taken;
+        }
+    }
+
+    PayloadGenerator::PayloadGenerator()
+    {
+#if OZZY_USE_GENERATOR_THREAD
+        m_thread = std::thread([this]
+        {
+            run();
+        });
+#endif
+    }
+
+    PayloadGenerator::~PayloadGenerator()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_one();
+
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    std::shared_ptr<PayloadStream> PayloadGenerator::open_stream(const std::uint64_t count, const double low,
+                                                                 const double high)
+    {
+        std::shared_ptr<PayloadStream> stream;
+        {
+            std::lock_guard lock(m_mutex);
+            // The stream with its ring takes one block of the pool, the finished session gives it back
+            stream = std::allocate_shared<PayloadStream>(Component::PoolAllocator<PayloadStream>(),
+                                                         m_seed_generator, count, low, high);
+
+#if OZZY_USE_GENERATOR_THREAD
+            stream->m_generator = this;
+            m_streams.push_back(stream);
+            m_pending = true;
+#endif
+        }
+        m_wake.notify_one();
+
+        return stream;
+    }
+
+    void PayloadGenerator::wake() noexcept
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_pending = true;
+        }
+        m_wake.notify_one();
+    }
+
+    void PayloadGenerator::run()
+    {
+        std::vector<std::shared_ptr<PayloadStream>> streams;
+        for (;;)
+        {
+            {
+                std::unique_lock lock(m_mutex);
+                m_wake.wait(lock, [this]
+                {
+                    return m_quit || m_pending;
+                });
+
+                if (m_quit)
+                {
+                    return;
+                }
+                m_pending = false;
+
+                // Forget the streams of the finished sessions, and the ones that have every
+                // value generated already
+                std::erase_if(m_streams, [&streams](const std::weak_ptr<PayloadStream> &weak_stream)
+                {
+                    std::shared_ptr<PayloadStream> stream = weak_stream.lock();
+                    if (!stream || stream->exhausted())
+                    {
+                        return true;
+                    }
+
+                    streams.push_back(std::move(stream));
+                    return false;
+                });
+            }
+
+            // Fill every ring up, one block per stream in turn, so no session waits for the others
+            for (bool produced = true; produced;)
+            {
+                produced = false;
+                for (auto &stream: streams)
+                {
+                    produced |= stream->produce();
+                }
+            }
+
+            streams.clear();
+        }
+    }
+
+    PayloadGenerator &payload_generator()
+    {
+        static PayloadGenerator generator;
+        return generator;
+    }
+}
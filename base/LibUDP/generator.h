@@ -0,0 +1,167 @@
+#ifndef __OZZY_NETWORKING_GENERATOR__
+#define __OZZY_NETWORKING_GENERATOR__
+
+#include <utility>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Generate the session payloads on the dedicated thread ahead of the sender. With 0 the
+// session generates the values itself(with the same kernel) right before baking the frames.
+#ifndef OZZY_USE_GENERATOR_THREAD
+#   define OZZY_USE_GENERATOR_THREAD 1
+#endif
+
+// How much blocks of the values the generator thread keeps ready for every session
+#ifndef OZZY_GENERATOR_RING_BLOCKS
+#   define OZZY_GENERATOR_RING_BLOCKS 4
+#else
+#   if OZZY_GENERATOR_RING_BLOCKS < 2
+#       error "Invalid value set for OZZY_GENERATOR_RING_BLOCKS"
+#   endif
+#endif
+
+namespace Ozzy::LibUDP
+{
+    class PayloadGenerator;
+
+    // Four xoshiro256++ streams that are stepped together, so the AVX2 kernel keeps one state
+    // word of every stream in one register. Every kernel gives the same random bits.
+    class UniformGenerator
+    {
+    public:
+        // Seeded from the std::random_device
+        UniformGenerator();
+
+        explicit UniformGenerator(std::uint64_t seed) noexcept;
+
+        // Fill the `values` with the doubles uniformly distributed in [low, high)
+        void fill(double *values, std::size_t count, double low, double high) noexcept;
+
+        // Take the streams of this generator away: returns the generator with these streams and
+        // moves this one 4 * 2^128 values ahead, so the streams of both never overlap
+        UniformGenerator split() noexcept;
+
+    private:
+        static constexpr std::size_t LANES = 4;
+
+        // [word][lane], the state of the stream `i` is the column `i`
+        alignas(32) std::uint64_t m_state[4][LANES];
+    };
+
+    // Name of the kernel the values are generated with, for the logs
+    const char *uniform_kernel_name() noexcept;
+
+    // Values of one session, which are generated on the generator thread ahead of the sender
+    // and handed over through the ring of the blocks(one producer, one consumer)
+    class PayloadStream
+    {
+    public:
+        static constexpr std::size_t BLOCK_VALUES = 4096;
+        static constexpr std::size_t RING_BLOCKS  = OZZY_GENERATOR_RING_BLOCKS;
+
+        // The stream takes its generators away from the `generator`(look at UniformGenerator::split)
+        PayloadStream(UniformGenerator &generator, std::uint64_t count, double low, double high);
+
+        PayloadStream(const PayloadStream&) = delete;
+
+        PayloadStream &operator=(const PayloadStream&) = delete;
+
+        // Copy the next `count` values to the `values`, the values the generator thread hasn't
+        // made in time are generated right here, so the sender never waits for it
+        void take(double *values, std::size_t count) noexcept;
+
+        // Count of the values that were generated by the sender itself
+        std::uint64_t inline_values() const noexcept
+        {
+            return m_inline_values;
+        }
+
+    private:
+        friend class PayloadGenerator;
+
+        // Generate the next block on the generator thread, false if the ring is full or every
+        // value is already claimed
+        bool produce() noexcept;
+
+        bool exhausted() const noexcept
+        {
+            return m_claimed.load(std::memory_order_relaxed) >= m_count;
+        }
+
+        // Claim up to `count` of the values that are not generated yet
+        std::size_t claim(std::size_t count) noexcept;
+
+    private:
+        const std::uint64_t        m_count;
+        const double               m_low;
+        const double               m_high;
+
+        // Values taken by either side, the generator claims one block at a time
+        std::atomic<std::uint64_t> m_claimed{0};
+
+        // The ring is a part of the stream, which memory is recycled(look at open_stream())
+        std::array<double, RING_BLOCKS * BLOCK_VALUES> m_blocks;
+        std::array<std::size_t, RING_BLOCKS>           m_block_sizes{};
+
+        // Blocks published by the generator and fully taken by the sender
+        std::atomic<std::uint64_t> m_produced{0};
+        std::atomic<std::uint64_t> m_consumed{0};
+
+        // The generator thread side
+        UniformGenerator           m_producer;
+
+        // Generator thread that fills the ring, if any
+        PayloadGenerator          *m_generator = nullptr;
+
+        // The sender side
+        UniformGenerator           m_consumer;
+        std::size_t                m_block_offset  = 0;
+        std::uint64_t              m_inline_values = 0;
+    };
+
+    // Thread that fills the rings of every open stream, one block per stream at a time
+    class PayloadGenerator
+    {
+    public:
+        PayloadGenerator();
+
+        PayloadGenerator(const PayloadGenerator&) = delete;
+
+        PayloadGenerator &operator=(const PayloadGenerator&) = delete;
+
+        ~PayloadGenerator();
+
+        // Stream of `count` values from [low, high), seeded with its own part of the process
+        // generator(std::random_device is read once per process)
+        std::shared_ptr<PayloadStream> open_stream(std::uint64_t count, double low, double high);
+
+        // The sender took the block, so there is room in its ring
+        void wake() noexcept;
+
+    private:
+        void run();
+
+    private:
+        std::mutex                                m_mutex;
+        std::condition_variable                   m_wake;
+        bool                                      m_pending = false;
+        bool                                      m_quit    = false;
+
+        UniformGenerator                          m_seed_generator;
+        std::vector<std::weak_ptr<PayloadStream>> m_streams;
+
+        std::thread                               m_thread;
+    };
+
+    // Process-wide generator, created on the first use
+    PayloadGenerator &payload_generator();
+}
+
+#endif // __OZZY_NETWORKING_GENERATOR__
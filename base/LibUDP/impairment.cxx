@@ -0,0 +1,382 @@
+#include "impairment.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cerrno>
+#include <sstream>
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace Ozzy::LibUDP
+{
+    namespace
+    {
+        bool parse_number(const std::string &text, double &value)
+        {
+            const char *end = text.data() + text.size();
+            const auto result = std::from_chars(text.data(), end, value);
+            return result.ec == std::errc() && result.ptr == end;
+        }
+
+        bool parse_probability(const std::string &text, double &value)
+        {
+            return parse_number(text, value) && value >= 0.0 && value <= 1.0;
+        }
+
+        // Milliseconds of the specification, fractions are fine
+        bool parse_milliseconds(const std::string &text, std::chrono::microseconds &value)
+        {
+            double milliseconds = 0.0;
+            if (!parse_number(text, milliseconds) || milliseconds < 0.0 || milliseconds > 3600.0 * 1000.0)
+            {
+                return false;
+            }
+
+            value = std::chrono::microseconds(static_cast<std::int64_t>(milliseconds * 1000.0));
+            return true;
+        }
+
+        // Both halves of "first/second", the second one is optional
+        std::pair<std::string, std::string> split_pair(const std::string &text)
+        {
+            const std::size_t separator = text.find('/');
+            if (separator == std::string::npos)
+            {
+                return {text, std::string()};
+            }
+
+            return {text.substr(0, separator), text.substr(separator + 1)};
+        }
+    }
+
+    bool parse_link_impairment(const std::string &specification, LinkImpairment &impairment)
+    {
+        LinkImpairment parsed;
+
+        std::istringstream stream(specification);
+        for (std::string item; std::getline(stream, item, ',');)
+        {
+            if (item.empty())
+            {
+                continue;
+            }
+
+            const std::size_t equals = item.find('=');
+            if (equals == std::string::npos)
+            {
+                return false;
+            }
+
+            const std::string key   = item.substr(0, equals);
+            const std::string value = item.substr(equals + 1);
+
+            bool valid = false;
+            if (key == "loss")
+            {
+                valid = parse_probability(value, parsed.loss);
+            }
+            else if (key == "burst")
+            {
+                const auto [start, end] = split_pair(value);
+                valid = parse_probability(start, parsed.burst_start) &&
+                        (end.empty() || (parse_probability(end, parsed.burst_end) && parsed.burst_end > 0.0));
+            }
+            else if (key == "reorder")
+            {
+                const auto [chance, delay] = split_pair(value);
+                valid = parse_probability(chance, parsed.reorder) &&
+                        (delay.empty() || parse_milliseconds(delay, parsed.reorder_delay));
+            }
+            else if (key == "duplicate")
+            {
+                valid = parse_probability(value, parsed.duplicate);
+            }
+            else if (key == "corrupt")
+            {
+                const auto [chance, size] = split_pair(value);
+                const auto result = std::from_chars(size.data(), size.data() + size.size(), parsed.corrupt_size);
+                valid = parse_probability(chance, parsed.corrupt) &&
+                        (size.empty() || (result.ec == std::errc() && result.ptr == size.data() + size.size()));
+            }
+            else if (key == "delay")
+            {
+                valid = parse_milliseconds(value, parsed.delay);
+            }
+            else if (key == "jitter")
+            {
+                valid = parse_milliseconds(value, parsed.jitter);
+            }
+            else if (key == "rate")
+            {
+                double megabits = 0.0;
+                valid = parse_number(value, megabits) && megabits > 0.0 && megabits <= 1e6;
+                parsed.bandwidth = static_cast<std::uint64_t>(megabits * 1e6);
+            }
+            else if (key == "limit")
+            {
+                const auto result = std::from_chars(value.data(), value.data() + value.size(), parsed.queue_limit);
+                valid = result.ec == std::errc() && result.ptr == value.data() + value.size() && parsed.queue_limit > 0;
+            }
+            else if (key == "seed")
+            {
+                const auto result = std::from_chars(value.data(), value.data() + value.size(), parsed.seed);
+                valid = result.ec == std::errc() && result.ptr == value.data() + value.size();
+            }
+
+            if (!valid)
+            {
+                return false;
+            }
+        }
+
+        impairment = parsed;
+        return true;
+    }
+
+    std::string describe_link_impairment(const LinkImpairment &impairment)
+    {
+        const auto milliseconds = [](const std::chrono::microseconds value)
+        {
+            return static_cast<double>(value.count()) / 1000.0;
+        };
+
+        std::ostringstream stream;
+        stream << "loss="      << impairment.loss
+               << ",burst="    << impairment.burst_start << "/" << impairment.burst_end
+               << ",reorder="  << impairment.reorder << "/" << milliseconds(impairment.reorder_delay)
+               << ",duplicate="<< impairment.duplicate
+               << ",corrupt="  << impairment.corrupt << "/" << impairment.corrupt_size
+               << ",delay="    << milliseconds(impairment.delay)
+               << ",jitter="   << milliseconds(impairment.jitter)
+               << ",rate="     << static_cast<double>(impairment.bandwidth) / 1e6
+               << ",limit="    << impairment.queue_limit
+               << ",seed="     << impairment.seed;
+        return stream.str();
+    }
+
+    ImpairedLink::Descriptor::~Descriptor()
+    {
+        ::close(value);
+    }
+
+    ImpairedLink::~ImpairedLink()
+    {
+        {
+            std::lock_guard lock(m_mutex);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void ImpairedLink::configure(const LinkImpairment &impairment)
+    {
+        std::lock_guard lock(m_mutex);
+
+        m_impairment = impairment;
+        m_enabled    = impairment.enabled();
+        m_engine.seed(impairment.seed);
+        m_burst      = false;
+        m_link_free  = link_clock_t::time_point();
+
+        if (m_enabled && !m_thread.joinable())
+        {
+            m_thread = std::thread(&ImpairedLink::run, this);
+        }
+    }
+
+    ImpairedLink::link_clock_t::duration ImpairedLink::serialization(const std::size_t size) const noexcept
+    {
+        return std::chrono::duration_cast<link_clock_t::duration>(
+            std::chrono::duration<double>(static_cast<double>(size * 8) / static_cast<double>(m_impairment.bandwidth)));
+    }
+
+    ImpairedLink::link_clock_t::time_point ImpairedLink::schedule(const std::size_t size,
+                                                                  const link_clock_t::time_point now)
+    {
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+        // Every decision takes its number even when it doesn't matter, so one of them doesn't
+        // shift the others when the impairment is changed
+        const double burst   = chance(m_engine);
+        const double loss    = chance(m_engine);
+        const double reorder = chance(m_engine);
+        const double jitter  = chance(m_engine);
+
+        m_burst = m_burst ? burst >= m_impairment.burst_end : burst < m_impairment.burst_start;
+        if (m_burst || loss < m_impairment.loss)
+        {
+            m_statistics.lost.fetch_add(1, std::memory_order_relaxed);
+            return link_clock_t::time_point::min();
+        }
+
+        // Bandwidth limit, the datagram waits for the previous ones to leave the link
+        link_clock_t::time_point departure = now;
+        if (m_impairment.bandwidth > 0)
+        {
+            const link_clock_t::time_point start = std::max(now, m_link_free);
+            const link_clock_t::duration   carry = serialization(size);
+
+            if (start - now > carry * static_cast<link_clock_t::rep>(m_impairment.queue_limit))
+            {
+                m_statistics.overflowed.fetch_add(1, std::memory_order_relaxed);
+                return link_clock_t::time_point::min();
+            }
+
+            m_link_free = start + carry;
+            departure   = m_link_free;
+        }
+
+        link_clock_t::duration delay = m_impairment.delay;
+        if (m_impairment.jitter.count() > 0)
+        {
+            delay += std::chrono::duration_cast<link_clock_t::duration>(
+                m_impairment.jitter * (jitter * 2.0 - 1.0));
+        }
+
+        if (reorder < m_impairment.reorder)
+        {
+            m_statistics.reordered.fetch_add(1, std::memory_order_relaxed);
+            delay += m_impairment.reorder_delay;
+        }
+
+        return departure + std::max(delay, link_clock_t::duration::zero());
+    }
+
+    std::size_t ImpairedLink::send(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                                   const std::size_t datagram_size, const std::size_t count,
+                                   boost::system::error_code &error_code)
+    {
+        const auto *bytes = static_cast<const std::uint8_t*>(data);
+        std::shared_ptr<const Descriptor> descriptor;
+
+        error_code.clear();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const std::uint8_t *datagram = bytes + i * datagram_size;
+            const auto          now      = link_clock_t::now();
+
+            bool inline_send = false;
+            bool queued      = false;
+            {
+                std::lock_guard lock(m_mutex);
+                m_statistics.datagrams.fetch_add(1, std::memory_order_relaxed);
+
+                std::uniform_real_distribution<double> chance(0.0, 1.0);
+                const bool duplicate = chance(m_engine) < m_impairment.duplicate;
+                const bool corrupt   = chance(m_engine) < m_impairment.corrupt &&
+                                       datagram_size >= std::max<std::size_t>(m_impairment.corrupt_size, 1);
+                const auto flip      = m_engine();
+
+                const link_clock_t::time_point release = schedule(datagram_size, now);
+                if (release == link_clock_t::time_point::min())
+                {
+                    continue;
+                }
+
+                if (duplicate)
+                {
+                    m_statistics.duplicated.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                // Nothing to wait for, the caller sends it right away(so does the lossy only link).
+                // The corrupted datagram is the copy, the caller's data stays intact.
+                inline_send = !corrupt && release <= now && m_delayed.empty();
+
+                for (std::size_t copy = inline_send ? 1 : 0; copy < (duplicate ? 2 : 1); ++copy)
+                {
+                    if (!descriptor)
+                    {
+                        const int duplicated = ::dup(socket.native_handle());
+                        if (duplicated < 0)
+                        {
+                            error_code = boost::system::error_code(errno, boost::asio::error::get_system_category());
+                            return i;
+                        }
+                        descriptor = std::make_shared<const Descriptor>(duplicated);
+                    }
+
+                    std::vector<std::uint8_t> copied(datagram, datagram + datagram_size);
+                    if (corrupt && copy == 0)
+                    {
+                        copied[(flip >> 3) % datagram_size] ^= static_cast<std::uint8_t>(1u << (flip & 7));
+                        m_statistics.corrupted.fetch_add(1, std::memory_order_relaxed);
+                    }
+
+                    m_delayed.push(DelayedDatagram{release, m_order++, descriptor, endpoint, std::move(copied)});
+                    queued = true;
+                }
+            }
+
+            if (queued)
+            {
+                m_wakeup.notify_one();
+            }
+
+            if (!inline_send)
+            {
+                continue;
+            }
+
+            if (::sendto(socket.native_handle(), datagram, datagram_size, MSG_DONTWAIT, endpoint.data(),
+                         static_cast<socklen_t>(endpoint.size())) < 0)
+            {
+                error_code = errno == EAGAIN || errno == EWOULDBLOCK
+                             ? boost::system::error_code(boost::asio::error::would_block)
+                             : boost::system::error_code(errno, boost::asio::error::get_system_category());
+                return i;
+            }
+        }
+
+        return count;
+    }
+
+    void ImpairedLink::run()
+    {
+        std::unique_lock lock(m_mutex);
+
+        while (!m_stopping)
+        {
+            if (m_delayed.empty())
+            {
+                m_wakeup.wait(lock);
+                continue;
+            }
+
+            const link_clock_t::time_point release = m_delayed.top().release;
+            if (link_clock_t::now() < release)
+            {
+                m_wakeup.wait_until(lock, release);
+                continue;
+            }
+
+            // priority_queue::top() is const, the datagram is moved out of it anyway
+            DelayedDatagram datagram = std::move(const_cast<DelayedDatagram&>(m_delayed.top()));
+            m_delayed.pop();
+
+            lock.unlock();
+
+            // The link has carried it, the full socket send buffer drops it like the full router
+            // queue would(the rest, like the refused one of the closed session, are just lost)
+            if (::sendto(datagram.descriptor->value, datagram.data.data(), datagram.data.size(), MSG_DONTWAIT,
+                         datagram.endpoint.data(), static_cast<socklen_t>(datagram.endpoint.size())) < 0 &&
+                (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+            {
+                m_statistics.overflowed.fetch_add(1, std::memory_order_relaxed);
+            }
+            datagram.descriptor.reset();
+
+            lock.lock();
+        }
+    }
+
+    ImpairedLink &impaired_link()
+    {
+        static ImpairedLink link;
+        return link;
+    }
+}
@@ -0,0 +1,189 @@
+#ifndef __OZZY_NETWORKING_IMPAIRMENT__
+#define __OZZY_NETWORKING_IMPAIRMENT__
+
+#include <utility>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace Ozzy::LibUDP
+{
+    using boost::asio::ip::udp;
+
+    // What the emulated link does to the datagrams the process sends. Every process impairs
+    // only its own datagrams, so both peers need it to impair both directions.
+    struct LinkImpairment
+    {
+        // Chance of every datagram to be lost on its own
+        double                    loss           = 0.0;
+
+        // Gilbert-Elliott burst loss: the chance of the datagram to start the burst, and to end
+        // it, every datagram of the burst is lost(the mean burst is 1 / burst_end datagrams)
+        double                    burst_start    = 0.0;
+        double                    burst_end      = 1.0;
+
+        // Chance of the datagram to be held back for `reorder_delay`, so the next ones overtake it
+        double                    reorder        = 0.0;
+        std::chrono::microseconds reorder_delay{1000};
+
+        // Chance of the datagram to arrive twice
+        double                    duplicate      = 0.0;
+
+        // Chance of the datagram of at least `corrupt_size` bytes to arrive with one bit flipped.
+        // The v2 client answers the corrupted frame with NACK, its one byte answers have no
+        // checksum at all, so the size keeps them intact.
+        double                    corrupt        = 0.0;
+        std::size_t               corrupt_size   = 0;
+
+        // One way delay, every datagram gets the uniform [-jitter, jitter] on top of it
+        std::chrono::microseconds delay{0};
+        std::chrono::microseconds jitter{0};
+
+        // Bits per second the link carries, the datagrams wait in the queue of `queue_limit`
+        // datagrams for their turn and the ones above it are lost. No limit if zero.
+        std::uint64_t             bandwidth      = 0;
+        std::size_t               queue_limit    = 1000;
+
+        // Same seed and the same sequence of the sends give the same impairments
+        std::uint64_t             seed           = 1;
+
+        bool enabled() const noexcept
+        {
+            return loss > 0.0 || burst_start > 0.0 || reorder > 0.0 || duplicate > 0.0 || corrupt > 0.0 || delay.count() > 0 ||
+                   jitter.count() > 0 || bandwidth > 0;
+        }
+    };
+
+    // Parse the comma separated `key=value` list, e.g. "loss=0.01,burst=0.001/0.25,delay=20,rate=100".
+    // The delays are in milliseconds, the rate in megabits per second. False if anything is
+    // unknown or out of range.
+    bool parse_link_impairment(const std::string &specification, LinkImpairment &impairment);
+
+    std::string describe_link_impairment(const LinkImpairment &impairment);
+
+    // Process-wide counters of the emulated link
+    struct LinkStatistics
+    {
+        std::atomic<std::uint64_t> datagrams  {0};
+        std::atomic<std::uint64_t> lost       {0};
+        std::atomic<std::uint64_t> overflowed {0};
+        std::atomic<std::uint64_t> reordered  {0};
+        std::atomic<std::uint64_t> duplicated {0};
+        std::atomic<std::uint64_t> corrupted  {0};
+    };
+
+    // Sits between the senders and the sockets. The datagrams that go right away are sent by
+    // the caller, the delayed ones are sent later by the link thread through the duplicate of
+    // the socket descriptor(so the socket may be closed in the meantime).
+    class ImpairedLink
+    {
+    public:
+        ImpairedLink() = default;
+
+        ~ImpairedLink();
+
+        ImpairedLink(const ImpairedLink&) = delete;
+
+        ImpairedLink &operator=(const ImpairedLink&) = delete;
+
+        // Should be called before anything is sent
+        void configure(const LinkImpairment &impairment);
+
+        bool enabled() const noexcept
+        {
+            return m_enabled;
+        }
+
+        const LinkImpairment &impairment() const noexcept
+        {
+            return m_impairment;
+        }
+
+        const LinkStatistics &statistics() const noexcept
+        {
+            return m_statistics;
+        }
+
+        // Same contract as send_batch(): `count` datagrams of `datagram_size` bytes one after
+        // another in the `data`. The lost and the delayed datagrams count as sent.
+        std::size_t send(udp::socket &socket, const udp::endpoint &endpoint, const void *data,
+                         std::size_t datagram_size, std::size_t count, boost::system::error_code &error_code);
+
+    private:
+        using link_clock_t = std::chrono::steady_clock;
+
+        // Duplicate of the socket descriptor, shared by the delayed datagrams of one send() call
+        struct Descriptor
+        {
+            explicit Descriptor(int descriptor) noexcept
+                : value(descriptor)
+            {
+            }
+
+            ~Descriptor();
+
+            Descriptor(const Descriptor&) = delete;
+
+            Descriptor &operator=(const Descriptor&) = delete;
+
+            const int value;
+        };
+
+        struct DelayedDatagram
+        {
+            link_clock_t::time_point          release;
+
+            // Keeps the equally released datagrams in order
+            std::uint64_t                     order;
+
+            std::shared_ptr<const Descriptor> descriptor;
+            udp::endpoint                     endpoint;
+            std::vector<std::uint8_t>         data;
+
+            bool operator>(const DelayedDatagram &other) const noexcept
+            {
+                return release != other.release ? release > other.release : order > other.order;
+            }
+        };
+
+        // When the datagram leaves the link, time_point::min() if it's lost. Called under the mutex.
+        link_clock_t::time_point schedule(std::size_t size, link_clock_t::time_point now);
+
+        // Time the link needs to carry that much bytes
+        link_clock_t::duration serialization(std::size_t size) const noexcept;
+
+        void run();
+
+    private:
+        LinkImpairment           m_impairment;
+        bool                     m_enabled = false;
+        LinkStatistics           m_statistics;
+
+        std::mutex               m_mutex;
+        std::condition_variable  m_wakeup;
+        std::mt19937_64          m_engine;
+        bool                     m_burst = false;
+
+        // The bandwidth limited link is busy with the previous datagrams until then
+        link_clock_t::time_point m_link_free;
+
+        std::priority_queue<DelayedDatagram, std::vector<DelayedDatagram>, std::greater<>> m_delayed;
+        std::uint64_t            m_order    = 0;
+        bool                     m_stopping = false;
+        std::thread              m_thread;
+    };
+
+    ImpairedLink &impaired_link();
+}
+
+#endif // __OZZY_NETWORKING_IMPAIRMENT__
@@ -1,6 +1,18 @@
 #include "networking.h"
+#include "byteswap.h"
 #include "LibLog/logging.h"
 
+#include <algorithm>
+#include <limits>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#if defined(__linux__)
+#   include <linux/filter.h>
+#endif
+
 namespace Ozzy::LibUDP
 {
     template<>
@@ -15,13 +27,25 @@ namespace Ozzy::LibUDP
             return;
         }
 
-        std::uint64_t value = data;
-        value = boost::endian::endian_reverse(value);
-        data = value;
+        // By the bit pattern, the value conversion to the integer would lose it
+        byteswap_64(&data, 1);
+    }
+
+    // Separate bytes have no order, nothing to convert
+    template<>
+    void swap_endianess(std::array<std::uint8_t, Proto::Constant::TransmittionUnitSize> &, bool)
+    {
+    }
+
+    // The endian marker stays in the sender's order(that's how the server finds it out), and the
+    // type is a single octet, nothing to convert
+    template<>
+    void swap_endianess(Proto::Handshake &, bool)
+    {
     }
 
     template<>
-    void swap_endianess(std::array<std::uint8_t, Proto::Constant::TransmittionUnitSize> &data, bool to_big_endian)
+    void swap_endianess(Proto::Frame &frame, bool to_big_endian)
     {
 #if TARGET_DEVICE_LITTLE_ENDIAN
         if(!to_big_endian)
@@ -32,15 +56,43 @@ namespace Ozzy::LibUDP
             return;
         }
 
-        const std::size_t array_size = data.size();
-        for (std::size_t i = 0; i < array_size; ++i)
+        // The type and the length occupy the first two octets of the header on both
+        // orders(they are one byte wide), only the 48 bit checksum in the rest of the
+        // octets is reversed
+        const std::size_t payload_count = std::min<std::size_t>(frame.length, Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK);
+
+        auto *header = reinterpret_cast<std::uint8_t*>(&frame);
+        std::reverse(header + 2, header + sizeof(std::uint64_t));
+
+        byteswap_64(frame.payload, payload_count);
+    }
+
+    template<>
+    void swap_endianess(Proto::v3::Frame &frame, bool to_big_endian)
+    {
+#if TARGET_DEVICE_LITTLE_ENDIAN
+        if(!to_big_endian)
+#else
+        if(to_big_endian)
+#endif
         {
-            data[i] = boost::endian::endian_reverse(data[i]);
+            return;
         }
+
+        // Only the sender converts the data to the receiver's order, so the length
+        // is in the host order before the conversion(and fits into the frame slot).
+        // Coded payload is the byte stream.
+        const std::size_t payload_count = frame.flags & Proto::v3::FRAME_FLAG_CODED ? 0 : frame.length;
+
+        frame.length   = boost::endian::endian_reverse(frame.length);
+        frame.sequence = boost::endian::endian_reverse(frame.sequence);
+        frame.checksum = boost::endian::endian_reverse(frame.checksum);
+
+        byteswap_64(frame.payload, payload_count);
     }
 
     template<>
-    void swap_endianess(Proto::Handshake &handshake, bool to_big_endian)
+    void swap_endianess(Proto::v3::Negotiation &negotiation, bool to_big_endian)
     {
 #if TARGET_DEVICE_LITTLE_ENDIAN
         if(!to_big_endian)
@@ -51,14 +103,13 @@ namespace Ozzy::LibUDP
             return;
         }
 
-        std::uint8_t reversed_type;
-        std::memcpy(&reversed_type, &handshake, 1);
-        reversed_type = boost::endian::endian_reverse(handshake.type);
-        std::memcpy(&handshake, &reversed_type, 1);
+        // The struct is packed, so the field is copied out instead of the reference
+        const std::uint32_t datagram_size = negotiation.datagram_size;
+        negotiation.datagram_size = boost::endian::endian_reverse(datagram_size);
     }
 
     template<>
-    void swap_endianess(Proto::Frame &frame, bool to_big_endian)
+    void swap_endianess(Proto::v3::Acknowledgement &acknowledgement, bool to_big_endian)
     {
 #if TARGET_DEVICE_LITTLE_ENDIAN
         if(!to_big_endian)
@@ -69,17 +120,271 @@ namespace Ozzy::LibUDP
             return;
         }
 
-        std::uint8_t reversed_type;
-        std::memcpy(&reversed_type, &frame, 1);
-        reversed_type = boost::endian::endian_reverse(frame.type);
-        std::memcpy(&frame, &reversed_type, 1);
+        acknowledgement.cumulative = boost::endian::endian_reverse(acknowledgement.cumulative);
 
-        frame.length   = boost::endian::endian_reverse(frame.length);
-        frame.checksum = boost::endian::endian_reverse(frame.checksum);
+        byteswap_64(acknowledgement.selective, Proto::v3::ACK_SELECTIVE_WORDS);
+    }
+
+    template<>
+    void swap_endianess(Proto::v3::SessionRequest &request, bool to_big_endian)
+    {
+#if TARGET_DEVICE_LITTLE_ENDIAN
+        if(!to_big_endian)
+#else
+        if(to_big_endian)
+#endif
+        {
+            return;
+        }
+
+        swap_endianess(request.offered, to_big_endian);
+
+        const std::uint64_t doubles_count = request.doubles_count;
+        request.doubles_count = boost::endian::endian_reverse(doubles_count);
+
+        // By the bit pattern, same as the payload
+        byteswap_64(&request.x_upper_bound, 1);
+    }
+
+    template<>
+    void swap_endianess(Proto::v3::SessionAnswer &answer, bool to_big_endian)
+    {
+#if TARGET_DEVICE_LITTLE_ENDIAN
+        if(!to_big_endian)
+#else
+        if(to_big_endian)
+#endif
+        {
+            return;
+        }
+
+        swap_endianess(answer.picked, to_big_endian);
+
+        const std::uint64_t doubles_count = answer.doubles_count;
+        answer.doubles_count = boost::endian::endian_reverse(doubles_count);
+    }
+
+    bool detect_endianess(const std::uint8_t *message, const std::size_t size, bool &big_endian) noexcept
+    {
+        if (size < sizeof(Proto::ENDIAN_MARKER))
+        {
+            return false;
+        }
+
+        const std::uint8_t high = Proto::ENDIAN_MARKER >> 8;
+        const std::uint8_t low  = Proto::ENDIAN_MARKER & 0xFF;
+
+        if (message[0] == high && message[1] == low)
+        {
+            big_endian = true;
+            return true;
+        }
+        if (message[0] == low && message[1] == high)
+        {
+            big_endian = false;
+            return true;
+        }
+        return false;
+    }
+
+    std::uint64_t calculate_wire_checksum(const Session &session, Proto::v3::Frame &frame,
+                                          const std::size_t payload_count)
+    {
+#if TARGET_DEVICE_LITTLE_ENDIAN
+        const bool converted = session.to_big_endian;
+#else
+        const bool converted = !session.to_big_endian;
+#endif
+
+        // XOR of the bytes doesn't depend on their order, and the coded payload is the byte stream
+        // that is never converted
+        if (!converted || session.checksum == Proto::v3::CHECKSUM_XOR || frame.flags & Proto::v3::FRAME_FLAG_CODED)
+        {
+            return Proto::calculate_frame_checksum(frame, session.checksum, payload_count);
+        }
+
+        byteswap_64(frame.payload, frame.length);
+        const std::uint64_t checksum = Proto::calculate_frame_checksum(frame, session.checksum, payload_count);
+        byteswap_64(frame.payload, frame.length);
+
+        return checksum;
+    }
+
+    std::size_t probe_datagram_size(const udp::endpoint &endpoint) noexcept
+    {
+        std::size_t datagram_size = Proto::v3::DEFAULT_DATAGRAM_SIZE;
+
+#if defined(IP_MTU_DISCOVER) && defined(IP_MTU)
+        // IPv4 header without the options and the UDP header
+        constexpr int HEADERS_SIZE = 20 + 8;
+
+        // The kernel knows the route MTU as soon as the socket is connected, and with the discovery
+        // turned on it also takes what the ICMP "fragmentation needed" messages told about the path
+        const int descriptor = endpoint.protocol() == udp::v4() ? ::socket(AF_INET, SOCK_DGRAM, 0) : -1;
+        if (descriptor >= 0)
+        {
+            const int discover = IP_PMTUDISC_DO;
+            int       mtu      = 0;
+            socklen_t length   = sizeof(mtu);
+
+            if (::setsockopt(descriptor, IPPROTO_IP, IP_MTU_DISCOVER, &discover, sizeof(discover)) == 0 &&
+                ::connect(descriptor, endpoint.data(), static_cast<socklen_t>(endpoint.size())) == 0 &&
+                ::getsockopt(descriptor, IPPROTO_IP, IP_MTU, &mtu, &length) == 0 && mtu > HEADERS_SIZE)
+            {
+                datagram_size = static_cast<std::size_t>(mtu - HEADERS_SIZE);
+            }
+            ::close(descriptor);
+        }
+#endif
+
+        // The default frame goes even over the smaller MTU, fragmented(as it always did)
+        datagram_size = std::clamp(datagram_size, Proto::v3::DEFAULT_DATAGRAM_SIZE, Proto::v3::MAX_DATAGRAM_SIZE);
+        return Proto::v3::frame_datagram_size(Proto::v3::frame_payload_count(datagram_size));
+    }
+
+    std::size_t reserve_receive_buffer(udp::socket &socket, const std::size_t datagram_size,
+                                       const std::size_t count) noexcept
+    {
+        boost::system::error_code error_code;
+
+        // The kernel caps the value by net.core.rmem_max
+        socket.set_option(udp::socket::receive_buffer_size(
+            static_cast<int>(std::min<std::size_t>(datagram_size * count, std::numeric_limits<int>::max()))), error_code);
+
+        // The kernel doubles the size for the bookkeeping(which is what the datagram takes on top
+        // of its payload), asio reports it halved back, so the value is for the payloads only
+        udp::socket::receive_buffer_size buffer_size;
+        socket.get_option(buffer_size, error_code);
+        if (error_code || buffer_size.value() <= 0)
+        {
+            return Proto::v3::DEFAULT_DATAGRAM_SIZE;
+        }
+
+        const std::size_t fitting = static_cast<std::size_t>(buffer_size.value()) / std::max<std::size_t>(count, 1);
+        if (fitting < Proto::v3::DEFAULT_DATAGRAM_SIZE)
+        {
+            return Proto::v3::DEFAULT_DATAGRAM_SIZE;
+        }
+        return Proto::v3::frame_datagram_size(Proto::v3::frame_payload_count(std::min(fitting, datagram_size)));
+    }
+
+    void bind_reuse_port(udp::socket &socket, const udp::endpoint &endpoint)
+    {
+        socket.open(endpoint.protocol());
+
+#if defined(SO_REUSEPORT)
+        using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+        socket.set_option(reuse_port(true));
+#endif
+
+        socket.bind(endpoint);
+    }
 
-        for (int i = 0; i < frame.length; ++i)
+    bool attach_cpu_steering(udp::socket &socket, const std::size_t count) noexcept
+    {
+#if defined(SO_ATTACH_REUSEPORT_CBPF) && defined(SKF_AD_CPU)
+        // A = cpu; A %= count; return A
+        sock_filter code[] =
         {
-            swap_endianess(frame.payload[i], to_big_endian);
+            {BPF_LD  | BPF_W   | BPF_ABS, 0, 0, static_cast<std::uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+            {BPF_ALU | BPF_MOD | BPF_K,   0, 0, static_cast<std::uint32_t>(std::max<std::size_t>(count, 1))},
+            {BPF_RET | BPF_A,             0, 0, 0},
+        };
+
+        sock_fprog program{};
+        program.len    = static_cast<unsigned short>(std::size(code));
+        program.filter = code;
+
+        return ::setsockopt(socket.native_handle(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                            &program, sizeof(program)) == 0;
+#else
+        static_cast<void>(socket);
+        static_cast<void>(count);
+        return false;
+#endif
+    }
+
+    bool wait_readable(std::shared_ptr<Session> &session, const std::chrono::milliseconds timeout)
+    {
+        pollfd descriptor{};
+        descriptor.fd     = session->socket.native_handle();
+        descriptor.events = POLLIN;
+
+        return ::poll(&descriptor, 1, static_cast<int>(timeout.count())) > 0;
+    }
+
+    boost::asio::awaitable<bool> async_wait_readable(std::shared_ptr<Session> &session,
+                                                     const std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+
+        for (;;)
+        {
+            timer.expires_at(deadline);
+            timer.async_wait([session](const boost::system::error_code &error_code)
+            {
+                if (!error_code)
+                {
+                    boost::system::error_code cancel_error;
+                    session->socket.cancel(cancel_error);
+                }
+            });
+
+            boost::system::error_code error_code;
+            co_await session->socket.async_wait(udp::socket::wait_read,
+                                                boost::asio::redirect_error(boost::asio::use_awaitable, error_code));
+            timer.cancel();
+
+            if (!error_code)
+            {
+                co_return true;
+            }
+
+            // The timer of the previous timed call may have expired right before it was cancelled,
+            // its handler cancels the wait that comes after it
+            if (error_code != boost::asio::error::operation_aborted || std::chrono::steady_clock::now() >= deadline)
+            {
+                co_return false;
+            }
+        }
+    }
+
+    boost::asio::awaitable<bool> async_wait_zero_copy(std::shared_ptr<Session> &session, const std::uint32_t id)
+    {
+        // Completions usually arrive long before we need the buffer again(we wait for the
+        // acknowledgement in between), so polling the error queue is cheap enough. The
+        // edge triggered reactor may miss the error queue readiness, that's why there is
+        // no async_wait(wait_error) here.
+        const auto deadline = std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp);
+
+        const auto is_completed = [&session, id]
+        {
+            return static_cast<std::int32_t>(session->zero_copy.completed - id) >= 0;
+        };
+
+        if (is_completed())
+        {
+            co_return true;
+        }
+
+        boost::asio::steady_timer timer(session->socket.get_executor());
+        for (;;)
+        {
+            reap_zero_copy(session->socket, session->zero_copy);
+            if (is_completed())
+            {
+                co_return true;
+            }
+
+            if (std::chrono::steady_clock::now() >= deadline)
+            {
+                co_return false;
+            }
+
+            timer.expires_after(std::chrono::microseconds(100));
+            co_await timer.async_wait(boost::asio::use_awaitable);
         }
     }
 }
@@ -2,18 +2,32 @@
 #define __OZZY_NETWORKING__
 
 #include "protocol.h"
+#include "batch.h"
+#include "demux.h"
+#include "impairment.h"
+#include <utility>
+#include <chrono>
+#include <span>
+#include <array>
+#include <cstring>
+#include <vector>
+#include <algorithm>
 #include <boost/asio.hpp>
 #include <boost/endian/conversion.hpp>
-#include <utility>
 
 namespace Ozzy::LibUDP
 {
     using boost::asio::ip::udp;
 
+    // The shared session gets the acknowledgements through its inbox
+    static_assert(sizeof(Proto::v3::Acknowledgement) <= SessionInbox::MAX_DATAGRAM_SIZE);
+
     struct Session
     {
         Session(boost::asio::io_context &context, udp::endpoint endpoint)
-            : socket(context), endpoint(std::move(endpoint)), to_big_endian(false)
+            : socket(context), endpoint(std::move(endpoint)), to_big_endian(false), version(Proto::VERSION_2),
+              checksum(Proto::v3::CHECKSUM_XOR), codec(Proto::v3::CODEC_IDENTITY),
+              datagram_size(Proto::v3::DEFAULT_DATAGRAM_SIZE)
         {
             socket.open(udp::v4());
             socket.bind(udp::endpoint(udp::v4(), 0));
@@ -24,14 +38,164 @@ namespace Ozzy::LibUDP
         {
         }
 
+        // Session that sends with the listener `shared_socket` and receives through the `inbox`,
+        // only the coroutine calls below are supported for it
+        Session(boost::asio::io_context &context, udp::endpoint endpoint, udp::socket &shared_socket,
+                std::shared_ptr<SessionInbox> inbox)
+            : socket(context), endpoint(std::move(endpoint)), to_big_endian(false), version(Proto::VERSION_2),
+              checksum(Proto::v3::CHECKSUM_XOR), codec(Proto::v3::CODEC_IDENTITY),
+              datagram_size(Proto::v3::DEFAULT_DATAGRAM_SIZE), shared_socket(&shared_socket), inbox(std::move(inbox))
+        {
+        }
+
         void close()
         {
             socket.close();
+            if (inbox)
+            {
+                inbox->close();
+            }
+        }
+
+        // Socket the datagrams of the session are sent with
+        udp::socket &output_socket() noexcept
+        {
+            return shared_socket ? *shared_socket : socket;
         }
 
         udp::socket socket;
         udp::endpoint endpoint;
         bool to_big_endian;
+        Proto::Version version;
+        Proto::v3::Checksum checksum;
+        Proto::v3::Codec codec;
+
+        // Size of every v3 frame datagram, negotiated in the handshake
+        std::size_t datagram_size;
+
+        // How much doubles are sent to the client, agreed in the handshake
+        std::uint64_t doubles_count = 0;
+
+        // Offloads of the batched calls enabled on the socket, see enable_offload()
+        Offload offload;
+        ZeroCopyCompletions zero_copy;
+
+        // Listener socket and the inbox of the shared session, nothing for the session with
+        // its own socket
+        udp::socket *shared_socket = nullptr;
+        std::shared_ptr<SessionInbox> inbox;
+    };
+
+    // Messages of the same type, which size is known only at the run time(the v3 frames of the
+    // negotiated datagram size). Each message takes the slot of `slot_size()` bytes, the part of
+    // the slot past sizeof(T) is the tail of the message payload, and every slot is sent as one
+    // datagram of that size.
+    template<typename T>
+    class MessageSlots
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+    public:
+        // The slot size is rounded up to 8 bytes, so the doubles in the slots stay aligned
+        explicit MessageSlots(std::size_t slot_size = sizeof(T), std::size_t count = 0)
+            : m_slot_size((std::max(slot_size, sizeof(T)) + 7) / 8 * 8)
+        {
+            resize(count);
+        }
+
+        T &operator[](std::size_t index) noexcept
+        {
+            return *reinterpret_cast<T*>(data() + index * m_slot_size);
+        }
+
+        const T &operator[](std::size_t index) const noexcept
+        {
+            return *reinterpret_cast<const T*>(data() + index * m_slot_size);
+        }
+
+        std::uint8_t *data() noexcept
+        {
+            return reinterpret_cast<std::uint8_t*>(m_storage.data());
+        }
+
+        const std::uint8_t *data() const noexcept
+        {
+            return reinterpret_cast<const std::uint8_t*>(m_storage.data());
+        }
+
+        std::size_t slot_size() const noexcept
+        {
+            return m_slot_size;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_size;
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        void clear() noexcept
+        {
+            m_size = 0;
+        }
+
+        void reserve(std::size_t count)
+        {
+            m_storage.reserve(count * m_slot_size / sizeof(std::uint64_t));
+        }
+
+        // Start over with `count` slots of the other size, the storage is kept(look at SlabPool)
+        void reset(std::size_t slot_size, std::size_t count = 0)
+        {
+            m_slot_size = (std::max(slot_size, sizeof(T)) + 7) / 8 * 8;
+            m_size      = 0;
+            resize(count);
+        }
+
+        // New slots hold the value initialized message with the zeroed tail
+        void resize(std::size_t count)
+        {
+            const std::size_t words = count * m_slot_size / sizeof(std::uint64_t);
+            if (m_storage.size() < words)
+            {
+                m_storage.resize(words);
+            }
+
+            for (std::size_t index = m_size; index < count; ++index)
+            {
+                std::memset(data() + index * m_slot_size, 0, m_slot_size);
+                new (data() + index * m_slot_size) T{};
+            }
+            m_size = count;
+        }
+
+        T &emplace_back()
+        {
+            resize(m_size + 1);
+            return (*this)[m_size - 1];
+        }
+
+        // Copy the whole slot, the `message` must be the slot of the MessageSlots with the
+        // same slot size
+        void assign(std::size_t index, const T &message) noexcept
+        {
+            std::memcpy(data() + index * m_slot_size, std::addressof(message), m_slot_size);
+        }
+
+        void push_back(const T &message)
+        {
+            resize(m_size + 1);
+            assign(m_size - 1, message);
+        }
+
+    private:
+        std::size_t                m_slot_size;
+        std::size_t                m_size = 0;
+        std::vector<std::uint64_t> m_storage;
     };
 
     template<typename T>
@@ -40,6 +204,100 @@ namespace Ozzy::LibUDP
     template<typename T>
     bool send_data(std::shared_ptr<Session> &session, T &&data);
 
+    // Coroutine flavours of the calls above, the session socket should be bound
+    // to the io_context the calling coroutine is running on.
+    template<typename T>
+    boost::asio::awaitable<bool> async_receive_data(std::shared_ptr<Session> &session, T &result);
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data(std::shared_ptr<Session> &session, T &&data);
+
+    // Same as above, but gives up when nothing arrived in `timeout`. The calling coroutine should
+    // run on a strand, because the timer cancels the pending receive from its own handler.
+    template<typename T>
+    boost::asio::awaitable<bool> async_receive_data(std::shared_ptr<Session> &session, T &result,
+                                                    std::chrono::milliseconds timeout);
+
+    // Batched flavours of the calls above, one system call per OZZY_UDP_BATCH_SIZE datagrams.
+    //
+    // Receive up to `results.size()` datagrams that are already queued on the socket, the datagrams
+    // of the wrong size are skipped. Returns count of the elements stored at the beginning of `results`.
+    template<typename T>
+    std::size_t receive_data_batch(std::shared_ptr<Session> &session, std::span<T> results);
+
+    // Send every element of the `data` as the separate datagram, the elements are converted to the
+    // receiver's order in place
+    template<typename T>
+    bool send_data_batch(std::shared_ptr<Session> &session, std::span<T> data);
+
+    // Same as receive_data_batch(), but waits for at least one datagram
+    template<typename T>
+    boost::asio::awaitable<std::size_t> async_receive_data_batch(std::shared_ptr<Session> &session, std::span<T> results);
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data_batch(std::shared_ptr<Session> &session, std::span<T> data);
+
+    // Same as above for the messages in the slots, the receive fills up to `results.size()` slots
+    template<typename T>
+    std::size_t receive_data_batch(std::shared_ptr<Session> &session, MessageSlots<T> &results);
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data_batch(std::shared_ptr<Session> &session, MessageSlots<T> &data);
+
+    // How much messages of `message_size` bytes receive_data_batch() takes at once, the coalesced
+    // receive needs more room(see COALESCED_RECEIVE_BYTES)
+    constexpr std::size_t receive_batch_capacity(std::size_t message_size, bool coalescing) noexcept
+    {
+        return coalescing ? std::max<std::size_t>(OZZY_UDP_BATCH_SIZE,
+                                                  std::min<std::size_t>(256, COALESCED_RECEIVE_BYTES / message_size * 3))
+                          : OZZY_UDP_BATCH_SIZE;
+    }
+
+    template<typename T>
+    constexpr std::size_t receive_batch_capacity(bool coalescing) noexcept
+    {
+        return receive_batch_capacity(sizeof(T), coalescing);
+    }
+
+    // Largest v3 frame datagram the path to the `endpoint` carries without the fragmentation,
+    // the route MTU is probed with IP_MTU_DISCOVER/IP_MTU. The result is clamped to
+    // [DEFAULT_DATAGRAM_SIZE, OZZY_MAX_DATAGRAM_SIZE], the default one if the MTU is unknown.
+    std::size_t probe_datagram_size(const udp::endpoint &endpoint) noexcept;
+
+    // Enlarge the socket receive buffer to keep `count` datagrams of `datagram_size` bytes, returns
+    // the largest v3 frame datagram, which `count` of really fit into the buffer the kernel gave us
+    std::size_t reserve_receive_buffer(udp::socket &socket, std::size_t datagram_size, std::size_t count) noexcept;
+
+    // Open the socket and bind it to the `endpoint`, which the other sockets of the process may
+    // be bound to as well(SO_REUSEPORT). The kernel spreads the datagrams between the sockets
+    // of such a group by the flow hash, so every sender always comes to the same socket.
+    void bind_reuse_port(udp::socket &socket, const udp::endpoint &endpoint);
+
+    // Spread the datagrams between the `count` sockets of the SO_REUSEPORT group by the CPU
+    // they are received on instead(socket `cpu % count`, in the order they were bound).
+    // The program applies to the whole group, false if the kernel doesn't support it.
+    bool attach_cpu_steering(udp::socket &socket, std::size_t count) noexcept;
+
+    // Wait until every zero copy send call before `id` is completed, so the data of these calls
+    // can be modified
+    boost::asio::awaitable<bool> async_wait_zero_copy(std::shared_ptr<Session> &session, std::uint32_t id);
+
+    // Wait until the blocking receive_data() on the session will not block, false on timeout
+    bool wait_readable(std::shared_ptr<Session> &session, std::chrono::milliseconds timeout);
+
+    // Coroutine flavour of the wait_readable(), should run on a strand for the same reason as the
+    // async_receive_data() with the timeout
+    boost::asio::awaitable<bool> async_wait_readable(std::shared_ptr<Session> &session, std::chrono::milliseconds timeout);
+
+
+    // Find out the order of the client from the Proto::ENDIAN_MARKER at the beginning of the
+    // `message`, false when there is no valid marker
+    bool detect_endianess(const std::uint8_t *message, std::size_t size, bool &big_endian) noexcept;
+
+    // Checksum of the v3 frame the receiver calculates: the payload is converted to the receiver's
+    // order by the send, and the CRC of it depends on the byte order. The payload is converted
+    // there and back in place, the frame is the same after the call.
+    std::uint64_t calculate_wire_checksum(const Session &session, Proto::v3::Frame &frame, std::size_t payload_count);
 
     template<typename T>
     concept enum_type_t = std::is_same_v<T, Proto::v1::Answer> ||
@@ -63,6 +321,21 @@ namespace Ozzy::LibUDP
 
     template<>
     void swap_endianess(Proto::Handshake &handshake, bool to_big_endian);
+
+    template<>
+    void swap_endianess(Proto::v3::Frame &frame, bool to_big_endian);
+
+    template<>
+    void swap_endianess(Proto::v3::Negotiation &negotiation, bool to_big_endian);
+
+    template<>
+    void swap_endianess(Proto::v3::Acknowledgement &acknowledgement, bool to_big_endian);
+
+    template<>
+    void swap_endianess(Proto::v3::SessionRequest &request, bool to_big_endian);
+
+    template<>
+    void swap_endianess(Proto::v3::SessionAnswer &answer, bool to_big_endian);
 }
 
 #include "networking.txx"
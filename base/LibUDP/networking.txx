@@ -55,6 +55,28 @@ namespace Ozzy::LibUDP
         std::size_t bytes_sended = 0u;
 
         swap_endianess(data, session->to_big_endian);
+
+        // The emulated link never blocks, the send waits for the room in the socket itself
+        if (impaired_link().enabled())
+        {
+            boost::system::error_code error_code;
+            while (impaired_link().send(session->socket, session->endpoint, std::addressof(data), sizeof(T), 1,
+                                        error_code) == 0)
+            {
+                if (error_code != boost::asio::error::would_block)
+                {
+                    return false;
+                }
+                session->socket.wait(udp::socket::wait_write, error_code);
+                if (error_code)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
         bytes_sended = session->socket.send_to(
             boost::asio::buffer(std::addressof(data), sizeof(T)),
             session->endpoint
@@ -62,4 +84,311 @@ namespace Ozzy::LibUDP
 
         return bytes_sended == sizeof(T);
     }
+
+    namespace detail
+    {
+        // Take the datagram of the shared session from its inbox, the longer one is truncated
+        // just like the socket receive does
+        template<typename T>
+        boost::asio::awaitable<bool> async_receive_inbox(std::shared_ptr<Session>& session, T &result,
+                                                         const std::chrono::steady_clock::time_point deadline)
+        {
+            if (!co_await session->inbox->async_wait(deadline))
+            {
+                co_return false;
+            }
+
+            const SessionInbox::Datagram &datagram = *session->inbox->front();
+            const bool received = datagram.size >= sizeof(T);
+            if (received)
+            {
+                std::memcpy(static_cast<void*>(std::addressof(result)), datagram.data.data(), sizeof(T));
+                swap_endianess(result, session->to_big_endian);
+            }
+            session->inbox->pop();
+
+            co_return received;
+        }
+
+        template<typename T>
+        boost::asio::awaitable<bool> async_send_slots(std::shared_ptr<Session>& session, std::uint8_t *slots,
+                                                      std::size_t slot_size, std::size_t count);
+    }
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_receive_data(std::shared_ptr<Session>& session, T &result)
+    {
+        if (session->inbox)
+        {
+            co_return co_await detail::async_receive_inbox(session, result, std::chrono::steady_clock::time_point::max());
+        }
+
+        boost::system::error_code error_code;
+
+        const std::size_t bytes_received = co_await session->socket.async_receive_from(
+                boost::asio::buffer(std::addressof(result), sizeof(T)),
+                session->endpoint,
+                boost::asio::redirect_error(boost::asio::use_awaitable, error_code)
+        );
+
+        if (error_code)
+        {
+            co_return false;
+        }
+        swap_endianess(result, session->to_big_endian);
+
+        co_return bytes_received == sizeof(T);
+    }
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data(std::shared_ptr<Session>& session, T &&data)
+    {
+        // The listener socket is never waited on by the session(see async_send_slots), the
+        // emulated link is reached through the batched send as well
+        if (session->shared_socket || impaired_link().enabled())
+        {
+            co_return co_await detail::async_send_slots<std::remove_cvref_t<T>>(
+                session, reinterpret_cast<std::uint8_t*>(std::addressof(data)), sizeof(T), 1);
+        }
+
+        boost::system::error_code error_code;
+
+        swap_endianess(data, session->to_big_endian);
+        const std::size_t bytes_sended = co_await session->socket.async_send_to(
+            boost::asio::buffer(std::addressof(data), sizeof(T)),
+            session->endpoint,
+            boost::asio::redirect_error(boost::asio::use_awaitable, error_code)
+        );
+
+        co_return !error_code && bytes_sended == sizeof(T);
+    }
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_receive_data(std::shared_ptr<Session>& session, T &result,
+                                                    const std::chrono::milliseconds timeout)
+    {
+        if (session->inbox)
+        {
+            co_return co_await detail::async_receive_inbox(session, result, std::chrono::steady_clock::now() + timeout);
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+
+        for (;;)
+        {
+            timer.expires_at(deadline);
+            timer.async_wait([session](const boost::system::error_code &error_code)
+            {
+                // The session may be already closed by the time the expired timer handler runs
+                if (!error_code)
+                {
+                    boost::system::error_code cancel_error;
+                    session->socket.cancel(cancel_error);
+                }
+            });
+
+            boost::system::error_code error_code;
+            const std::size_t bytes_received = co_await session->socket.async_receive_from(
+                    boost::asio::buffer(std::addressof(result), sizeof(T)),
+                    session->endpoint,
+                    boost::asio::redirect_error(boost::asio::use_awaitable, error_code)
+            );
+            timer.cancel();
+
+            if (!error_code)
+            {
+                swap_endianess(result, session->to_big_endian);
+                co_return bytes_received == sizeof(T);
+            }
+
+            // The timer of the previous timed call may have expired right before it was cancelled,
+            // its handler cancels the receive that comes after it(look at the async_wait_readable())
+            if (error_code != boost::asio::error::operation_aborted || std::chrono::steady_clock::now() >= deadline)
+            {
+                co_return false;
+            }
+        }
+    }
+
+    namespace detail
+    {
+        // Receive into `count` slots of `slot_size` bytes, the datagrams of the other size are skipped
+        template<typename T>
+        std::size_t receive_slots(std::shared_ptr<Session>& session, std::uint8_t *slots, const std::size_t slot_size,
+                                  const std::size_t count)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            if (session->inbox)
+            {
+                std::size_t valid = 0;
+
+                for (const SessionInbox::Datagram *datagram; valid < count && (datagram = session->inbox->front());
+                     session->inbox->pop())
+                {
+                    if (datagram->size < slot_size)
+                    {
+                        continue;
+                    }
+
+                    std::memcpy(slots + valid * slot_size, datagram->data.data(), slot_size);
+                    swap_endianess(*reinterpret_cast<T*>(slots + valid * slot_size), session->to_big_endian);
+                    ++valid;
+                }
+
+                return valid;
+            }
+
+            constexpr std::size_t max_capacity = receive_batch_capacity(1, true);
+
+            std::array<std::size_t,   max_capacity> sizes;
+            std::array<udp::endpoint, max_capacity> endpoints;
+            boost::system::error_code error_code;
+
+            const std::size_t capacity = receive_batch_capacity(slot_size, session->offload.coalescing);
+            const std::size_t received = receive_batch(session->socket, slots, slot_size, std::min(count, capacity),
+                                                       sizes.data(), endpoints.data(), error_code, session->offload);
+
+            std::size_t valid = 0;
+            for (std::size_t i = 0; i < received; ++i)
+            {
+                if (sizes[i] != slot_size)
+                {
+                    continue;
+                }
+
+                if (valid != i)
+                {
+                    std::memmove(slots + valid * slot_size, slots + i * slot_size, slot_size);
+                }
+                swap_endianess(*reinterpret_cast<T*>(slots + valid * slot_size), session->to_big_endian);
+
+                session->endpoint = endpoints[i];
+                ++valid;
+            }
+
+            return valid;
+        }
+
+        template<typename T>
+        boost::asio::awaitable<bool> async_send_slots(std::shared_ptr<Session>& session, std::uint8_t *slots,
+                                                      const std::size_t slot_size, const std::size_t count)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                swap_endianess(*reinterpret_cast<T*>(slots + i * slot_size), session->to_big_endian);
+            }
+
+            std::size_t sent_total = 0;
+            while (sent_total < count)
+            {
+                boost::system::error_code error_code;
+                sent_total += send_batch(session->output_socket(), session->endpoint, slots + sent_total * slot_size,
+                                         slot_size, count - sent_total, error_code, session->offload, session->zero_copy);
+
+                if (error_code == boost::asio::error::would_block && session->shared_socket)
+                {
+                    // The readiness of the listener socket belongs to its accept loop, so the
+                    // shared session just retries a bit later(the send buffer is rarely full)
+                    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+                    timer.expires_after(std::chrono::microseconds(100));
+                    co_await timer.async_wait(boost::asio::redirect_error(boost::asio::use_awaitable, error_code));
+                }
+                else if (error_code == boost::asio::error::would_block)
+                {
+                    co_await session->socket.async_wait(udp::socket::wait_write,
+                                                        boost::asio::redirect_error(boost::asio::use_awaitable, error_code));
+                }
+
+                if (error_code)
+                {
+                    co_return false;
+                }
+            }
+
+            co_return true;
+        }
+    }
+
+    template<typename T>
+    std::size_t receive_data_batch(std::shared_ptr<Session>& session, std::span<T> results)
+    {
+        return detail::receive_slots<T>(session, reinterpret_cast<std::uint8_t*>(results.data()), sizeof(T),
+                                        results.size());
+    }
+
+    template<typename T>
+    std::size_t receive_data_batch(std::shared_ptr<Session>& session, MessageSlots<T> &results)
+    {
+        return detail::receive_slots<T>(session, results.data(), results.slot_size(), results.size());
+    }
+
+    template<typename T>
+    bool send_data_batch(std::shared_ptr<Session>& session, std::span<T> data)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+
+        for (auto &element: data)
+        {
+            swap_endianess(element, session->to_big_endian);
+        }
+
+        std::size_t sent_total = 0;
+        while (sent_total < data.size())
+        {
+            boost::system::error_code error_code;
+            sent_total += send_batch(session->socket, session->endpoint, data.data() + sent_total, sizeof(T),
+                                     data.size() - sent_total, error_code, session->offload, session->zero_copy);
+
+            if (error_code == boost::asio::error::would_block)
+            {
+                session->socket.wait(udp::socket::wait_write, error_code);
+            }
+
+            if (error_code)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    template<typename T>
+    boost::asio::awaitable<std::size_t> async_receive_data_batch(std::shared_ptr<Session>& session, std::span<T> results)
+    {
+        for (;;)
+        {
+            boost::system::error_code error_code;
+
+            co_await session->socket.async_wait(udp::socket::wait_read,
+                                                boost::asio::redirect_error(boost::asio::use_awaitable, error_code));
+            if (error_code)
+            {
+                co_return 0;
+            }
+
+            // Readiness can be spurious, or every datagram can be of the wrong size
+            if (const std::size_t received = receive_data_batch(session, results); received > 0)
+            {
+                co_return received;
+            }
+        }
+    }
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data_batch(std::shared_ptr<Session>& session, std::span<T> data)
+    {
+        return detail::async_send_slots<T>(session, reinterpret_cast<std::uint8_t*>(data.data()), sizeof(T),
+                                           data.size());
+    }
+
+    template<typename T>
+    boost::asio::awaitable<bool> async_send_data_batch(std::shared_ptr<Session>& session, MessageSlots<T> &data)
+    {
+        return detail::async_send_slots<T>(session, data.data(), data.slot_size(), data.size());
+    }
 }
@@ -0,0 +1,101 @@
+#include "receiver.h"
+
+#include <span>
+
+namespace Ozzy::LibUDP
+{
+    FrameReceiver::FrameReceiver(const Session &session)
+        : m_payload_count(Proto::v3::frame_payload_count(session.datagram_size)), m_checksum(session.checksum),
+          m_codec(payload_codec(session.codec)), m_reorder_buffer(session.datagram_size, WINDOW_SIZE),
+          m_received(WINDOW_SIZE, false), m_decoded_values(Proto::v3::codec_max_values(m_payload_count))
+    {
+    }
+
+    FrameReceiver::Status FrameReceiver::take(const Proto::v3::Frame &frame, const sink_t &sink)
+    {
+        // Corrupted frame is just not acknowledged, the sender will re-send it
+        const std::size_t max_length = frame.flags & Proto::v3::FRAME_FLAG_CODED
+                                       ? Proto::v3::codec_max_values(m_payload_count)
+                                       : m_payload_count;
+        if (frame.length > max_length ||
+            frame.checksum != Proto::calculate_frame_checksum(frame, m_checksum, m_payload_count))
+        {
+            return Status::CORRUPTED;
+        }
+
+        // The close frame follows the last frame of the stream. The stream without the frames has
+        // no END_OF_STREAM one, its end is known only from the close frame.
+        if (frame.flags & Proto::v3::FRAME_FLAG_CLOSE)
+        {
+            if (m_end_sequence == std::numeric_limits<std::uint64_t>::max() && frame.sequence == m_expected_sequence)
+            {
+                m_end_sequence = frame.sequence;
+            }
+
+            if (frame.sequence != m_end_sequence)
+            {
+                return Status::CORRUPTED;
+            }
+
+            m_closed = complete();
+            return Status::CLOSED;
+        }
+
+        // Keep the frame if it fits into the window and is not a duplicate
+        const std::uint32_t sequence = frame.sequence;
+        if (sequence >= m_expected_sequence && sequence < m_expected_sequence + WINDOW_SIZE &&
+            !m_received[sequence % WINDOW_SIZE])
+        {
+            m_reorder_buffer.assign(sequence % WINDOW_SIZE, frame);
+            m_received      [sequence % WINDOW_SIZE] = true;
+
+            if (frame.flags & Proto::v3::FRAME_FLAG_END_OF_STREAM)
+            {
+                m_end_sequence = static_cast<std::uint64_t>(sequence) + 1;
+            }
+        }
+
+        // Hand over everything that is in order now
+        while (m_received[m_expected_sequence % WINDOW_SIZE])
+        {
+            const Proto::v3::Frame &ordered_frame = m_reorder_buffer[m_expected_sequence % WINDOW_SIZE];
+            if (!(ordered_frame.flags & Proto::v3::FRAME_FLAG_CODED))
+            {
+                sink(ordered_frame.payload, ordered_frame.length);
+            }
+            else if (m_codec.decode(std::span(reinterpret_cast<const std::uint8_t*>(ordered_frame.payload),
+                                              m_payload_count * sizeof(double)),
+                                    std::span(m_decoded_values).first(ordered_frame.length)))
+            {
+                sink(m_decoded_values.data(), ordered_frame.length);
+            }
+            else
+            {
+                return Status::UNDECODABLE;
+            }
+
+            m_received[m_expected_sequence % WINDOW_SIZE] = false;
+            ++m_expected_sequence;
+        }
+
+        return Status::ACCEPTED;
+    }
+
+    Proto::v3::Acknowledgement FrameReceiver::acknowledgement() const noexcept
+    {
+        // Describe the whole receive window, so the sender is able to re-send only the missing frames
+        Proto::v3::Acknowledgement acknowledgement;
+        acknowledgement.answer     = Proto::v1::Answer::ACK;
+        acknowledgement.cumulative = m_closed ? m_expected_sequence + 1 : m_expected_sequence;
+
+        for (std::size_t i = 0; i + 1 < WINDOW_SIZE && i < Proto::v3::ACK_SELECTIVE_BITS; ++i)
+        {
+            if (m_received[(m_expected_sequence + 1 + i) % WINDOW_SIZE])
+            {
+                acknowledgement.selective[i / 64] |= 1ULL << (i % 64);
+            }
+        }
+
+        return acknowledgement;
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef __OZZY_NETWORKING_RECEIVER__
+#define __OZZY_NETWORKING_RECEIVER__
+
+#include "networking.h"
+#include "codec.h"
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace Ozzy::LibUDP
+{
+    // Receiver side of the Proto::v3 sliding window. Frames that arrived ahead of the expected
+    // one wait in the reorder buffer, the values are handed over in the stream order, and the
+    // acknowledgement describes the whole receive window.
+    class FrameReceiver
+    {
+    public:
+        // What happened to the frame passed to take()
+        enum class Status
+        {
+            // Taken(or it is the duplicate of the taken one)
+            ACCEPTED,
+
+            // Checksum or length doesn't match, the frame is not acknowledged so the sender re-sends it
+            CORRUPTED,
+
+            // The frame is in order, but its payload can't be decoded, the stream is broken
+            UNDECODABLE,
+
+            // The sender has closed the session, the close frame carries the sequence right after
+            // the last frame of the stream(look at the complete())
+            CLOSED,
+        };
+
+        // Gets the values in the stream order
+        using sink_t = std::function<void(const double *values, std::size_t count)>;
+
+        // The frames are of the session negotiated size, checksum and codec
+        explicit FrameReceiver(const Session &session);
+
+        Status take(const Proto::v3::Frame &frame, const sink_t &sink);
+
+        // State of the receive window, one per received batch is enough
+        Proto::v3::Acknowledgement acknowledgement() const noexcept;
+
+        // Every frame up to the end of the stream is handed over
+        bool complete() const noexcept
+        {
+            return m_expected_sequence == m_end_sequence;
+        }
+
+        // Every frame below it is handed over
+        std::uint32_t expected_sequence() const noexcept
+        {
+            return m_expected_sequence;
+        }
+
+    private:
+        static constexpr std::size_t           WINDOW_SIZE = OZZY_ARQ_WINDOW_SIZE;
+
+        const std::size_t                      m_payload_count;
+        const Proto::v3::Checksum              m_checksum;
+        const PayloadCodec                    &m_codec;
+
+        // The frame with the sequence `s` is stored at `s % window_size`
+        MessageSlots<Proto::v3::Frame>         m_reorder_buffer;
+        std::vector<bool>                      m_received;
+
+        std::uint32_t                          m_expected_sequence = 0;
+        std::uint64_t                          m_end_sequence      = std::numeric_limits<std::uint64_t>::max();
+
+        // The close frame is acknowledged as the frame right after the end of the stream
+        bool                                   m_closed            = false;
+
+        // Coded frames are decoded right before they are handed over
+        std::vector<double>                    m_decoded_values;
+    };
+}
+
+#endif // __OZZY_NETWORKING_RECEIVER__
@@ -1,18 +1,205 @@
 #include "protocol.h"
 
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define OZZY_CHECKSUM_X86 1
+#else
+#   define OZZY_CHECKSUM_X86 0
+#endif
+
 namespace Ozzy::Proto
 {
-    std::uint64_t calculate_frame_checksum(Frame frame)
+    namespace
     {
-        const std::uint8_t *data    = reinterpret_cast<const std::uint8_t *>(frame.payload);
-        const std::size_t data_size = frame.length / sizeof(double);
+        using checksum_kernel_t = std::uint64_t(*)(const std::uint8_t *data, std::size_t size);
+
+        struct ChecksumKernel
+        {
+            checksum_kernel_t calculate;
+            const char       *name;
+        };
+
+        // XOR of every byte is the same as XOR of the wide words folded down to one byte,
+        // so all the XOR kernels below give the same value as the byte-wise one.
+        std::uint64_t fold_xor(std::uint64_t value) noexcept
+        {
+            value ^= value >> 32;
+            value ^= value >> 16;
+            value ^= value >> 8;
+            return value & 0xFF;
+        }
+
+        std::uint64_t xor_bytes(const std::uint8_t *data, const std::size_t size)
+        {
+            std::uint64_t checksum = 0;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                checksum ^= data[i];
+            }
+            return checksum;
+        }
+
+        std::uint64_t xor_words(const std::uint8_t *data, const std::size_t size)
+        {
+            std::uint64_t checksum = 0;
+            std::size_t   offset   = 0;
+
+            for (; offset + sizeof(std::uint64_t) <= size; offset += sizeof(std::uint64_t))
+            {
+                std::uint64_t word;
+                std::memcpy(&word, data + offset, sizeof(word));
+                checksum ^= word;
+            }
+
+            return fold_xor(checksum) ^ xor_bytes(data + offset, size - offset);
+        }
+
+        // CRC-32C lookup table(reflected polynomial 0x82F63B78) for the software kernel
+        constexpr std::array<std::uint32_t, 256> make_crc32c_table()
+        {
+            std::array<std::uint32_t, 256> table{};
+            for (std::uint32_t i = 0; i < 256; ++i)
+            {
+                std::uint32_t crc = i;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+                }
+                table[i] = crc;
+            }
+            return table;
+        }
+
+        constexpr std::array<std::uint32_t, 256> crc32c_table = make_crc32c_table();
+
+        std::uint64_t crc32c_software(const std::uint8_t *data, const std::size_t size)
+        {
+            std::uint32_t crc = 0xFFFFFFFFu;
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return crc ^ 0xFFFFFFFFu;
+        }
+
+#if OZZY_CHECKSUM_X86
+        __attribute__((target("avx2")))
+        std::uint64_t xor_avx2(const std::uint8_t *data, const std::size_t size)
+        {
+            __m256i     accumulator = _mm256_setzero_si256();
+            std::size_t offset      = 0;
+
+            for (; offset + sizeof(__m256i) <= size; offset += sizeof(__m256i))
+            {
+                accumulator = _mm256_xor_si256(accumulator,
+                                               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + offset)));
+            }
+
+            alignas(32) std::uint64_t lanes[4];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), accumulator);
+
+            return fold_xor(lanes[0] ^ lanes[1] ^ lanes[2] ^ lanes[3]) ^ xor_words(data + offset, size - offset);
+        }
+
+        __attribute__((target("sse4.2")))
+        std::uint64_t crc32c_sse42(const std::uint8_t *data, const std::size_t size)
+        {
+            std::uint64_t crc    = 0xFFFFFFFFu;
+            std::size_t   offset = 0;
 
-        std::uint64_t checksum = 0;
-        for(std::size_t i = 0; i < data_size * sizeof(double); ++i)
+            for (; offset + sizeof(std::uint64_t) <= size; offset += sizeof(std::uint64_t))
+            {
+                std::uint64_t word;
+                std::memcpy(&word, data + offset, sizeof(word));
+                crc = _mm_crc32_u64(crc, word);
+            }
+
+            auto crc32 = static_cast<std::uint32_t>(crc);
+            for (; offset < size; ++offset)
+            {
+                crc32 = _mm_crc32_u8(crc32, data[offset]);
+            }
+            return crc32 ^ 0xFFFFFFFFu;
+        }
+#endif
+
+        // Pick the fastest kernel of every algorithm once, the CPU does not change at runtime
+        std::array<ChecksumKernel, v3::CHECKSUM_COUNT> select_kernels() noexcept
+        {
+            std::array<ChecksumKernel, v3::CHECKSUM_COUNT> kernels{};
+            kernels[v3::CHECKSUM_XOR]    = {xor_words,       "xor-word"};
+            kernels[v3::CHECKSUM_CRC32C] = {crc32c_software, "crc32c-table"};
+
+#if OZZY_CHECKSUM_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                kernels[v3::CHECKSUM_XOR] = {xor_avx2, "xor-avx2"};
+            }
+#if defined(__x86_64__)
+            if (__builtin_cpu_supports("sse4.2"))
+            {
+                kernels[v3::CHECKSUM_CRC32C] = {crc32c_sse42, "crc32c-sse4.2"};
+            }
+#endif
+#endif
+            return kernels;
+        }
+
+        const std::array<ChecksumKernel, v3::CHECKSUM_COUNT> &kernels() noexcept
         {
-            checksum ^= data[i];
+            static const std::array<ChecksumKernel, v3::CHECKSUM_COUNT> selected = select_kernels();
+            return selected;
         }
+    }
+
+    std::uint64_t calculate_payload_checksum(const double *payload, const std::size_t count)
+    {
+        return calculate_payload_checksum(v3::CHECKSUM_XOR, payload, count);
+    }
+
+    std::uint64_t calculate_payload_checksum(const v3::Checksum algorithm, const double *payload, const std::size_t count)
+    {
+        const std::uint64_t checksum = kernels()[algorithm].calculate(reinterpret_cast<const std::uint8_t*>(payload),
+                                                                      count * sizeof(double));
 
         return checksum & ((1ULL << FRAME_BITS_PER_CHECKSUM) - 1);
     }
-}
\ No newline at end of file
+
+    std::uint64_t calculate_frame_checksum(const Frame &frame)
+    {
+        return calculate_payload_checksum(frame.payload, frame.length / sizeof(double));
+    }
+
+    std::uint64_t calculate_frame_checksum(const v3::Frame &frame, const v3::Checksum algorithm,
+                                           const std::size_t payload_count)
+    {
+        // Coded payload takes the whole payload area, whatever the values count is
+        const std::size_t count = frame.flags & v3::FRAME_FLAG_CODED ? payload_count : frame.length;
+        return calculate_payload_checksum(algorithm, frame.payload, count);
+    }
+
+    std::uint8_t supported_checksums() noexcept
+    {
+        // Every algorithm has the software kernel
+        return v3::checksum_bit(v3::CHECKSUM_XOR) | v3::checksum_bit(v3::CHECKSUM_CRC32C);
+    }
+
+    v3::Checksum pick_checksum(const std::uint8_t local, const std::uint8_t remote) noexcept
+    {
+        const std::uint8_t common = local & remote;
+        if (common & v3::checksum_bit(v3::CHECKSUM_CRC32C))
+        {
+            return v3::CHECKSUM_CRC32C;
+        }
+        return v3::CHECKSUM_XOR;
+    }
+
+    const char *checksum_kernel_name(const v3::Checksum algorithm) noexcept
+    {
+        return kernels()[algorithm].name;
+    }
+}
@@ -2,6 +2,28 @@
 #define __OZZ_PROTOCOL__
 
 #include <cstdint>
+#include <cstddef>
+
+// How much frames the sender can keep in flight before waiting for the
+// acknowledgement(Proto::v3 and above)
+#ifndef OZZY_ARQ_WINDOW_SIZE
+#   define OZZY_ARQ_WINDOW_SIZE 64
+#else
+#   if OZZY_ARQ_WINDOW_SIZE < 1
+#       error "Invalid value set for OZZY_ARQ_WINDOW_SIZE"
+#   endif
+#endif
+
+// Largest datagram(UDP payload) we offer in the Proto::v3 handshake, the frames are sized by
+// the smaller of the path MTU and this value. 65507 is the largest UDP payload over IPv4.
+#ifndef OZZY_MAX_DATAGRAM_SIZE
+#   define OZZY_MAX_DATAGRAM_SIZE 65507
+#else
+#   if OZZY_MAX_DATAGRAM_SIZE > 65507
+#       error "Invalid value set for OZZY_MAX_DATAGRAM_SIZE"
+#   endif
+#endif
+
 namespace Ozzy::Proto
 {
     enum Constant
@@ -23,6 +45,7 @@ namespace Ozzy::Proto
     {
         VERSION_1 = 0,
         VERSION_2,
+        VERSION_3,
     };
 
     // Specifies the message type, should be the first 8 bits of
@@ -32,6 +55,11 @@ namespace Ozzy::Proto
     {
         MESSAGE_TYPE_FRAME = 0,
         MESSAGE_TYPE_HANDSHAKE,
+        MESSAGE_TYPE_ACKNOWLEDGEMENT,
+
+        // Single round-trip handshake(Proto::v3 and above), look at the v3::SessionRequest
+        MESSAGE_TYPE_SESSION_REQUEST,
+        MESSAGE_TYPE_SESSION_ANSWER,
     };
 
     constexpr std::size_t OZZY_PAYLOAD_COUNT_PER_CHUNK        = 175;
@@ -69,11 +97,18 @@ namespace Ozzy::Proto
     static_assert(sizeof(Frame) <= OZZY_MAXIMAL_TRANSMITTION_UNIT_SIZE);
 #pragma pack(pop)
 
+    // Written by the client in its own order, the server tells the client's order by the
+    // octets it gets(0x01 0x02 from the big endian one, 0x02 0x01 from the little endian one)
+    constexpr std::uint16_t ENDIAN_MARKER = 0x0102;
+
+    // Offset of the message type in the Handshake and the v3::SessionRequest
+    constexpr std::size_t HANDSHAKE_TYPE_OFFSET = sizeof(ENDIAN_MARKER);
+
 #pragma pack(push, 1)
     struct Handshake
     {
-        // Value to check clients's endiannes
-        const std::uint8_t endian = 1;
+        // Value to check clients's endiannes, never converted
+        const std::uint16_t endian = ENDIAN_MARKER;
         // 8 readonly bits for the type of this message
         const std::uint8_t type   = MESSAGE_TYPE_HANDSHAKE;
     };
@@ -105,7 +140,219 @@ namespace Ozzy::Proto
         };
     }
 
-    std::uint64_t calculate_frame_checksum(Frame frame);
+    namespace v3
+    {
+        // Bits of the Frame::flags field
+        enum FrameFlags
+        {
+            FRAME_FLAG_NONE          = 0,
+
+            // This is the last frame with the payload in the stream
+            FRAME_FLAG_END_OF_STREAM = 1 << 0,
+
+            // Sender received the acknowledgements for every frame and closes the
+            // session, carries no payload
+            FRAME_FLAG_CLOSE         = 1 << 1,
+
+            // Payload is the byte stream of the negotiated codec(not the doubles), which
+            // carries `length` values
+            FRAME_FLAG_CODED         = 1 << 2,
+        };
+
+        // Payload checksum algorithms, the client sends the bitmask of the supported ones
+        // right after the version is accepted and the server answers with the one it picked.
+        enum Checksum
+        {
+            // Byte-wise XOR of the payload, the Proto::v2 one
+            CHECKSUM_XOR    = 0,
+
+            // CRC-32C(Castagnoli), detects reordered and swapped doubles as well
+            CHECKSUM_CRC32C = 1,
+
+            CHECKSUM_COUNT,
+        };
+
+        constexpr std::uint8_t checksum_bit(Checksum checksum)
+        {
+            return static_cast<std::uint8_t>(1u << checksum);
+        }
+
+        // Payload codecs(look at LibUDP/codec.h), negotiated together with the checksum
+        enum Codec
+        {
+            // Raw doubles, OZZY_PAYLOAD_COUNT_PER_CHUNK per frame at most
+            CODEC_IDENTITY    = 0,
+
+            // XOR with the previous value, split into the byte planes, and the planes with
+            // a few distinct bytes are packed with the small dictionary
+            CODEC_SHUFFLE_XOR = 1,
+
+            CODEC_COUNT,
+        };
+
+        constexpr std::uint8_t codec_bit(Codec codec)
+        {
+            return static_cast<std::uint8_t>(1u << codec);
+        }
+
+
+        // Selective acknowledgement bitmap is 4 * 64 bits wide, so the receiver is able
+        // to report 256 frames after the first missing one.
+        constexpr std::size_t ACK_SELECTIVE_WORDS = 4;
+        constexpr std::size_t ACK_SELECTIVE_BITS  = ACK_SELECTIVE_WORDS * 64;
+        static_assert(OZZY_ARQ_WINDOW_SIZE <= ACK_SELECTIVE_BITS + 1,
+                      "OZZY_ARQ_WINDOW_SIZE does not fit into the selective acknowledgement bitmap");
+
+#pragma pack(push, 1)
+        // Same idea as the Proto::Frame, but the frame is numbered, so the receiver is able
+        // to acknowledge the frames out of order and the sender to keep the window of
+        // frames in flight.
+        //
+        // The frame takes the whole negotiated datagram(look at the Negotiation), the struct
+        // has the payload of the smallest one, that fits into the 1500 bytes MTU. The longer
+        // frames are kept in the LibUDP::MessageSlots, and their payload goes on past the end
+        // of the struct.
+        struct Frame
+        {
+            // 8 bits for the type of this message(not const, the frames are kept in the
+            // sender window and re-assigned)
+            std::uint8_t  type     = MESSAGE_TYPE_FRAME;
+
+            // Bitmask of FrameFlags
+            std::uint8_t  flags    = FRAME_FLAG_NONE;
+
+            // Count of the doubles in the payload
+            std::uint16_t length   = 0;
+
+            // Index of the frame in the stream, starting from zero
+            std::uint32_t sequence = 0;
+
+            // Checksum of the payload
+            std::uint64_t checksum = 0;
+
+            double payload[OZZY_PAYLOAD_COUNT_PER_CHUNK];
+        };
+        static_assert(sizeof(Frame) <= OZZY_MAXIMAL_TRANSMITTION_UNIT_SIZE);
+
+        // Sent by the receiver for every frame it gets, describes the whole receive
+        // window state, so any of the acknowledgements can be lost.
+        struct Acknowledgement
+        {
+            // 8 readonly bits for the type of this message
+            const std::uint8_t type     = MESSAGE_TYPE_ACKNOWLEDGEMENT;
+
+            // Either v1::ACK or v1::DROP(receiver wants to close the session)
+            std::uint8_t  answer        = 0;
+
+            std::uint16_t reserved      = 0;
+
+            // Every frame with the sequence below this value is received
+            std::uint32_t cumulative    = 0;
+
+            // Bit `i` is set when the frame with the `cumulative + 1 + i` sequence is received
+            std::uint64_t selective[ACK_SELECTIVE_WORDS] = {};
+        };
+        static_assert(sizeof(Acknowledgement) <= OZZY_MAXIMAL_TRANSMITTION_UNIT_SIZE);
+
+        // Sent by the client right after the version is accepted with the bitmasks of the
+        // algorithms it supports and the largest datagram it is able to receive, the server
+        // answers with the ones it picked
+        struct Negotiation
+        {
+            std::uint8_t  checksums     = 0;
+            std::uint8_t  codecs        = 0;
+            std::uint32_t datagram_size = 0;
+        };
+
+        // Replaces the whole v2 handshake(handshake, version, negotiation, x bound and the
+        // client ready answer) with one datagram. The first three octets are the same as the
+        // Proto::Handshake ones, so the server tells them apart by the type.
+        struct SessionRequest
+        {
+            // Value to check clients's endiannes, never converted
+            std::uint16_t endian        = ENDIAN_MARKER;
+            std::uint8_t  type          = MESSAGE_TYPE_SESSION_REQUEST;
+
+            std::uint8_t  version       = VERSION_3;
+
+            // What the client supports, same as the Negotiation sent in the v2 handshake
+            Negotiation   offered;
+
+            // How much doubles the client wants, zero takes as much as the server sends by default
+            std::uint64_t doubles_count = 0;
+
+            // The values are generated from [-x_upper_bound, x_upper_bound]
+            double        x_upper_bound = 1.0;
+        };
+
+        // Server's answer to the SessionRequest, with v1::ACK the frames follow right away. Any
+        // other answer(NACK, DROP, ERR_VERSIONS_INCOMPATIBLE, CLIENT_THREAD_POOL_EXHAUSED) closes
+        // the session.
+        struct SessionAnswer
+        {
+            std::uint8_t  type          = MESSAGE_TYPE_SESSION_ANSWER;
+            std::uint8_t  answer        = v1::ACK;
+
+            // Version the server speaks
+            std::uint8_t  version       = VERSION_3;
+
+            // What the server picked from the offered ones
+            Negotiation   picked;
+
+            // How much doubles the session is going to send
+            std::uint64_t doubles_count = 0;
+        };
+#pragma pack(pop)
+
+        constexpr std::size_t FRAME_HEADER_SIZE = offsetof(Frame, payload);
+
+        // The default frame, which is used when the path MTU is unknown
+        constexpr std::size_t DEFAULT_DATAGRAM_SIZE = sizeof(Frame);
+        constexpr std::size_t MAX_DATAGRAM_SIZE     = OZZY_MAX_DATAGRAM_SIZE;
+        static_assert(MAX_DATAGRAM_SIZE >= DEFAULT_DATAGRAM_SIZE, "OZZY_MAX_DATAGRAM_SIZE is below the default frame");
+
+        // How much doubles the frame of the `datagram_size` bytes carries
+        constexpr std::size_t frame_payload_count(std::size_t datagram_size)
+        {
+            return (datagram_size - FRAME_HEADER_SIZE) / sizeof(double);
+        }
+
+        // Size of the frame with the `payload_count` doubles
+        constexpr std::size_t frame_datagram_size(std::size_t payload_count)
+        {
+            return FRAME_HEADER_SIZE + payload_count * sizeof(double);
+        }
+
+        // Coded frame never carries more values than that for the payload of `payload_count`
+        // doubles, whatever the codec packs(1050 for the default frame)
+        constexpr std::size_t codec_max_values(std::size_t payload_count)
+        {
+            return payload_count * 6;
+        }
+        static_assert(codec_max_values(frame_payload_count(MAX_DATAGRAM_SIZE)) <= UINT16_MAX,
+                      "Values count of the largest coded frame does not fit into the Frame::length");
+    }
+
+    // Checksums are calculated with the fastest kernel this CPU has(picked once at the start),
+    // every kernel of one algorithm gives the same value.
+    std::uint64_t calculate_payload_checksum(const double *payload, std::size_t count);
+
+    std::uint64_t calculate_payload_checksum(v3::Checksum algorithm, const double *payload, std::size_t count);
+
+    std::uint64_t calculate_frame_checksum(const Frame &frame);
+
+    // The coded frame checksum covers its whole payload of `payload_count` doubles
+    std::uint64_t calculate_frame_checksum(const v3::Frame &frame, v3::Checksum algorithm = v3::CHECKSUM_XOR,
+                                           std::size_t payload_count = OZZY_PAYLOAD_COUNT_PER_CHUNK);
+
+    // Bitmask of the checksum algorithms we are able to calculate(v3::checksum_bit)
+    std::uint8_t supported_checksums() noexcept;
+
+    // The strongest algorithm from both bitmasks, CHECKSUM_XOR if there is nothing in common
+    v3::Checksum pick_checksum(std::uint8_t local, std::uint8_t remote) noexcept;
+
+    // Name of the kernel the algorithm is calculated with, for the logs
+    const char *checksum_kernel_name(v3::Checksum algorithm) noexcept;
 };
 
 #endif // __OZZ_PROTOCOL__
@@ -5,6 +5,38 @@ THREAD_CACHE_MAGIC = 0x595A5A4F
 THREAD_CACHE_START = 0xDEADBEEF
 THREAD_CACHE_END   = 0xC0FFEE
 
+# Version 2 file(look at base/LibFS/result_file.h)
+RESULT_FILE_VERSION     = 2
+RESULT_SESSION_COMPLETE = 1
+HEADER_FORMAT           = "<IIIIQQ32x"
+PAGE_FORMAT             = "<Q56x"
+ENTRY_FORMAT            = "<QQddQQII8x"
+
+def read_result_file_v2(file) -> List[List[str]]:
+    clients_data: List[List[str]] = []
+
+    file.seek(0)
+    _, _, _, page_entries, sessions_count, page_offset = struct.unpack(HEADER_FORMAT, file.read(64))
+
+    # Every session is reached through the directory, nothing is scanned
+    entries = []
+    while len(entries) < sessions_count:
+        file.seek(page_offset)
+        page_offset, = struct.unpack(PAGE_FORMAT, file.read(64))
+
+        for _ in range(min(page_entries, sessions_count - len(entries))):
+            entries.append(struct.unpack(ENTRY_FORMAT, file.read(64)))
+
+    for values_offset, count, _, _, _, _, _, state in entries:
+        if state != RESULT_SESSION_COMPLETE:
+            print("Skipping the session that is not complete")
+            continue
+
+        file.seek(values_offset)
+        clients_data.append(list(struct.unpack(f"<{count}d", file.read(count * 8))))
+
+    return clients_data
+
 def read_result_file() -> List[List[str]]:
     clients_data       : List[List[str]] = []
     current_client_data: List[str]       = []
@@ -12,16 +44,19 @@ def read_result_file() -> List[List[str]]:
     with open("result.bin", "rb") as file:
         print("Parsing result.bin file")
 
-        header_data = file.read(4)
-        if(not header_data):
+        header_data = file.read(8)
+        if(len(header_data) < 8):
             return
-        header = int.from_bytes(header_data, byteorder='little')
+        header, version = struct.unpack("<II", header_data)
 
         if header != THREAD_CACHE_MAGIC:
             print("Invalid file to process!")
             raise NotImplementedError()
 
-        file.read(4) # Skip THREAD_START directive
+        if version == RESULT_FILE_VERSION:
+            return read_result_file_v2(file)
+
+        # Version 1 file, THREAD_START directive is already skipped
 
         while True:
             hex_data = file.read(8)
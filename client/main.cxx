@@ -1,8 +1,10 @@
 #include <iostream>
+#include <utility>
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 
-#include "udp_client_v2.h"
+#include "udp_client_v3.h"
+#include "LibUDP/impairment.h"
 
 using boost::asio::ip::udp;
 
@@ -17,6 +19,21 @@ int main(int argc, char** argv)
         "x",
         boost::program_options::value<double>(),
         "Up bound for the doubles set"
+    )
+    (
+        "doubles",
+        boost::program_options::value<std::uint64_t>(),
+        "Count of the doubles to request from the server(as much as the server sends by default if not set)"
+    )
+    (
+        "protocol",
+        boost::program_options::value<int>()->default_value(3),
+        "Protocol version the clients speak(2 or 3)"
+    )
+    (
+        "impair",
+        boost::program_options::value<std::string>(),
+        "Impair the sent datagrams like the lossy link does, e.g. \"loss=0.01,delay=20,jitter=5,rate=100\"(see README)"
     );
 
     boost::program_options::variables_map variables_map;
@@ -45,6 +62,34 @@ int main(int argc, char** argv)
         std::cerr << "Set X to " << x << std::endl;
     }
 
+    std::uint64_t doubles_count = 0;
+    if (variables_map.contains("doubles"))
+    {
+        doubles_count = variables_map["doubles"].as<std::uint64_t>();
+        std::cerr << "Set count of requested doubles to the " << doubles_count << std::endl;
+    }
+
+    // The versions are counted from one on the command line, the enum counts them from zero
+    const int protocol = variables_map["protocol"].as<int>() - 1;
+    if (protocol != Ozzy::Proto::VERSION_2 && protocol != Ozzy::Proto::VERSION_3)
+    {
+        std::cerr << "Unsupported protocol version " << protocol + 1 << std::endl;
+        return -1;
+    }
+
+    if (variables_map.contains("impair"))
+    {
+        Ozzy::LibUDP::LinkImpairment impairment;
+        if (!Ozzy::LibUDP::parse_link_impairment(variables_map["impair"].as<std::string>(), impairment))
+        {
+            std::cerr << "Invalid link impairment " << variables_map["impair"].as<std::string>() << std::endl;
+            return -1;
+        }
+
+        Ozzy::LibUDP::impaired_link().configure(impairment);
+        std::cerr << "Impairing the sent datagrams with " << Ozzy::LibUDP::describe_link_impairment(impairment) << std::endl;
+    }
+
     try
     {
         boost::asio::io_context io_context;
@@ -54,11 +99,20 @@ int main(int argc, char** argv)
 
         for (int i = 0; i < num_clients; ++i)
         {
-            client_threads.emplace_back([&io_context, x, i]
+            client_threads.emplace_back([&io_context, x, doubles_count, protocol, i]
             {
                 try
                 {
-                    Ozzy::v2::UdpClient client(io_context, "config/client_cfg.cfg", "UdpClient" + std::to_string(i), x);
+                    // The v2 session always carries as much doubles as the server sends by default
+                    if (protocol == Ozzy::Proto::VERSION_2)
+                    {
+                        Ozzy::v2::UdpClient client(io_context, "config/client_cfg.cfg", "UdpClient" + std::to_string(i), x);
+                        client.process_handshake();
+                        return;
+                    }
+
+                    Ozzy::v3::UdpClient client(io_context, "config/client_cfg.cfg", "UdpClient" + std::to_string(i), x,
+                                               doubles_count);
                     client.process_handshake();
                 }
                 catch (const std::exception &e)
@@ -2,6 +2,7 @@
 #define __OZZY_UDP_CLIENT_BASE__
 
 #include <string>
+#include <utility>
 #include <boost/asio.hpp>
 #include "LibLog/logging.h"
 #include "LibUDP/networking.h"
@@ -67,7 +67,7 @@ namespace Ozzy::v2
 
     bool UdpClient::validate_protocol_versions() noexcept
     {
-        if (!LibUDP::send_data(m_session, Proto::VERSION_2))
+        if (!LibUDP::send_data(m_session, protocol_version()))
         {
             LibLog::log_print(m_logger_name, "Unable to send protocol specification to the server");
             return false;
@@ -118,9 +118,14 @@ namespace Ozzy::v2
         }
         LibLog::log_print(m_logger_name, "Validated server/client protocol versions");
 
-        // 2.1 Wait 3 seconds and send double set upper bound for the generated
-        // double values in the payload.
-        std::this_thread::sleep_for(std::chrono::seconds(3));
+        if (!negotiate_session())
+        {
+            LibLog::log_print(m_logger_name, "Session negotiation failed");
+            return;
+        }
+
+        // 2.1 Send double set upper bound for the generated double values in the payload, the
+        // server is already waiting for it
         if (!LibUDP::send_data(m_session, m_upper_bound))
         {
             LibLog::log_print(m_logger_name, "Unable to send data to the server");
@@ -128,10 +133,7 @@ namespace Ozzy::v2
             return;
         }
 
-        // 3. Client receives the frames with the payload in them. Validates the checksum if the frame
-        // and if all is correct, responds with Ack signal, otherwise with Nack, and re-receivers the frame.
-        server_answer_t        answer;
-        Proto::Frame           frame;
+        // 3. Client receives the frames with the payload in them.
         LibFS::ThreadCacheFile cache_file;
 
         if (cache_file.initialized_sucessfully())
@@ -139,6 +141,17 @@ namespace Ozzy::v2
         else
             LibUDP::send_data(m_session, Proto::v1::Answer::DROP);
 
+        receive_frames(cache_file);
+        cache_file.sort_file();
+    }
+
+    bool UdpClient::receive_frames(LibFS::ThreadCacheFile &cache_file) noexcept
+    {
+        // Validates the checksum of the frame and if all is correct, responds with Ack signal,
+        // otherwise with Nack, and re-receivers the frame.
+        server_answer_t answer;
+        Proto::Frame    frame;
+
         for (;;)
         {
             if (!LibUDP::receive_data(m_session, frame))
@@ -167,16 +180,14 @@ namespace Ozzy::v2
             if (!LibUDP::receive_data(m_session, answer))
             {
                 LibLog::log_print(m_logger_name, "Failed receiving data from the the client!");
-                break;
+                return false;
             }
 
             if (answer != Proto::v1::Answer::CONT)
             {
                 LibLog::log_print(m_logger_name, "Finished receiving the frame data from the server");
-                break;
+                return true;
             }
         }
-
-        cache_file.sort_file();
     }
 }
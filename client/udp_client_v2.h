@@ -3,6 +3,7 @@
 
 #include "udp_client_base.h"
 #include "protocol.h"
+#include "LibFS/thread_cache_file.h"
 
 namespace Ozzy::v2
 {
@@ -21,6 +22,24 @@ namespace Ozzy::v2
     private:
         bool validate_protocol_versions() noexcept;
 
+    protected:
+        // Protocol version that this client speaks
+        virtual Proto::Version protocol_version() const noexcept
+        {
+            return Proto::VERSION_2;
+        }
+
+        // Agree on the session parameters right after the versions are validated, returns
+        // false when the session should be closed
+        virtual bool negotiate_session() noexcept
+        {
+            return true;
+        }
+
+        // Receive the frames from the server and write them to the cache file, returns false
+        // when the transmission has failed
+        virtual bool receive_frames(LibFS::ThreadCacheFile &cache_file) noexcept;
+
     public:
         void process_handshake() noexcept override;
 
@@ -0,0 +1,329 @@
+#include "udp_client_v3.h"
+#include "LibLog/logging.h"
+#include "LibUDP/networking.h"
+#include "LibUDP/codec.h"
+#include "LibUDP/receiver.h"
+#include "LibTT/allocations.h"
+
+namespace Ozzy::v3
+{
+    using boost::asio::ip::udp;
+
+    Proto::v3::Negotiation UdpClient::offer_session_parameters() noexcept
+    {
+        // Offer the frames as large as the path allows, but only as long as the whole window
+        // of them fits into the socket receive buffer, the rest would be dropped by the kernel
+        const std::size_t datagram_size = LibUDP::reserve_receive_buffer(
+            m_session->socket, LibUDP::probe_datagram_size(m_session->endpoint), OZZY_ARQ_WINDOW_SIZE);
+
+        Proto::v3::Negotiation supported;
+        supported.checksums     = Proto::supported_checksums();
+        supported.codecs        = LibUDP::supported_codecs();
+        supported.datagram_size = static_cast<std::uint32_t>(datagram_size);
+        return supported;
+    }
+
+    bool UdpClient::accept_session_parameters(const Proto::v3::Negotiation &offered,
+                                              const Proto::v3::Negotiation &picked) noexcept
+    {
+        if (picked.checksums >= Proto::v3::CHECKSUM_COUNT ||
+            !(offered.checksums & Proto::v3::checksum_bit(static_cast<Proto::v3::Checksum>(picked.checksums))))
+        {
+            LibLog::log_print(m_logger_name, "Server picked unknown checksum algorithm");
+            return false;
+        }
+
+        if (picked.codecs >= Proto::v3::CODEC_COUNT ||
+            !(offered.codecs & Proto::v3::codec_bit(static_cast<Proto::v3::Codec>(picked.codecs))))
+        {
+            LibLog::log_print(m_logger_name, "Server picked unknown codec");
+            return false;
+        }
+
+        if (picked.datagram_size < Proto::v3::DEFAULT_DATAGRAM_SIZE || picked.datagram_size > offered.datagram_size ||
+            (picked.datagram_size - Proto::v3::FRAME_HEADER_SIZE) % sizeof(double) != 0)
+        {
+            LibLog::log_print(m_logger_name, "Server picked invalid frame size " + std::to_string(picked.datagram_size));
+            return false;
+        }
+
+        m_session->checksum      = static_cast<Proto::v3::Checksum>(picked.checksums);
+        m_session->codec         = static_cast<Proto::v3::Codec>(picked.codecs);
+        m_session->datagram_size = picked.datagram_size;
+        LibLog::log_print(m_logger_name, "Using " + std::string(Proto::checksum_kernel_name(m_session->checksum)) +
+                                         " checksum, " + LibUDP::payload_codec(m_session->codec).name() + " codec and " +
+                                         std::to_string(m_session->datagram_size) + " bytes frames");
+        return true;
+    }
+
+    bool UdpClient::negotiate_session() noexcept
+    {
+        const Proto::v3::Negotiation supported = offer_session_parameters();
+
+        if (!LibUDP::send_data(m_session, Proto::v3::Negotiation(supported)))
+        {
+            LibLog::log_print(m_logger_name, "Unable to send the checksum algorithms and codecs to the server");
+            return false;
+        }
+
+        Proto::v3::Negotiation picked;
+        if (!LibUDP::receive_data(m_session, picked))
+        {
+            LibLog::log_print(m_logger_name, "Unable to receive the picked checksum algorithm and codec");
+            return false;
+        }
+
+        return accept_session_parameters(supported, picked);
+    }
+
+    bool UdpClient::request_session(const Proto::v3::SessionRequest &request, Proto::v3::SessionAnswer &answer) noexcept
+    {
+        const auto retransmit_timeout = std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp);
+
+        // The server re-sends the lost answer together with the frames it re-sends, so once the
+        // frames are here there is no point in sending the request again
+        const auto idle_timeout = retransmit_timeout * (Proto::Constant::PacketRetransmitMaxAttempts + 1);
+
+        // Every datagram we receive replaces the session endpoint, but the request always goes
+        // to the server port
+        const udp::endpoint server_endpoint = m_session->endpoint;
+
+        for (std::size_t attempts = 0; attempts < Proto::PacketRetransmitMaxAttempts; ++attempts)
+        {
+            m_session->endpoint = server_endpoint;
+            if (!LibUDP::send_data(m_session, Proto::v3::SessionRequest(request)))
+            {
+                LibLog::log_print(m_logger_name, "Unable to send data to the server");
+                std::this_thread::sleep_for(retransmit_timeout);
+                continue;
+            }
+
+            bool session_running = false;
+            while (LibUDP::wait_readable(m_session, session_running ? idle_timeout : retransmit_timeout))
+            {
+                // Only the beginning of the frame is read, that's enough to skip it
+                std::array<std::uint8_t, sizeof(Proto::v3::SessionAnswer)> datagram{};
+                boost::system::error_code error;
+
+                const std::size_t size = m_session->socket.receive_from(boost::asio::buffer(datagram),
+                                                                        m_session->endpoint, 0, error);
+                if (error)
+                {
+                    break;
+                }
+
+                if (size == sizeof(Proto::v3::SessionAnswer) && datagram[0] == Proto::MESSAGE_TYPE_SESSION_ANSWER)
+                {
+                    std::memcpy(&answer, datagram.data(), sizeof(answer));
+                    LibUDP::swap_endianess(answer, m_session->to_big_endian);
+                    return true;
+                }
+
+                // The server that doesn't know the request answers with the bare v1/v2 answer
+                if (size < sizeof(Proto::v3::SessionAnswer))
+                {
+                    m_session->endpoint = server_endpoint;
+                    answer.answer  = Proto::v1::ERR_VERSIONS_INCOMPATIBLE;
+                    answer.version = Proto::VERSION_2;
+                    return true;
+                }
+
+                session_running = true;
+            }
+
+            LibLog::log_print(m_logger_name, "Unable to receive answer from the server");
+        }
+
+        return false;
+    }
+
+    void UdpClient::process_handshake() noexcept
+    {
+        // 1. Send everything the server needs to start the session with one request
+        Proto::v3::SessionRequest request;
+        request.version       = static_cast<std::uint8_t>(protocol_version());
+        request.offered       = offer_session_parameters();
+        request.doubles_count = m_doubles_count;
+        request.x_upper_bound = m_upper_bound;
+
+        Proto::v3::SessionAnswer answer;
+        if (!request_session(request, answer))
+        {
+            LibLog::log_print(m_logger_name, "Unable to send handshake to the server, connection discarded");
+            return;
+        }
+
+        // The session is already running on the server, it's closed with the acknowledgement
+        Proto::v3::Acknowledgement drop;
+        drop.answer = Proto::v1::DROP;
+
+        // 2. Server either accepts the session and starts sending the frames right away, or
+        // tells why it's not going to
+        switch (answer.answer)
+        {
+            case Proto::v1::ACK:
+            {
+                break;
+            }
+
+            case Proto::v1::ERR_VERSIONS_INCOMPATIBLE:
+            {
+                if (answer.version < Proto::VERSION_3)
+                {
+                    LibLog::log_print(m_logger_name, "Server has no single round-trip handshake, using the v2 one");
+                    v2::UdpClient::process_handshake();
+                    return;
+                }
+
+                LibLog::log_print(m_logger_name, "[Proto::v" + std::to_string(answer.version + 1) +
+                                                 " ] Client and server versions are incompatible");
+                return;
+            }
+
+            case Proto::v2::CLIENT_THREAD_POOL_EXHAUSED:
+            {
+                LibLog::log_print(m_logger_name, "[>Proto::v2] Server's client thread pool exhausted, handshake discarded");
+                return;
+            }
+
+            default:
+            {
+                LibLog::log_print(m_logger_name, "Server cannot handle handshake, connection discarded");
+                return;
+            }
+        }
+
+        if (!accept_session_parameters(request.offered, answer.picked))
+        {
+            LibLog::log_print(m_logger_name, "Session negotiation failed");
+            LibUDP::send_data(m_session, drop);
+            return;
+        }
+        LibLog::log_print(m_logger_name, "Server accepted handshake, receiving " + std::to_string(answer.doubles_count) +
+                                         " doubles");
+
+        // The re-sent request may have started one more session on the server, only the datagrams
+        // of the session that answered first are taken from now on
+        boost::system::error_code error;
+        m_session->socket.connect(m_session->endpoint, error);
+
+        // 3. Client receives the frames with the payload in them, the ones that arrive while the
+        // cache file is created wait in the socket buffer
+        LibFS::ThreadCacheFile cache_file;
+        if (!cache_file.initialized_sucessfully())
+        {
+            LibLog::log_print(m_logger_name, "Unable to create the cache file, connection discarded");
+            LibUDP::send_data(m_session, drop);
+            return;
+        }
+
+        // The partial data never goes to the result file, the cache file is removed with the object
+        if (!receive_frames(cache_file))
+        {
+            LibLog::log_print(m_logger_name, "Session with " + LibLog::serialize_endpoint(m_session->endpoint) +
+                                             " failed, received data discarded");
+            LibUDP::send_data(m_session, drop);
+            return;
+        }
+
+        cache_file.sort_file();
+    }
+
+    bool UdpClient::receive_frames(LibFS::ThreadCacheFile &cache_file) noexcept
+    {
+        // If the server is silent for that long, it has already given up retransmitting
+        const auto idle_timeout = std::chrono::milliseconds(
+            Proto::Constant::PacketRetransmitWaitTimestamp * (Proto::Constant::PacketRetransmitMaxAttempts + 1));
+
+        // Frames that arrived out of order wait in the receiver, the values go to the cache file in order
+        LibUDP::FrameReceiver receiver(*m_session);
+
+        const auto write_values = [&cache_file](const double *values, const std::size_t count)
+        {
+            cache_file.write_values(values, count);
+        };
+
+#ifdef OZZY_USE_UDP_OFFLOAD
+        m_session->offload = LibUDP::enable_offload(m_session->socket, {.coalescing = true});
+#endif
+
+        // Frames are received with one call per OZZY_UDP_BATCH_SIZE datagrams(or more when
+        // they arrive coalesced)
+        LibUDP::MessageSlots<Proto::v3::Frame> frames(
+            m_session->datagram_size,
+            LibUDP::receive_batch_capacity(m_session->datagram_size, m_session->offload.coalescing));
+
+#if OZZY_COUNT_ALLOCATIONS
+        // Everything the frames need is allocated by now
+        const std::uint64_t allocations_before = Component::heap_allocations();
+#endif
+
+        for (;;)
+        {
+            const bool finished = receiver.complete();
+
+            if (!LibUDP::wait_readable(m_session, idle_timeout))
+            {
+                // The close frame is lost, but we already have everything
+                if (finished)
+                {
+                    LibLog::log_print(m_logger_name, "Finished receiving the frame data from the server");
+                    return true;
+                }
+
+                LibLog::log_print(m_logger_name, "Server stopped sending the frames, connection discarded");
+                return false;
+            }
+
+            const std::size_t frames_received = LibUDP::receive_data_batch(m_session, frames);
+            if (frames_received == 0)
+            {
+                continue;
+            }
+
+            for (std::size_t frame_index = 0; frame_index < frames_received; ++frame_index)
+            {
+                switch (receiver.take(frames[frame_index], write_values))
+                {
+                    case LibUDP::FrameReceiver::Status::CLOSED:
+                    {
+                        // The server re-sends the close frame until it's acknowledged
+                        LibUDP::send_data(m_session, receiver.acknowledgement());
+                        LibLog::log_print(m_logger_name, "Finished receiving the frame data from the server, average receive "
+                                                         "batch fill is " +
+                                                         std::to_string(LibUDP::receive_batch_statistics().average_fill()) +
+                                                         "/" + std::to_string(OZZY_UDP_BATCH_SIZE));
+#if OZZY_COUNT_ALLOCATIONS
+                        LibLog::log_print(m_logger_name, "Heap allocations while receiving the frames: " +
+                                                         std::to_string(Component::heap_allocations() - allocations_before) +
+                                                         "(whole process)");
+#endif
+                        return receiver.complete();
+                    }
+
+                    case LibUDP::FrameReceiver::Status::CORRUPTED:
+                    {
+                        LibLog::log_print(m_logger_name, "Frame checksum calculation failed. Recieved frame data is corrupted");
+                        break;
+                    }
+
+                    case LibUDP::FrameReceiver::Status::UNDECODABLE:
+                    {
+                        LibLog::log_print(m_logger_name, "Unable to decode the frame " +
+                                                         std::to_string(receiver.expected_sequence()) +
+                                                         ", connection discarded");
+                        return false;
+                    }
+
+                    case LibUDP::FrameReceiver::Status::ACCEPTED:
+                    {
+                        break;
+                    }
+                }
+            }
+
+            // One acknowledgement per batch is enough, it describes the whole receive window
+            LibUDP::send_data(m_session, receiver.acknowledgement());
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef __UDP_CLIENT_V3__
+#define __UDP_CLIENT_V3__
+
+#include "udp_client_v2.h"
+#include "protocol.h"
+
+namespace Ozzy::v3
+{
+    using boost::asio::ip::udp;
+
+    // Receives the numbered frames of the sliding window ARQ, puts the frames that arrived
+    // out of order into the reorder buffer, and writes them to the cache file in order.
+    class UdpClient : public v2::UdpClient
+    {
+    public:
+        // With `doubles_count` of zero the server sends as much doubles as it does by default
+        UdpClient(boost::asio::io_context &io_context, const std::string &config_path, const std::string logger_name, const double x,
+                  const std::uint64_t doubles_count = 0)
+            : v2::UdpClient(io_context, config_path, logger_name, x), m_doubles_count(doubles_count)
+        {
+        }
+
+        // Set the session up with one request and one answer, the frames follow the answer right
+        // away. Falls back to the v2 handshake when the server doesn't know the request.
+        void process_handshake() noexcept override;
+
+    protected:
+        Proto::Version protocol_version() const noexcept override
+        {
+            return Proto::VERSION_3;
+        }
+
+        // Offer every checksum algorithm we have, the server picks one
+        bool negotiate_session() noexcept override;
+
+        bool receive_frames(LibFS::ThreadCacheFile &cache_file) noexcept override;
+
+    private:
+        // Every checksum algorithm and codec we have, and the largest frame we are able to take
+        Proto::v3::Negotiation offer_session_parameters() noexcept;
+
+        // Validate what the server picked from the `offered` parameters and set them up for the session
+        bool accept_session_parameters(const Proto::v3::Negotiation &offered, const Proto::v3::Negotiation &picked) noexcept;
+
+        // Send the request until the server answers, false if it never does. The short answer of
+        // the server without the single round-trip handshake is reported as ERR_VERSIONS_INCOMPATIBLE
+        // with VERSION_2.
+        bool request_session(const Proto::v3::SessionRequest &request, Proto::v3::SessionAnswer &answer) noexcept;
+
+    private:
+        std::uint64_t m_doubles_count;
+    };
+}
+
+#endif // __UDP_CLIENT_V3__
@@ -1,7 +1,9 @@
 #include <iostream>
+#include <utility>
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
-#include "udp_server_v2.h"
+#include "udp_server_v3.h"
+#include "LibUDP/impairment.h"
 
 auto main(int argc, char** argv) -> int
 {
@@ -17,6 +19,11 @@ auto main(int argc, char** argv) -> int
         "doubles",
         boost::program_options::value<std::uint64_t>(),
         "Count of the doubles to send to the client"
+    )
+    (
+        "impair",
+        boost::program_options::value<std::string>(),
+        "Impair the sent datagrams like the lossy link does, e.g. \"loss=0.01,delay=20,jitter=5,rate=100\"(see README)"
     );
 
     boost::program_options::variables_map variables_map;
@@ -44,18 +51,41 @@ auto main(int argc, char** argv) -> int
         std::cerr << "Set count of sended doubles to the " << doubles_count << std::endl;
     }
 
+    if (variables_map.contains("impair"))
+    {
+        Ozzy::LibUDP::LinkImpairment impairment;
+        if (!Ozzy::LibUDP::parse_link_impairment(variables_map["impair"].as<std::string>(), impairment))
+        {
+            std::cerr << "Invalid link impairment " << variables_map["impair"].as<std::string>() << std::endl;
+            return -1;
+        }
+
+        Ozzy::LibUDP::impaired_link().configure(impairment);
+        std::cerr << "Impairing the sent datagrams with " << Ozzy::LibUDP::describe_link_impairment(impairment) << std::endl;
+    }
+
     //
     // Initialize main routine
     //
     try
     {
         boost::asio::io_context context;
-        Ozzy::v2::UdpServer     server(context, "config/server_cfg.cfg", "UdpServer", doubles_count);
+        Ozzy::v3::UdpServer     server(context, "config/server_cfg.cfg", "UdpServer", doubles_count);
         server.start();
 
-        while (true)
+        for (std::uint64_t tick = 1;; ++tick)
         {
             std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            // What the emulated link did so far, every 10 seconds
+            const Ozzy::LibUDP::LinkStatistics &link = Ozzy::LibUDP::impaired_link().statistics();
+            if (Ozzy::LibUDP::impaired_link().enabled() && tick % 100 == 0)
+            {
+                std::cerr << "Link: " << link.datagrams.load() << " datagrams, " << link.lost.load() << " lost, "
+                          << link.overflowed.load() << " overflowed, " << link.reordered.load() << " reordered, "
+                          << link.duplicated.load() << " duplicated, " << link.corrupted.load() << " corrupted"
+                          << std::endl;
+            }
         }
     }
     catch (std::exception &e)
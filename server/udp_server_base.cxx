@@ -1,85 +1,282 @@
 #include "udp_server_base.h"
 #include "LibLog/logging.h"
 #include "LibUDP/networking.h"
+#include "LibTT/slab_pool.h"
 
 namespace Ozzy::Base
 {
-    thread_local std::mt19937_64 UdpServerBase::m_random_engine;
-
     UdpServerBase::~UdpServerBase()
     {
-        m_server_thread .join();
-        m_general_socket.close();
+        m_should_quit.store(true);
+
+        // Sessions that are still running are destroyed together with the
+        // io_context, we only need to make sure nobody is running them now
+        m_work_guard.reset();
+        m_io_context.stop();
 
-        // We really want all threads to be joined
-        std::this_thread::sleep_for(std::chrono::seconds(3));
-        m_thread_cleaner.join();
-        m_io_context    .stop();
+        for (auto &thread: m_io_threads)
+        {
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+        for (auto &listener: m_listeners)
+        {
+            boost::system::error_code error;
+            listener->socket.close(error);
+        }
+    }
+
+    std::size_t UdpServerBase::io_threads_count() noexcept
+    {
+        if (OZZY_SERVER_IO_THREADS != 0)
+        {
+            return OZZY_SERVER_IO_THREADS;
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
     }
 
-    void UdpServerBase::start_receiving()
+    boost::asio::awaitable<void> UdpServerBase::start_receiving(Listener &listener)
     {
         while (!m_should_quit.load())
         {
-            while (!m_process_next_request.load())
+            boost::system::error_code error;
+
+            co_await listener.socket.async_wait(udp::socket::wait_read,
+                                                 boost::asio::redirect_error(boost::asio::use_awaitable, error));
+            if (error == boost::asio::error::operation_aborted)
             {
+                break;
             }
 
-            udp::endpoint client_endpoint;
-            boost::system::error_code error;
-
-            const std::size_t bytes_received = m_general_socket.receive_from(
-                boost::asio::buffer(m_receive_buffer),
-                client_endpoint, 0, error
+            // The buffers are owned by this coroutine only, handle_message() copies
+            // everything it needs out of them before spawning the session, so there is
+            // no need to wait for the session to pick the request up. The listeners run
+            // on the io threads side by side, handle_message() is safe to be called so.
+            const std::size_t messages_received = LibUDP::receive_batch(
+                listener.socket, listener.buffers.data(), sizeof(receive_slot_t), listener.buffers.size(),
+                listener.sizes.data(), listener.endpoints.data(), error
             );
 
-            if (!error)
+            for (std::size_t i = 0; i < messages_received; ++i)
             {
-                handle_message(client_endpoint, bytes_received);
+                // Datagrams of the running shared sessions are only handed over to them
+                if (OZZY_USE_SHARED_SESSION_SOCKET)
+                {
+                    if (auto inbox = m_session_table.find(listener.endpoints[i]))
+                    {
+                        LibUDP::SessionInbox::deliver(inbox, listener.buffers[i].data(), listener.sizes[i]);
+                        continue;
+                    }
+                }
+
+                handle_message(listener.endpoints[i], listener.buffers[i].data(), listener.sizes[i]);
             }
-            else
+
+            if (error && error != boost::asio::error::would_block)
             {
                 LibLog::log_print(m_logger_name, "Receive error: " + error.message());
             }
         }
     }
 
-    void UdpServerBase::start()
+    UdpServerBase::SpawnResult UdpServerBase::spawn_session(const udp::endpoint &endpoint, const bool to_big_endian,
+                                                            const std::optional<Proto::v3::SessionRequest> &request)
+    {
+        const PendingHandshake handshake{endpoint, to_big_endian, std::chrono::steady_clock::now(), request};
+        {
+            std::lock_guard lock(m_sessions_mutex);
+
+            // The client re-sends the request every PacketRetransmitWaitTimestamp until it gets the
+            // answer, which takes much longer when the request waits in the queue
+            if (request && m_request_endpoints.contains(endpoint))
+            {
+                return SpawnResult::DUPLICATE;
+            }
+
+            const bool slot_taken = m_active_sessions < CLIENTS_THREAD_POOL_CAPACITY;
+            if (!slot_taken && m_pending_handshakes.size() >= OZZY_PENDING_HANDSHAKES &&
+                drop_expired_handshakes(handshake.received_at) == 0)
+            {
+                return SpawnResult::EXHAUSTED;
+            }
+
+            // Forgotten in finish_session()
+            if (request)
+            {
+                m_request_endpoints.insert(endpoint);
+            }
+
+            if (!slot_taken)
+            {
+                m_pending_handshakes.push_back(handshake);
+                return SpawnResult::ACCEPTED;
+            }
+            ++m_active_sessions;
+        }
+
+        start_session(handshake);
+        return SpawnResult::ACCEPTED;
+    }
+
+    std::size_t UdpServerBase::drop_expired_handshakes(const std::chrono::steady_clock::time_point now)
+    {
+        // The queue is in the arrival order, so the expired handshakes are at its front
+        const auto give_up_timeout = std::chrono::milliseconds(
+            Proto::Constant::PacketRetransmitWaitTimestamp * Proto::Constant::PacketRetransmitMaxAttempts);
+
+        std::size_t dropped = 0;
+        while (!m_pending_handshakes.empty() && now - m_pending_handshakes.front().received_at >= give_up_timeout)
+        {
+            if (m_pending_handshakes.front().request)
+            {
+                m_request_endpoints.erase(m_pending_handshakes.front().endpoint);
+            }
+
+            m_pending_handshakes.pop_front();
+            ++dropped;
+        }
+
+        return dropped;
+    }
+
+    void UdpServerBase::finish_session(const PendingHandshake &finished)
     {
-        m_server_thread = std::thread([this]
+        std::optional<PendingHandshake> next;
+        std::size_t                     dropped = 0;
+        {
+            std::lock_guard lock(m_sessions_mutex);
+            if (finished.request)
+            {
+                m_request_endpoints.erase(finished.endpoint);
+            }
+
+            // Nobody would take the frames of these sessions
+            dropped = drop_expired_handshakes(std::chrono::steady_clock::now());
+            if (m_pending_handshakes.empty())
+            {
+                --m_active_sessions;
+            }
+            else
+            {
+                // The slot goes to the next handshake right away, the count stays the same
+                next = m_pending_handshakes.front();
+                m_pending_handshakes.pop_front();
+            }
+        }
+
+        if (dropped > 0)
         {
-            start_receiving();
-        });
+            LibLog::log_print(m_logger_name, "Dropped " + std::to_string(dropped) +
+                                             " pending handshakes, their clients have already given up");
+        }
 
-        m_thread_cleaner = std::thread([this]
+        if (!next)
         {
-            while (true)
+            return;
+        }
+
+        const PendingHandshake &handshake = *next;
+        const auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - handshake.received_at);
+        LibLog::log_print(m_logger_name, "Handshake from " + LibLog::serialize_endpoint(handshake.endpoint) +
+                                         " waited " + std::to_string(waited.count()) + "ms for the session slot");
+
+        start_session(handshake);
+    }
+
+    void UdpServerBase::start_session(const PendingHandshake &handshake)
+    {
+        // Every session runs on its own strand, so the timers are able to cancel the
+        // session socket operations safely(and the shared session inbox lives on it).
+        auto strand = boost::asio::make_strand(m_io_context);
+
+        std::shared_ptr<LibUDP::Session> session;
+        try
+        {
+            // The shared session answers from one of the listeners, the client takes the
+            // address it's answered from as the session address anyway. The session with its
+            // own socket is the fallback when the endpoint can't be shared.
+            if (OZZY_USE_SHARED_SESSION_SOCKET)
             {
-                std::size_t joined_total = 0;
-                for (std::size_t i = 0; i < m_client_threads.size(); ++ i)
+                const std::uint32_t id = m_next_session_id.fetch_add(1, std::memory_order_relaxed);
+                auto inbox = std::allocate_shared<LibUDP::SessionInbox>(
+                    Component::PoolAllocator<LibUDP::SessionInbox>(), strand, id);
+
+                if (m_session_table.insert(handshake.endpoint, inbox))
                 {
-                    if (m_client_threads[i].joinable())
-                    {
-                        m_client_threads    [i].join();
-                        m_client_connections[i]->close();
+                    session = std::allocate_shared<LibUDP::Session>(
+                        Component::PoolAllocator<LibUDP::Session>(), m_io_context, handshake.endpoint,
+                        m_listeners[id % m_listeners.size()]->socket, inbox);
+                }
+            }
 
-                        m_client_threads    .erase(m_client_threads.begin()     + i);
-                        m_client_connections.erase(m_client_connections.begin() + 1);
-                        --i;
+            // The session objects come from the pool, there are a lot of them over the server life
+            if (!session)
+            {
+                session = std::allocate_shared<LibUDP::Session>(Component::PoolAllocator<LibUDP::Session>(),
+                                                                m_io_context, handshake.endpoint);
+            }
+        }
+        catch (const std::exception &ex)
+        {
+            LibLog::log_print(m_logger_name, "Exception when creating session context: " + std::string(ex.what()));
+            finish_session(handshake);
+            return;
+        }
+        session->to_big_endian = handshake.to_big_endian;
 
-                        ++joined_total;
+        // The completion handler is the only owner of the slot, so the slot is handed over
+        // as soon as the coroutine is finished(no polling needed).
+        boost::asio::co_spawn(strand, handshake.request ? handle_session_request(session, *handshake.request)
+                                                        : handle_handshake(session),
+            [this, session, handshake](std::exception_ptr exception)
+            {
+                if (exception)
+                {
+                    try
+                    {
+                        std::rethrow_exception(exception);
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        LibLog::log_print(m_logger_name, "Exception in the session: " + std::string(ex.what()));
+                    }
+                    catch (...)
+                    {
+                        LibLog::log_print(m_logger_name, "Unknown exception in the session");
                     }
                 }
 
-                if (joined_total > 0)
+                session->close();
+                if (session->inbox)
                 {
-                    LibLog::log_print("[Ozzy::UdpServerBase::ThreadCleaner] ",
-                                      "Released " + std::to_string(joined_total) + " finished threads");
+                    m_session_table.erase(handshake.endpoint, session->inbox->id());
                 }
-                std::this_thread::sleep_for(std::chrono::seconds(2));
-            }
-        });
+                finish_session(handshake);
+            });
+    }
+
+    void UdpServerBase::start()
+    {
+        for (auto &listener: m_listeners)
+        {
+            boost::asio::co_spawn(m_io_context, start_receiving(*listener), boost::asio::detached);
+        }
+
+        const std::size_t threads_count = io_threads_count();
+
+        m_work_guard.emplace(m_io_context.get_executor());
+        for (std::size_t i = 0; i < threads_count; ++i)
+        {
+            m_io_threads.emplace_back([this]
+            {
+                m_io_context.run();
+            });
+        }
 
-        LibLog::log_print(m_logger_name, "Server started");
+        LibLog::log_print(m_logger_name, "Server started with " + std::to_string(threads_count) + " io threads and " +
+                                         std::to_string(m_listeners.size()) + " listeners");
     }
 }
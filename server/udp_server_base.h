@@ -4,6 +4,13 @@
 #include <stdexcept>
 #include <random>
 #include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <utility>
 #include <boost/asio.hpp>
 
 #include "protocol.h"
@@ -21,6 +28,43 @@
 #   endif
 #endif
 
+// How much handshakes can wait for the free session slot, when the server already runs
+// CLIENTS_THREAD_POOL_CAPACITY sessions. Only the handshakes above that are answered with
+// the CLIENT_THREAD_POOL_EXHAUSED.
+#ifndef OZZY_PENDING_HANDSHAKES
+#   define OZZY_PENDING_HANDSHAKES 4096
+#else
+#   if OZZY_PENDING_HANDSHAKES < 0
+#       error "Invalid value set for OZZY_PENDING_HANDSHAKES"
+#   endif
+#endif
+
+// How much threads are running the sessions coroutines, zero means one thread
+// per hardware core
+#ifndef OZZY_SERVER_IO_THREADS
+#   define OZZY_SERVER_IO_THREADS 0
+#else
+#   if OZZY_SERVER_IO_THREADS < 0
+#       error "Invalid value set for OZZY_SERVER_IO_THREADS"
+#   endif
+#endif
+
+// How much sockets are receiving the handshakes on the server port(SO_REUSEPORT), each of them
+// is served by its own coroutine. Zero means one listener per io thread.
+#ifndef OZZY_SERVER_LISTENERS
+#   define OZZY_SERVER_LISTENERS 0
+#else
+#   if OZZY_SERVER_LISTENERS < 0
+#       error "Invalid value set for OZZY_SERVER_LISTENERS"
+#   endif
+#endif
+
+// Steer the handshakes to the listeners by the CPU they are received on(SO_ATTACH_REUSEPORT_CBPF),
+// instead of the kernel flow hash
+#ifndef OZZY_USE_REUSEPORT_CBPF
+#   define OZZY_USE_REUSEPORT_CBPF 0
+#endif
+
 namespace Ozzy::Base
 {
     using boost::asio::ip::udp;
@@ -29,12 +73,9 @@ namespace Ozzy::Base
     {
     protected:
         UdpServerBase(boost::asio::io_context &io_context, const std::string &config_path, const std::string &logger_name, const std::uint64_t doubles_count)
-            : Informative(logger_name), m_general_socket(io_context), m_io_context(io_context), m_doubles_count(doubles_count)
+            : Informative(logger_name), m_io_context(io_context), m_doubles_count(doubles_count),
+              m_session_table(OZZY_USE_SHARED_SESSION_SOCKET ? CLIENTS_THREAD_POOL_CAPACITY : 0)
         {
-            // Initialize RNG
-            std::random_device m_random_device;
-            m_random_engine = std::mt19937_64(m_random_device());
-
             // Load configuration file
             if (!config_load(config_path))
             {
@@ -48,13 +89,20 @@ namespace Ozzy::Base
                 return;
             }
 
-            // Setup main server socket
+            // Setup the listener sockets, every one of them is bound to the server port
+            std::vector<std::unique_ptr<Listener>> listeners;
             try
             {
-                m_general_socket.open(udp::v4());
-
                 const int port_number = std::stoi(m_config["port"]);
-                m_general_socket.bind(udp::endpoint(udp::v4(), static_cast<std::uint16_t>(port_number)));
+                const udp::endpoint endpoint(udp::v4(), static_cast<std::uint16_t>(port_number));
+
+                const std::size_t listeners_count = OZZY_SERVER_LISTENERS == 0 ? io_threads_count()
+                                                                               : OZZY_SERVER_LISTENERS;
+                for (std::size_t i = 0; i < listeners_count; ++i)
+                {
+                    listeners.push_back(std::make_unique<Listener>(io_context));
+                    LibUDP::bind_reuse_port(listeners.back()->socket, endpoint);
+                }
             }
             catch (const std::invalid_argument &)
             {
@@ -73,14 +121,20 @@ namespace Ozzy::Base
                 LibLog::log_print(m_logger_name, "Exception: " + std::string(ex.what()));
                 return;
             }
+            m_listeners = std::move(listeners);
 
-            m_process_next_request.store(true, std::memory_order_release);
+#if OZZY_USE_REUSEPORT_CBPF
+            if (m_listeners.size() > 1 && !LibUDP::attach_cpu_steering(m_listeners.front()->socket, m_listeners.size()))
+            {
+                LibLog::log_print(m_logger_name, "Unable to steer the listeners by the CPU, using the flow hash");
+            }
+#endif
         }
 
         virtual ~UdpServerBase();
 
     public:
-        // Start the server thread
+        // Start the accept loop and the threads running the sessions
         void start();
 
         UdpServerBase(const UdpServerBase&)            = delete;
@@ -88,38 +142,120 @@ namespace Ozzy::Base
         UdpServerBase& operator=(const UdpServerBase&) = delete;
 
     private:
-        // Receive the message from the client
-        void start_receiving();
+        // Accept loop receives up to OZZY_UDP_BATCH_SIZE requests at once. Only the handshakes
+        // come here(the frames go to the session sockets, whatever size is negotiated for them),
+        // so one default frame is more than enough for any of them.
+        using receive_slot_t = std::array<std::uint8_t, Proto::v3::DEFAULT_DATAGRAM_SIZE>;
+
+        // Socket of the server port with the buffers of its accept loop
+        struct Listener
+        {
+            explicit Listener(boost::asio::io_context &io_context)
+                : socket(io_context)
+            {
+            }
+
+            udp::socket                                    socket;
+            std::vector<receive_slot_t>                    buffers{OZZY_UDP_BATCH_SIZE};
+            std::array<std::size_t,   OZZY_UDP_BATCH_SIZE> sizes{};
+            std::array<udp::endpoint, OZZY_UDP_BATCH_SIZE> endpoints{};
+        };
+
+        // OZZY_SERVER_IO_THREADS, or the count of the hardware cores
+        static std::size_t io_threads_count() noexcept;
+
+        // Receive the messages from the clients on the listener
+        boost::asio::awaitable<void> start_receiving(Listener &listener);
+
+        // Handshake that waits for the free session slot, the session socket is created
+        // only when it is started
+        struct PendingHandshake
+        {
+            udp::endpoint                            endpoint;
+            bool                                     to_big_endian;
+            std::chrono::steady_clock::time_point    received_at;
+
+            // Everything the single round-trip handshake carries, nothing for the v2 one
+            std::optional<Proto::v3::SessionRequest> request;
+        };
+
+        // Create the session and spawn its handshake coroutine, the slot is already taken
+        void start_session(const PendingHandshake &handshake);
+
+        // Hand the slot of the `finished` session to the oldest pending handshake, or free it
+        void finish_session(const PendingHandshake &finished);
+
+        // Forget the pending handshakes whose clients have already given up waiting for the
+        // answer(PacketRetransmitMaxAttempts x PacketRetransmitWaitTimestamp), m_sessions_mutex
+        // should be held
+        std::size_t drop_expired_handshakes(std::chrono::steady_clock::time_point now);
 
     protected:
+        // What spawn_session() did with the handshake
+        enum class SpawnResult
+        {
+            // The session is started, or the handshake waits for the free slot
+            ACCEPTED,
+
+            // The endpoint already has the session request that is running or waiting, this one
+            // is the client's re-transmit and is ignored
+            DUPLICATE,
+
+            // The pending queue is full, the client should be answered with CLIENT_THREAD_POOL_EXHAUSED
+            EXHAUSTED,
+        };
+
+        // Spawn the handshake coroutine for the client, or put the handshake into the pending
+        // queue when the server already runs CLIENTS_THREAD_POOL_CAPACITY sessions. Only one
+        // single round-trip session is kept per endpoint, the re-sent requests are DUPLICATE.
+        SpawnResult spawn_session(const udp::endpoint &endpoint, bool to_big_endian,
+                                  const std::optional<Proto::v3::SessionRequest> &request = std::nullopt);
+
         // Handle the received message
-        virtual void handle_message(udp::endpoint client_endpoint, std::size_t bytes_received) noexcept = 0;
+        virtual void handle_message(udp::endpoint client_endpoint, const std::uint8_t *message,
+                                    std::size_t bytes_received) noexcept = 0;
 
         // Handle the handshake between the server and the client
-        virtual void handle_handshake(std::shared_ptr<LibUDP::Session>&& session) noexcept = 0;
+        virtual boost::asio::awaitable<void> handle_handshake(std::shared_ptr<LibUDP::Session> session) = 0;
+
+        // Handle the single round-trip handshake, the request is already in the host order
+        virtual boost::asio::awaitable<void> handle_session_request(std::shared_ptr<LibUDP::Session> session,
+                                                                    Proto::v3::SessionRequest request) = 0;
 
         // Send individual frame to the client
-        virtual bool send_frame(std::shared_ptr<LibUDP::Session>& session, Proto::Frame frame) noexcept = 0;
+        virtual boost::asio::awaitable<bool> send_frame(std::shared_ptr<LibUDP::Session>& session, Proto::Frame frame) = 0;
 
         // Send array of frames with random doubles from -x to x
-        virtual bool send_frame_array(std::shared_ptr<LibUDP::Session>& session, double x) noexcept = 0;
+        virtual boost::asio::awaitable<bool> send_frame_array(std::shared_ptr<LibUDP::Session>& session, double x) = 0;
 
     private:
-        std::atomic<bool> m_should_quit;
-        std::thread       m_server_thread;
-        udp::socket       m_general_socket;
-        std::thread       m_thread_cleaner;
+        using work_guard_t = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
 
-    protected:
-        mutable             std::uint64_t   m_doubles_count;
-        static thread_local std::mt19937_64 m_random_engine;
+        std::atomic<bool>           m_should_quit;
+        std::optional<work_guard_t> m_work_guard;
+        std::vector<std::thread>    m_io_threads;
 
-        std::vector<std::shared_ptr<LibUDP::Session>> m_client_connections;
-        std::vector<std::thread    >                  m_client_threads;
+    protected:
+        mutable std::uint64_t        m_doubles_count;
 
-        std::atomic<bool>            m_process_next_request;
         boost::asio::io_context     &m_io_context;
-        std::array<std::uint8_t, Proto::Constant::TransmittionUnitSize> m_receive_buffer{};
+
+    private:
+        // Sessions that hold the slot, and the handshakes waiting for one
+        std::mutex                   m_sessions_mutex;
+        std::size_t                  m_active_sessions = 0;
+        std::deque<PendingHandshake> m_pending_handshakes;
+
+        // Endpoints of the single round-trip sessions that are running or pending. The v2 handshake
+        // is not tracked, its client re-sends it only when the session answer was lost, and the new
+        // session is the only one that answers it.
+        std::set<udp::endpoint>      m_request_endpoints;
+
+        std::vector<std::unique_ptr<Listener>> m_listeners;
+
+        // Sessions that share the listener sockets(OZZY_USE_SHARED_SESSION_SOCKET)
+        LibUDP::SessionTable         m_session_table;
+        std::atomic<std::uint32_t>   m_next_session_id{0};
     };
 }
 
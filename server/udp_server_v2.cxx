@@ -1,74 +1,74 @@
 #include "udp_server_v2.h"
 #include "LibUDP/networking.h"
+#include "LibUDP/generator.h"
 #include "LibLog/logging.h"
 
 namespace Ozzy::v2
 {
-    bool UdpServer::send_frame(std::shared_ptr<LibUDP::Session> &session, Proto::Frame frame) noexcept
+    boost::asio::awaitable<bool> UdpServer::send_frame(std::shared_ptr<LibUDP::Session> &session, Proto::Frame frame)
     {
         client_answer_t answer;
+        boost::asio::steady_timer retransmit_timer(co_await boost::asio::this_coro::executor);
 
         for (std::size_t i = 0u; i < Proto::Constant::PacketRetransmitMaxAttempts; ++i)
         {
-            if (!LibUDP::send_data(session, frame))
+            if (!co_await LibUDP::async_send_data(session, frame))
             {
                 LibLog::log_print(m_logger_name,
                                   "Failed sending frame(sending failed) to the client, connection unstable");
-                return false;
+                co_return false;
             }
 
-            if (!LibUDP::receive_data(session, answer))
+            if (!co_await LibUDP::async_receive_data(session, answer))
             {
                 LibLog::log_print(m_logger_name,
                                   "Failed sending frame(receiving answer failed) to the client, connection unstable");
-                return false;
+                co_return false;
             }
 
             // If client answered with Ack, it means that it received frame succesfully, otherwise try sending the
             // frame again.
             if (answer == Proto::v1::Answer::ACK)
             {
-                return true;
+                co_return true;
             }
             if (answer == Proto::v1::Answer::DROP)
             {
                 LibLog::log_print(m_logger_name,
                                   "Client requested to drop the connection " + LibLog::serialize_endpoint(
                                       session->endpoint));
-                return false;
+                co_return false;
             }
 
+            // Don't block the io thread, other sessions are running on it
             LibLog::log_print(m_logger_name, "Failed sending frame to the client retrying...");
-            std::this_thread::sleep_for(std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp));
+            retransmit_timer.expires_after(std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp));
+            co_await retransmit_timer.async_wait(boost::asio::use_awaitable);
         }
 
-        return false;
+        co_return false;
     }
 
-    bool UdpServer::send_frame_array(std::shared_ptr<LibUDP::Session> &session, double x) noexcept
+    boost::asio::awaitable<bool> UdpServer::send_frame_array(std::shared_ptr<LibUDP::Session> &session, double x)
     {
-        const int unsigned frames_total = (m_doubles_count + Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK - 1) /
+        const int unsigned frames_total = (session->doubles_count + Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK - 1) /
                                           Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK;
-        int unsigned doubles_remain = m_doubles_count;
+        int unsigned doubles_remain = session->doubles_count;
 
         // Setup initial frame data
         Proto::Frame frame;
 
-        // Setup initial RNG data
-        std::random_device seed = std::random_device();
-        m_random_engine = std::mt19937_64(seed());
+        // The values are generated ahead of us on the generator thread
+        const std::shared_ptr<LibUDP::PayloadStream> payload_stream =
+            LibUDP::payload_generator().open_stream(session->doubles_count, -x, x);
 
-        std::uniform_real_distribution<double> real_distribution(-x, x);
         for (std::size_t k = 0; k < frames_total; ++k)
         {
             // Bake the frame
             const std::size_t remaining = doubles_remain % Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK;
             frame.length = remaining == 0 ? Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK : remaining;
 
-            for (std::size_t i = 0; i < frame.length; ++i)
-            {
-                frame.payload[i] = real_distribution(m_random_engine);
-            }
+            payload_stream->take(frame.payload, frame.length);
 
             frame.checksum = calculate_frame_checksum(frame);
 
@@ -77,71 +77,102 @@ namespace Ozzy::v2
             //
             // If the client repsponded with Nack more than PacketRetransmitMaxAttempt, than
             // connection is marked as unstable and should be closed.
-            if (!send_frame(session, frame))
+            if (!co_await send_frame(session, frame))
             {
                 LibLog::log_print(m_logger_name, "Unable to send the frame to the client");
-                return false;
+                co_return false;
             }
 
             doubles_remain -= frame.length;
 
             if (k + 1 == frames_total)
-                LibUDP::send_data(session, Proto::v1::Answer::BRK);
+                co_await LibUDP::async_send_data(session, Proto::v1::Answer::BRK);
             else
-                LibUDP::send_data(session, Proto::v1::Answer::CONT);
+                co_await LibUDP::async_send_data(session, Proto::v1::Answer::CONT);
         }
 
-        return true;
+        co_return true;
     }
 
-    void UdpServer::handle_message(udp::endpoint client_endpoint, const std::size_t bytes_received) noexcept
+    void UdpServer::handle_message(udp::endpoint client_endpoint, const std::uint8_t *message,
+                                   const std::size_t bytes_received) noexcept
     {
-        m_process_next_request.store(false);
-
-        // Create the socket, that will handle the response routine for this message
-        boost::asio::io_context          io_context;
-        std::shared_ptr<LibUDP::Session> session;
-	
-	    try
-      	    {
-	        session = std::make_shared<LibUDP::Session>(io_context, client_endpoint);
-	    }
-	    catch(const std::exception& ex)
-	    {
-	        LibLog::log_print(m_logger_name, "Exception when creating session context: " + std::string(ex.what()));
-
-            	m_process_next_request.store(true);
-	        return;
-	    }
+        // Find out client endianes, the message without the marker is answered in our order
+        bool to_big_endian = false;
+        const bool has_endian_marker = LibUDP::detect_endianess(message, bytes_received, to_big_endian);
+
+        // Create the socket, that will answer the request the session is not started for
+        const auto answer = [this, &client_endpoint, to_big_endian](auto answer)
+        {
+            try
+            {
+                auto session = std::make_shared<LibUDP::Session>(m_io_context, client_endpoint);
+                session->to_big_endian = to_big_endian;
+
+                LibUDP::send_data(session, answer);
+                session->close();
+            }
+            catch(const std::exception& ex)
+            {
+                LibLog::log_print(m_logger_name, "Exception when creating session context: " + std::string(ex.what()));
+            }
+        };
 
         // Validate that we received at least enough data to validate the
         // request
-        if (bytes_received < sizeof(Proto::Handshake))
+        if (bytes_received < sizeof(Proto::Handshake) || !has_endian_marker)
         {
             LibLog::log_print(m_logger_name, "Recieve failed, requested re-transmit");
-            LibUDP::send_data(session, Proto::v1::NACK);
-            m_process_next_request.store(true);
+            answer(Proto::v1::NACK);
             return;
         }
 
-        // Find out client endianes
-        session->to_big_endian = m_receive_buffer[0] != 1;
-        const std::uint8_t message = m_receive_buffer[1];
+        const std::uint8_t message_type = message[Proto::HANDSHAKE_TYPE_OFFSET];
 
-        if (message == Proto::MESSAGE_TYPE_HANDSHAKE)
+        // The single round-trip client waits for the SessionAnswer, the v2 one for the bare answer
+        const auto reject = [this, &answer, message_type](auto code)
         {
-            // Create the separate thread for the client
-            if (m_client_connections.size() < CLIENTS_THREAD_POOL_CAPACITY)
+            if (message_type != Proto::MESSAGE_TYPE_SESSION_REQUEST)
             {
-                m_client_connections.push_back(session);
-                m_client_threads.emplace_back(&UdpServer::handle_handshake, this, std::move(session));
+                answer(code);
+                return;
             }
-            else
+
+            Proto::v3::SessionAnswer session_answer;
+            session_answer.answer  = static_cast<std::uint8_t>(code);
+            session_answer.version = static_cast<std::uint8_t>(protocol_version());
+            answer(session_answer);
+        };
+
+        if (message_type == Proto::MESSAGE_TYPE_HANDSHAKE)
+        {
+            // Spawn the session coroutine for the client(or queue the handshake)
+            if (spawn_session(client_endpoint, to_big_endian) == SpawnResult::EXHAUSTED)
             {
-                LibLog::log_print(m_logger_name, "Too many threads for the client requests, handshake dropped");
-                LibUDP::send_data(session, Proto::v2::CLIENT_THREAD_POOL_EXHAUSED);
-                session->close();
-                m_process_next_request.store(true);
+                LibLog::log_print(m_logger_name, "Too many sessions for the client requests, handshake dropped");
+                reject(Proto::v2::CLIENT_THREAD_POOL_EXHAUSED);
+            }
+        }
+        else if (message_type == Proto::MESSAGE_TYPE_SESSION_REQUEST)
+        {
+            if (bytes_received < sizeof(Proto::v3::SessionRequest))
+            {
+                LibLog::log_print(m_logger_name, "Recieved truncated session request, requested re-transmit");
+                reject(Proto::v1::NACK);
+                return;
+            }
+
+            // Everything the session needs is copied out, the buffer is re-used by the listener
+            Proto::v3::SessionRequest request;
+            std::memcpy(&request, message, sizeof(request));
+            LibUDP::swap_endianess(request, to_big_endian);
+
+            // The re-sent request of the running or waiting session is just dropped, the session
+            // answers it on its own
+            if (spawn_session(client_endpoint, to_big_endian, request) == SpawnResult::EXHAUSTED)
+            {
+                LibLog::log_print(m_logger_name, "Too many sessions for the client requests, handshake dropped");
+                reject(Proto::v2::CLIENT_THREAD_POOL_EXHAUSED);
             }
         }
         else
@@ -149,58 +180,74 @@ namespace Ozzy::v2
             LibLog::log_print(m_logger_name,
                               "Client " + LibLog::serialize_endpoint(client_endpoint) +
                               " did not start the transmit operation with the hadnshake. Connection discarded.");
-            LibUDP::send_data(session, Proto::v1::DROP);
-            session->close();
-            m_process_next_request.store(true);
+            reject(Proto::v1::DROP);
         }
     }
 
-
-    void UdpServer::handle_handshake(std::shared_ptr<LibUDP::Session> &&session) noexcept
+    boost::asio::awaitable<void> UdpServer::handle_session_request(std::shared_ptr<LibUDP::Session> session,
+                                                                   Proto::v3::SessionRequest request)
     {
-        m_process_next_request.store(true);
+        // Proto::v2 has no single round-trip handshake, the client has to fall back to the v2 one
+        LibLog::log_print(m_logger_name, "Client " + LibLog::serialize_endpoint(session->endpoint) + " protocol version " +
+                                         std::to_string(request.version + 1) + " is incompatible");
+
+        Proto::v3::SessionAnswer answer;
+        answer.answer  = Proto::v1::ERR_VERSIONS_INCOMPATIBLE;
+        answer.version = static_cast<std::uint8_t>(protocol_version());
+        co_await LibUDP::async_send_data(session, answer);
+    }
+
 
+    boost::asio::awaitable<void> UdpServer::handle_handshake(std::shared_ptr<LibUDP::Session> session)
+    {
         // 1. Recieve handshake from the client, answer with Ack, meaning that handhsake data
         // transmitted with no errors
         LibLog::log_print(m_logger_name, "Recieved handshake from " + LibLog::serialize_endpoint(session->endpoint));
-        LibUDP::send_data(session, Proto::v1::ACK);
+        co_await LibUDP::async_send_data(session, Proto::v1::ACK);
 
         // Validate client's version
         std::uint8_t client_version;
 
-        if (!LibUDP::receive_data(session, client_version))
+        if (!co_await LibUDP::async_receive_data(session, client_version) || !accepts_version(client_version))
         {
-            if (client_version < Proto::VERSION_2)
-            {
-                LibUDP::send_data(session, Proto::v1::ERR_VERSIONS_INCOMPATIBLE);
-                LibUDP::send_data(session, Proto::VERSION_2);
-                return;
-            }
+            LibLog::log_print(m_logger_name, "Client " + LibLog::serialize_endpoint(session->endpoint) +
+                                             " protocol version is incompatible");
+            co_await LibUDP::async_send_data(session, Proto::v1::ERR_VERSIONS_INCOMPATIBLE);
+            co_await LibUDP::async_send_data(session, protocol_version());
+            co_return;
+        }
+        session->version       = static_cast<Proto::Version>(client_version);
+        session->doubles_count = m_doubles_count;
+        co_await LibUDP::async_send_data(session, Proto::v1::ACK);
+
+        if (!co_await negotiate_session(session))
+        {
+            LibLog::log_print(m_logger_name, "Session negotiation failed, handshake failed");
+            co_return;
         }
-        LibUDP::send_data(session, Proto::v1::ACK);
 
         // 2. Get the X upper_bound from the client
         double x_upper_bound;
 
-        if (!LibUDP::receive_data(session, x_upper_bound))
+        if (!co_await LibUDP::async_receive_data(session, x_upper_bound))
         {
             LibLog::log_print(m_logger_name, "Unable to receive the answer from the client, handshake failed");
-            return;
+            co_return;
         }
 
         // Receive answer from the client, if it's Drop, then close the session.
         std::uint8_t client_answer;
 
-        if (!LibUDP::receive_data(session, client_answer))
+        if (!co_await LibUDP::async_receive_data(session, client_answer))
         {
             LibLog::log_print(m_logger_name, "Unable to receive the answer from the client, handshake failed");
-            return;
+            co_return;
         }
 
         if (client_answer == Proto::v1::Answer::DROP)
         {
             LibLog::log_print(m_logger_name, "Client requested to close the session");
-            return;
+            co_return;
         }
 
         LibLog::log_print(m_logger_name,
@@ -214,12 +261,12 @@ namespace Ozzy::v2
         // We !do not! track the missing packets, it's the RTMP/TCP style.
         LibLog::log_print(m_logger_name, "Start sending frames to " + LibLog::serialize_endpoint(session->endpoint));
 
-        if (!send_frame_array(session, x_upper_bound))
+        if (!co_await send_frame_array(session, x_upper_bound))
         {
             LibLog::log_print(m_logger_name,
                               "Discarded connection with " + LibLog::serialize_endpoint(session->endpoint));
-            LibUDP::send_data(session, Proto::v1::Answer::DROP);
-            return;
+            co_await LibUDP::async_send_data(session, Proto::v1::Answer::DROP);
+            co_return;
         }
 
         LibLog::log_print(m_logger_name,
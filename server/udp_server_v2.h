@@ -1,6 +1,7 @@
 #ifndef __OZZY_UDP_SERVER_V2__
 #define __OZZY_UDP_SERVER_V2__
 
+#include <utility>
 #include <boost/asio.hpp>
 #include "LibFS/filesystem.h"
 #include "protocol.h"
@@ -22,17 +23,41 @@ namespace Ozzy::v2
         }
 
     protected:
+        // Protocol version that this server speaks
+        virtual Proto::Version protocol_version() const noexcept
+        {
+            return Proto::VERSION_2;
+        }
+
+        // Whether the server is able to serve the client with provided protocol version
+        virtual bool accepts_version(std::uint8_t client_version) const noexcept
+        {
+            return client_version == Proto::VERSION_2;
+        }
+
+        // Agree on the session parameters right after the version is accepted, false
+        // when the session should be closed
+        virtual boost::asio::awaitable<bool> negotiate_session(std::shared_ptr<LibUDP::Session>&)
+        {
+            co_return true;
+        }
+
         // Handle the received message
-        void handle_message(udp::endpoint client_endpoint, std::size_t bytes_received) noexcept override;
+        void handle_message(udp::endpoint client_endpoint, const std::uint8_t *message,
+                            std::size_t bytes_received) noexcept override;
 
         // Handle the handshake between the server and the client
-        void handle_handshake(std::shared_ptr<LibUDP::Session>&& session) noexcept override;
+        boost::asio::awaitable<void> handle_handshake(std::shared_ptr<LibUDP::Session> session) override;
+
+        // Answer the single round-trip handshake with ERR_VERSIONS_INCOMPATIBLE, Proto::v2 has none
+        boost::asio::awaitable<void> handle_session_request(std::shared_ptr<LibUDP::Session> session,
+                                                            Proto::v3::SessionRequest request) override;
 
         // Send individual frame to the client
-        bool send_frame(std::shared_ptr<LibUDP::Session>& session, Proto::Frame frame) noexcept override;
+        boost::asio::awaitable<bool> send_frame(std::shared_ptr<LibUDP::Session>& session, Proto::Frame frame) override;
 
         // Send array of frames with random doubles from -x to x
-        bool send_frame_array(std::shared_ptr<LibUDP::Session>& session, double x) noexcept override;
+        boost::asio::awaitable<bool> send_frame_array(std::shared_ptr<LibUDP::Session>& session, double x) override;
     };
 }
 
@@ -0,0 +1,476 @@
+#include "udp_server_v3.h"
+#include "LibUDP/networking.h"
+#include "LibUDP/codec.h"
+#include "LibUDP/generator.h"
+
+#include <limits>
+#include "LibLog/logging.h"
+#include "LibTT/allocations.h"
+
+namespace
+{
+    using window_clock_t = std::chrono::steady_clock;
+
+    // State of the frame inside the sender window
+    struct WindowSlot
+    {
+        window_clock_t::time_point sent_at;
+        std::size_t                attempts           = 0;
+        bool                       acknowledged       = false;
+        bool                       fast_retransmitted = false;
+    };
+}
+
+namespace Ozzy::v3
+{
+    struct UdpServer::SenderBuffers
+    {
+        // The values are generated for that much frames at once, so the ones left by the coded
+        // frames are moved to the front only once in a few frames
+        static constexpr std::size_t            VALUES_FRAMES = 2;
+
+        // Values that are generated, the frames take them from the read offset
+        std::vector<double>                     values;
+
+        // Frames in flight, the frame with the sequence `s` is stored at `s % window_size`
+        LibUDP::MessageSlots<Proto::v3::Frame>  window;
+        std::vector<WindowSlot>                 slots;
+
+        // Copies of the frames that are about to be sent with one batched call, send_data()
+        // converts the data to the client's order in place, and we may need to re-send the
+        // frames from the window later
+        WireFrames                              wire_frames;
+
+        std::vector<Proto::v3::Acknowledgement> acknowledgements;
+
+        // Prepare the buffers for the session with the frames of `datagram_size` bytes, the memory
+        // of the previous session is kept
+        void reset(const std::size_t datagram_size, const std::size_t values_per_frame)
+        {
+            constexpr std::size_t window_size = OZZY_ARQ_WINDOW_SIZE;
+
+            values.clear();
+            values.reserve(VALUES_FRAMES * values_per_frame);
+
+            window.reset(datagram_size, window_size);
+            slots.assign(window_size, WindowSlot{});
+
+            for (auto &buffer: wire_frames.buffers)
+            {
+                buffer.reset(datagram_size);
+                buffer.reserve(window_size + 1);
+            }
+            wire_frames.issued  = {};
+            wire_frames.current = 0;
+
+            acknowledgements.resize(OZZY_UDP_BATCH_SIZE);
+        }
+    };
+
+    Component::SlabPool<UdpServer::SenderBuffers> &UdpServer::sender_buffers()
+    {
+        static Component::SlabPool<SenderBuffers> pool(OZZY_SESSION_POOL_CAPACITY);
+        return pool;
+    }
+
+    boost::asio::awaitable<bool> UdpServer::negotiate_session(std::shared_ptr<LibUDP::Session> &session)
+    {
+        if (session->version < Proto::VERSION_3)
+        {
+            co_return true;
+        }
+
+        Proto::v3::Negotiation client_algorithms;
+        if (!co_await LibUDP::async_receive_data(session, client_algorithms))
+        {
+            LibLog::log_print(m_logger_name, "Unable to receive the checksum algorithms and codecs from the client");
+            co_return false;
+        }
+
+        co_return co_await LibUDP::async_send_data(session, pick_session_parameters(session, client_algorithms));
+    }
+
+    Proto::v3::Negotiation UdpServer::pick_session_parameters(std::shared_ptr<LibUDP::Session> &session,
+                                                              const Proto::v3::Negotiation &offered) const
+    {
+        session->checksum = Proto::pick_checksum(Proto::supported_checksums(), offered.checksums);
+        session->codec    = LibUDP::pick_codec(LibUDP::supported_codecs(), offered.codecs);
+
+        // The frames are as large as both the path and the client's receive buffer allow
+        const std::size_t datagram_size = std::min<std::size_t>(LibUDP::probe_datagram_size(session->endpoint),
+                                                                offered.datagram_size);
+        session->datagram_size = Proto::v3::frame_datagram_size(Proto::v3::frame_payload_count(
+            std::max(datagram_size, Proto::v3::DEFAULT_DATAGRAM_SIZE)));
+
+        LibLog::log_print(m_logger_name, "Using " + std::string(Proto::checksum_kernel_name(session->checksum)) +
+                                         " checksum, " + LibUDP::payload_codec(session->codec).name() + " codec and " +
+                                         std::to_string(session->datagram_size) + " bytes frames for " +
+                                         LibLog::serialize_endpoint(session->endpoint));
+
+        Proto::v3::Negotiation picked;
+        picked.checksums     = static_cast<std::uint8_t>(session->checksum);
+        picked.codecs        = static_cast<std::uint8_t>(session->codec);
+        picked.datagram_size = static_cast<std::uint32_t>(session->datagram_size);
+        return picked;
+    }
+
+    boost::asio::awaitable<void> UdpServer::handle_session_request(std::shared_ptr<LibUDP::Session> session,
+                                                                   Proto::v3::SessionRequest request)
+    {
+        if (request.version < Proto::VERSION_3 || !accepts_version(request.version))
+        {
+            co_await v2::UdpServer::handle_session_request(session, request);
+            co_return;
+        }
+
+        LibLog::log_print(m_logger_name, "Recieved single round-trip handshake from " +
+                                         LibLog::serialize_endpoint(session->endpoint));
+        session->version = static_cast<Proto::Version>(request.version);
+
+        // The client may ask for less than the server sends by default, never for more
+        session->doubles_count = request.doubles_count == 0 ? m_doubles_count
+                                                            : std::min<std::uint64_t>(request.doubles_count, m_doubles_count);
+
+        Proto::v3::SessionAnswer answer;
+        answer.version       = static_cast<std::uint8_t>(protocol_version());
+        answer.picked        = pick_session_parameters(session, request.offered);
+        answer.doubles_count = session->doubles_count;
+
+        LibLog::log_print(m_logger_name, "Start sending frames to " + LibLog::serialize_endpoint(session->endpoint));
+
+        if (!co_await send_window(session, request.x_upper_bound, &answer))
+        {
+            LibLog::log_print(m_logger_name,
+                              "Discarded connection with " + LibLog::serialize_endpoint(session->endpoint));
+            co_await LibUDP::async_send_data(session, Proto::v1::Answer::DROP);
+            co_return;
+        }
+
+        LibLog::log_print(m_logger_name,
+                          "Sucessfully sended frames to the client " + LibLog::serialize_endpoint(session->endpoint));
+        LibLog::log_print(m_logger_name, "Closed the connection with " + LibLog::serialize_endpoint(session->endpoint));
+    }
+
+    boost::asio::awaitable<bool> UdpServer::send_window_frames(std::shared_ptr<LibUDP::Session> &session,
+                                                               WireFrames &wire_frames)
+    {
+        const bool sent = co_await LibUDP::async_send_data_batch(session, wire_frames.frames());
+        wire_frames.frames().clear();
+
+        if (!sent)
+        {
+            LibLog::log_print(m_logger_name, "Failed sending frame(sending failed) to the client, connection unstable");
+            co_return false;
+        }
+
+        wire_frames.issued[wire_frames.current] = session->zero_copy.issued;
+        wire_frames.current ^= 1;
+
+        if (!co_await LibUDP::async_wait_zero_copy(session, wire_frames.issued[wire_frames.current]))
+        {
+            LibLog::log_print(m_logger_name, "Zero copy send is not completed in time, connection unstable");
+            co_return false;
+        }
+
+        co_return true;
+    }
+
+    boost::asio::awaitable<bool> UdpServer::send_frame_array(std::shared_ptr<LibUDP::Session> &session, double x)
+    {
+        if (session->version < Proto::VERSION_3)
+        {
+            co_return co_await v2::UdpServer::send_frame_array(session, x);
+        }
+
+        co_return co_await send_window(session, x, nullptr);
+    }
+
+    boost::asio::awaitable<bool> UdpServer::send_window(std::shared_ptr<LibUDP::Session> &session, double x,
+                                                        const Proto::v3::SessionAnswer *answer)
+    {
+        constexpr std::size_t window_size = OZZY_ARQ_WINDOW_SIZE;
+        const auto retransmit_timeout     = std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp);
+
+        // The coded frames carry as much values as the codec manages to fit, so the frames
+        // count is known only after the last value is taken
+        const LibUDP::PayloadCodec &codec = LibUDP::payload_codec(session->codec);
+        const bool coded = session->codec != Proto::v3::CODEC_IDENTITY;
+
+        // Every frame takes the whole negotiated datagram
+        const std::size_t payload_count = Proto::v3::frame_payload_count(session->datagram_size);
+
+        std::uint32_t frames_total   = session->doubles_count == 0 ? 0 : std::numeric_limits<std::uint32_t>::max();
+        std::uint64_t doubles_remain = session->doubles_count;
+
+        // The buffers of the finished session are taken over, so the window is not allocated(and
+        // faulted in) again for every session
+        const std::size_t values_per_frame = coded ? Proto::v3::codec_max_values(payload_count) : payload_count;
+        const auto        buffers          = sender_buffers().acquire();
+        buffers->reset(session->datagram_size, values_per_frame);
+
+        std::vector<double>                     &values           = buffers->values;
+        std::size_t                              values_offset    = 0;
+        LibUDP::MessageSlots<Proto::v3::Frame>  &window           = buffers->window;
+        std::vector<WindowSlot>                 &slots            = buffers->slots;
+        WireFrames                              &wire_frames      = buffers->wire_frames;
+        std::vector<Proto::v3::Acknowledgement> &acknowledgements = buffers->acknowledgements;
+
+#ifdef OZZY_USE_UDP_OFFLOAD
+        // The zero copy completions of the shared socket can't be told apart between the sessions
+        session->offload = LibUDP::enable_offload(session->output_socket(),
+                                                  {.segmentation = true, .zero_copy = !session->shared_socket});
+#endif
+
+        // Lowest not acknowledged sequence, and the sequence of the next frame to bake
+        std::uint32_t window_base   = 0;
+        std::uint32_t next_sequence = 0;
+
+        // The values are generated ahead of us on the generator thread
+        const std::shared_ptr<LibUDP::PayloadStream> payload_stream =
+            LibUDP::payload_generator().open_stream(session->doubles_count, -x, x);
+
+        // Everything the frames need is allocated by now
+        const std::uint64_t allocations_before = Component::heap_allocations();
+
+        // The client takes the frames only after the answer, so it goes first. Any acknowledgement
+        // means the client has it.
+        bool answer_acknowledged = answer == nullptr;
+        if (answer && !co_await LibUDP::async_send_data(session, Proto::v3::SessionAnswer(*answer)))
+        {
+            LibLog::log_print(m_logger_name, "Unable to send the session answer to the client");
+            co_return false;
+        }
+
+        while (window_base < frames_total)
+        {
+            // 1. Fill the window with the new frames
+            while (next_sequence < frames_total && next_sequence < window_base + window_size)
+            {
+                Proto::v3::Frame &frame = window[next_sequence % window_size];
+                WindowSlot       &slot  = slots [next_sequence % window_size];
+
+                if (values.size() - values_offset < values_per_frame && doubles_remain > 0)
+                {
+                    // The values left are less than a frame, moving them is cheap
+                    values.erase(values.begin(), values.begin() + values_offset);
+                    values_offset = 0;
+
+                    const std::size_t generated = std::min<std::uint64_t>(
+                        SenderBuffers::VALUES_FRAMES * values_per_frame - values.size(), doubles_remain);
+                    const std::size_t offset    = values.size();
+
+                    values.resize(offset + generated);
+                    payload_stream->take(values.data() + offset, generated);
+                    doubles_remain -= generated;
+                }
+
+                std::size_t encoded_size = 0;
+                frame.length   = static_cast<std::uint16_t>(codec.encode(
+                    std::span(values).subspan(values_offset),
+                    std::span(reinterpret_cast<std::uint8_t*>(frame.payload), payload_count * sizeof(double)),
+                    encoded_size));
+                frame.sequence = next_sequence;
+                frame.flags    = coded ? Proto::v3::FRAME_FLAG_CODED : Proto::v3::FRAME_FLAG_NONE;
+
+                values_offset += frame.length;
+                if (values_offset == values.size() && doubles_remain == 0)
+                {
+                    frame.flags |= Proto::v3::FRAME_FLAG_END_OF_STREAM;
+                    frames_total = next_sequence + 1;
+                }
+
+                // Over the payload in the client's order, the way the client checks it
+                frame.checksum = LibUDP::calculate_wire_checksum(*session, frame, payload_count);
+
+                slot = WindowSlot{window_clock_t::now(), 1};
+                wire_frames.frames().push_back(frame);
+                ++next_sequence;
+            }
+
+            if (!wire_frames.frames().empty() && !co_await send_window_frames(session, wire_frames))
+            {
+                co_return false;
+            }
+
+            // 2. Wait for the acknowledgement, each of them describes the whole client's
+            // receive window, so we don't care about the lost ones
+            std::size_t acknowledgements_count = 0;
+            if (co_await LibUDP::async_receive_data(session, acknowledgements.front(), retransmit_timeout))
+            {
+                // Take the acknowledgements that are already queued without arming the timer
+                acknowledgements_count = 1 + LibUDP::receive_data_batch(session,
+                                                                        std::span(acknowledgements).subspan(1));
+                answer_acknowledged    = true;
+            }
+
+            for (const auto &acknowledgement: std::span(acknowledgements).first(acknowledgements_count))
+            {
+                if (acknowledgement.answer == Proto::v1::Answer::DROP)
+                {
+                    LibLog::log_print(m_logger_name,
+                                      "Client requested to drop the connection " + LibLog::serialize_endpoint(
+                                          session->endpoint));
+                    co_return false;
+                }
+
+                const std::uint32_t cumulative = std::min(acknowledgement.cumulative, next_sequence);
+                for (std::uint32_t sequence = window_base; sequence < cumulative; ++sequence)
+                {
+                    slots[sequence % window_size].acknowledged = true;
+                }
+
+                bool has_selective = false;
+                for (std::size_t i = 0; i < Proto::v3::ACK_SELECTIVE_BITS; ++i)
+                {
+                    const std::uint64_t sequence = static_cast<std::uint64_t>(cumulative) + 1 + i;
+                    if (sequence >= next_sequence)
+                    {
+                        break;
+                    }
+
+                    // Stale acknowledgement, the slot is already re-used by the newer frame
+                    if (sequence < window_base)
+                    {
+                        continue;
+                    }
+
+                    if (acknowledgement.selective[i / 64] & (1ULL << (i % 64)))
+                    {
+                        slots[sequence % window_size].acknowledged = true;
+                        has_selective = true;
+                    }
+                }
+
+                // Client got the frames after the `cumulative` one, so it is most likely lost,
+                // re-send it once without waiting for the timeout
+                WindowSlot &first_missing = slots[cumulative % window_size];
+                if (has_selective && cumulative < next_sequence && cumulative >= window_base &&
+                    !first_missing.acknowledged && !first_missing.fast_retransmitted)
+                {
+                    first_missing.fast_retransmitted = true;
+                    first_missing.sent_at            = window_clock_t::now();
+                    ++first_missing.attempts;
+
+                    wire_frames.frames().push_back(window[cumulative % window_size]);
+                }
+
+                while (window_base < next_sequence && slots[window_base % window_size].acknowledged)
+                {
+                    ++window_base;
+                }
+            }
+
+            // 3. Re-send the frames that are not acknowledged for too long
+            const auto now = window_clock_t::now();
+            for (std::uint32_t sequence = window_base; sequence < next_sequence; ++sequence)
+            {
+                WindowSlot &slot = slots[sequence % window_size];
+                if (slot.acknowledged || now - slot.sent_at < retransmit_timeout)
+                {
+                    continue;
+                }
+
+                // If the frame was re-sended more than PacketRetransmitMaxAttempt, than
+                // connection is marked as unstable and should be closed.
+                if (slot.attempts >= Proto::Constant::PacketRetransmitMaxAttempts)
+                {
+                    LibLog::log_print(m_logger_name, "Frame " + std::to_string(sequence) +
+                                                     " is not acknowledged, connection unstable");
+                    co_return false;
+                }
+
+                slot.sent_at            = now;
+                slot.fast_retransmitted = false;
+                ++slot.attempts;
+
+                wire_frames.frames().push_back(window[sequence % window_size]);
+            }
+
+            // Without any acknowledgement these are the expired frames only, the answer might be
+            // lost as well, so it's re-sent right before them
+            if (!wire_frames.frames().empty() && !answer_acknowledged &&
+                !co_await LibUDP::async_send_data(session, Proto::v3::SessionAnswer(*answer)))
+            {
+                co_return false;
+            }
+
+            // Fast retransmits and the expired frames go with one call
+            if (!wire_frames.frames().empty() && !co_await send_window_frames(session, wire_frames))
+            {
+                co_return false;
+            }
+        }
+
+        const std::uint64_t frame_loop_allocations = Component::heap_allocations() - allocations_before;
+
+        // Every frame is acknowledged, let the client know that it can stop waiting
+        // for the retransmits
+        LibLog::log_print(m_logger_name, "Sent " + std::to_string(session->doubles_count) + " doubles with " +
+                                         std::to_string(frames_total) + " frames(" +
+                                         std::to_string(frames_total == 0 ? 0.0 : double(session->doubles_count) / frames_total) +
+                                         " per frame), " + codec.name() + " codec, " +
+                                         std::to_string(payload_stream->inline_values()) + " of the " +
+                                         LibUDP::uniform_kernel_name() + " values are generated inline");
+
+        LibLog::log_print(m_logger_name, "Average send batch fill is " +
+                                         std::to_string(LibUDP::send_batch_statistics().average_fill()) +
+                                         "/" + std::to_string(OZZY_UDP_BATCH_SIZE));
+
+#if OZZY_COUNT_ALLOCATIONS
+        LibLog::log_print(m_logger_name, "Heap allocations while sending the frames: " +
+                                         std::to_string(frame_loop_allocations) + "(whole process), sender buffers " +
+                                         std::to_string(sender_buffers().reused()) + " reused/" +
+                                         std::to_string(sender_buffers().created()) + " created");
+#else
+        static_cast<void>(frame_loop_allocations);
+#endif
+
+        if (session->zero_copy.issued > 0)
+        {
+            LibLog::log_print(m_logger_name, "Zero copy sends: " + std::to_string(session->zero_copy.issued) +
+                                             ", copied by the kernel: " + std::to_string(session->zero_copy.copied));
+        }
+
+        // Every frame is acknowledged already, so the client that never acknowledges the close
+        // frame doesn't fail the session, it just waits for the idle timeout
+        for (std::size_t attempts = 0; attempts < Proto::Constant::PacketRetransmitMaxAttempts; ++attempts)
+        {
+            // The close frame follows the last frame, so the client with no frames at all knows
+            // where the stream ends as well. It's baked in the wire slot every time, send_data()
+            // converts it to the client's order in place.
+            Proto::v3::Frame &close_frame = wire_frames.frames().emplace_back();
+            close_frame.sequence = frames_total;
+            close_frame.flags    = Proto::v3::FRAME_FLAG_CLOSE;
+            close_frame.checksum = LibUDP::calculate_wire_checksum(*session, close_frame, payload_count);
+
+            if (!co_await send_window_frames(session, wire_frames))
+            {
+                co_return false;
+            }
+
+            // The acknowledgements of the frames may still be on the way, only the one past the
+            // close frame counts
+            bool close_acknowledged = false;
+            const auto deadline     = window_clock_t::now() + retransmit_timeout;
+            while (!close_acknowledged && window_clock_t::now() < deadline)
+            {
+                const auto remaining = std::chrono::ceil<std::chrono::milliseconds>(deadline - window_clock_t::now());
+                if (!co_await LibUDP::async_receive_data(session, acknowledgements.front(), remaining))
+                {
+                    break;
+                }
+
+                close_acknowledged = acknowledgements.front().answer == Proto::v1::Answer::DROP ||
+                                     acknowledgements.front().cumulative > frames_total;
+            }
+
+            if (close_acknowledged)
+            {
+                break;
+            }
+        }
+
+        // The kernel may still read both wire buffers
+        co_return co_await LibUDP::async_wait_zero_copy(session, session->zero_copy.issued);
+    }
+}
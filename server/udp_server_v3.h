@@ -0,0 +1,100 @@
+#ifndef __OZZY_UDP_SERVER_V3__
+#define __OZZY_UDP_SERVER_V3__
+
+#include <utility>
+#include <array>
+#include <vector>
+#include <boost/asio.hpp>
+#include "protocol.h"
+#include "udp_server_v2.h"
+#include "LibTT/slab_pool.h"
+
+// How much sender buffers of the finished sessions(the window and the wire frames, ~12MB with the
+// 64KB frames) the server keeps for the next sessions
+#ifndef OZZY_SESSION_POOL_CAPACITY
+#   define OZZY_SESSION_POOL_CAPACITY 16
+#else
+#   if OZZY_SESSION_POOL_CAPACITY < 0
+#       error "Invalid value set for OZZY_SESSION_POOL_CAPACITY"
+#   endif
+#endif
+
+namespace Ozzy::v3
+{
+    using boost::asio::ip::udp;
+
+    // Sends the frames with the sliding window selective-repeat ARQ instead of the
+    // stop-and-wait, still serves the Proto::v2 clients the old way.
+    class UdpServer : public v2::UdpServer
+    {
+    public:
+        UdpServer(boost::asio::io_context &io_context, const std::string &config_path, const std::string &logger_name,
+                  const std::uint64_t doubles_count)
+            : v2::UdpServer(io_context, config_path, logger_name, doubles_count)
+        {
+        }
+
+    protected:
+        Proto::Version protocol_version() const noexcept override
+        {
+            return Proto::VERSION_3;
+        }
+
+        bool accepts_version(std::uint8_t client_version) const noexcept override
+        {
+            return client_version == Proto::VERSION_2 || client_version == Proto::VERSION_3;
+        }
+
+        // Pick the payload checksum algorithm for the v3 clients
+        boost::asio::awaitable<bool> negotiate_session(std::shared_ptr<LibUDP::Session>& session) override;
+
+        // Accept the session with one answer and start sending the frames right after it
+        boost::asio::awaitable<void> handle_session_request(std::shared_ptr<LibUDP::Session> session,
+                                                            Proto::v3::SessionRequest request) override;
+
+        // Send array of frames with random doubles from -x to x
+        boost::asio::awaitable<bool> send_frame_array(std::shared_ptr<LibUDP::Session>& session, double x) override;
+
+    private:
+        // Pick the checksum, the codec and the frame size from the ones the client offered, and
+        // set them up for the session
+        Proto::v3::Negotiation pick_session_parameters(std::shared_ptr<LibUDP::Session>& session,
+                                                       const Proto::v3::Negotiation &offered) const;
+
+        // Send the frames with the sliding window. The `answer`(if any) is sent before the
+        // frames, and re-sent together with the expired ones until the client acknowledges
+        // anything, the frames alone are of no use to it without the answer.
+        boost::asio::awaitable<bool> send_window(std::shared_ptr<LibUDP::Session>& session, double x,
+                                                 const Proto::v3::SessionAnswer *answer);
+
+        // Copies of the window frames that are about to be sent with one batched call. The zero
+        // copy sends read the frames after the call has returned, so one buffer is filled while
+        // the other one may still be in flight.
+        struct WireFrames
+        {
+            std::array<LibUDP::MessageSlots<Proto::v3::Frame>, 2> buffers;
+
+            // Zero copy send id after the last send from the buffer
+            std::array<std::uint32_t, 2> issued{};
+
+            std::size_t current = 0;
+
+            LibUDP::MessageSlots<Proto::v3::Frame> &frames() noexcept
+            {
+                return buffers[current];
+            }
+        };
+
+        // Everything send_frame_array() needs for one session, recycled between the sessions
+        struct SenderBuffers;
+
+        static Component::SlabPool<SenderBuffers> &sender_buffers();
+
+        // Send the frames of the current wire buffer with one batched call and switch to the
+        // other buffer as soon as the kernel is done with it
+        boost::asio::awaitable<bool> send_window_frames(std::shared_ptr<LibUDP::Session>& session,
+                                                        WireFrames &wire_frames);
+    };
+}
+
+#endif // __OZZY_UDP_SERVER_V3__
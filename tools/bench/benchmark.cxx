@@ -0,0 +1,194 @@
+#include "benchmark.h"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <sstream>
+
+namespace Ozzy::Tools
+{
+    namespace
+    {
+        using benchmark_clock_t = std::chrono::steady_clock;
+
+        std::chrono::nanoseconds run_repetition(const Benchmark &benchmark, const std::uint64_t iterations)
+        {
+            if (benchmark.setup)
+            {
+                benchmark.setup();
+            }
+
+            const auto started = benchmark_clock_t::now();
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                benchmark.run();
+            }
+
+            return benchmark_clock_t::now() - started;
+        }
+
+        // Iterations per repetition, so it takes at least the `min_repetition_time`
+        std::uint64_t calibrate(const Benchmark &benchmark, const BenchmarkOptions &options)
+        {
+            if (benchmark.setup)
+            {
+                return 1;
+            }
+
+            std::uint64_t iterations = 1;
+            while (iterations < (1ULL << 30) && run_repetition(benchmark, iterations) < options.min_repetition_time)
+            {
+                iterations *= 2;
+            }
+
+            return iterations;
+        }
+
+        double to_nanoseconds(const std::uint64_t picoseconds) noexcept
+        {
+            return static_cast<double>(picoseconds) / 1000.0;
+        }
+    }
+
+    std::vector<BenchmarkResult> run_benchmarks(const std::vector<Benchmark> &benchmarks, const BenchmarkOptions &options)
+    {
+        std::vector<BenchmarkResult> results;
+
+        for (const auto &benchmark: benchmarks)
+        {
+            if (benchmark.name.find(options.filter) == std::string::npos)
+            {
+                continue;
+            }
+
+            BenchmarkResult result;
+            result.name       = benchmark.name;
+            result.bytes      = benchmark.bytes;
+            result.iterations = calibrate(benchmark, options);
+
+            for (std::size_t i = 0; i < options.warmup; ++i)
+            {
+                run_repetition(benchmark, result.iterations);
+            }
+
+            for (std::size_t i = 0; i < std::max<std::size_t>(1, options.repetitions); ++i)
+            {
+                const auto elapsed = run_repetition(benchmark, result.iterations);
+                result.picoseconds.record(static_cast<std::uint64_t>(elapsed.count()) * 1000 / result.iterations);
+            }
+
+            std::cerr << std::left << std::setw(48) << result.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << to_nanoseconds(result.picoseconds.percentile(50.0)) << " ns" << std::endl;
+            results.push_back(std::move(result));
+        }
+
+        return results;
+    }
+
+    std::string format_report(const std::vector<BenchmarkResult> &results,
+                              const std::vector<std::pair<std::string, std::string>> &context)
+    {
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(3);
+
+        stream << "{\n"
+               << "  \"context\": {";
+        for (std::size_t i = 0; i < context.size(); ++i)
+        {
+            stream << (i == 0 ? "" : ", ") << "\"" << context[i].first << "\": \"" << context[i].second << "\"";
+        }
+        stream << "},\n"
+               << "  \"benchmarks\": [\n";
+
+        for (std::size_t i = 0; i < results.size(); ++i)
+        {
+            const BenchmarkResult &result = results[i];
+            const double           median = to_nanoseconds(result.picoseconds.percentile(50.0));
+
+            stream << "    {\"name\": \"" << result.name << "\""
+                   << ", \"iterations\": " << result.iterations
+                   << ", \"repetitions\": " << result.picoseconds.count()
+                   << ", \"bytes\": " << result.bytes
+                   << ", \"min_ns\": " << to_nanoseconds(result.picoseconds.min())
+                   << ", \"p50_ns\": " << median
+                   << ", \"p90_ns\": " << to_nanoseconds(result.picoseconds.percentile(90.0))
+                   << ", \"p99_ns\": " << to_nanoseconds(result.picoseconds.percentile(99.0))
+                   << ", \"max_ns\": " << to_nanoseconds(result.picoseconds.max())
+                   << ", \"mean_ns\": " << result.picoseconds.mean() / 1000.0
+                   << ", \"mib_per_s\": "
+                   << (result.bytes != 0 && median > 0.0 ? result.bytes / median * 1e9 / (1024.0 * 1024.0) : 0.0)
+                   << "}" << (i + 1 == results.size() ? "\n" : ",\n");
+        }
+
+        stream << "  ]\n"
+               << "}\n";
+        return stream.str();
+    }
+
+    bool compare_with_baseline(const std::vector<BenchmarkResult> &results, const std::string &baseline,
+                               const double threshold_percents)
+    {
+        std::ifstream baseline_file(baseline);
+        if (!baseline_file.is_open())
+        {
+            std::cerr << "Unable to open the baseline " << baseline << std::endl;
+            return false;
+        }
+
+        // The report has one benchmark per line(look at format_report)
+        const std::regex line_pattern(R"pattern("name": "([^"]+)".*"p50_ns": ([0-9.]+))pattern");
+
+        std::map<std::string, double> baseline_medians;
+        for (std::string line; std::getline(baseline_file, line);)
+        {
+            std::smatch match;
+            if (std::regex_search(line, match, line_pattern))
+            {
+                baseline_medians[match[1]] = std::stod(match[2]);
+            }
+        }
+
+        if (baseline_medians.empty())
+        {
+            std::cerr << "No benchmarks in the baseline " << baseline << std::endl;
+            return false;
+        }
+
+        std::size_t regressions = 0;
+        std::cerr << std::endl << std::left << std::setw(48) << "benchmark" << std::right << std::setw(14) << "baseline"
+                  << std::setw(14) << "current" << std::setw(10) << "change" << std::endl;
+
+        for (const auto &result: results)
+        {
+            const double current  = to_nanoseconds(result.picoseconds.percentile(50.0));
+            const auto   previous = baseline_medians.find(result.name);
+
+            std::cerr << std::left << std::setw(48) << result.name << std::right << std::fixed << std::setprecision(1);
+            if (previous == baseline_medians.end() || previous->second <= 0.0)
+            {
+                std::cerr << std::setw(14) << "-" << std::setw(14) << current << std::setw(10) << "new" << std::endl;
+                continue;
+            }
+
+            const double change = (current - previous->second) / previous->second * 100.0;
+            std::cerr << std::setw(14) << previous->second << std::setw(14) << current << std::setw(9) << std::showpos
+                      << change << "%" << std::noshowpos;
+
+            if (change > threshold_percents)
+            {
+                std::cerr << "  REGRESSION";
+                ++regressions;
+            }
+            else if (change < -threshold_percents)
+            {
+                std::cerr << "  improved";
+            }
+            std::cerr << std::endl;
+        }
+
+        std::cerr << regressions << " regression(s) over " << threshold_percents << "%" << std::endl;
+        return regressions == 0;
+    }
+}
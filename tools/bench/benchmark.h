@@ -0,0 +1,79 @@
+#ifndef __OZZY_BENCHMARK__
+#define __OZZY_BENCHMARK__
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "LibTT/histogram.h"
+
+namespace Ozzy::Tools
+{
+    struct Benchmark
+    {
+        std::string           name;
+
+        // Bytes one iteration processes, for the throughput(nothing if zero)
+        std::uint64_t         bytes = 0;
+
+        // Prepares the data before every repetition, not measured. The benchmark with the setup
+        // runs one iteration per repetition, because its iteration consumes the data.
+        std::function<void()> setup;
+
+        std::function<void()> run;
+    };
+
+    // Keeps the compiler from throwing away the calculation of the `value`
+    template<typename T>
+    inline void keep_value(const T &value) noexcept
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    struct BenchmarkOptions
+    {
+        // Only the benchmarks with this in their names are run
+        std::string               filter;
+
+        // Not measured repetitions before the measured ones, they warm the caches up
+        std::size_t               warmup      = 3;
+        std::size_t               repetitions = 30;
+
+        // Iterations of every repetition are doubled until the repetition takes that long, so
+        // the clock resolution doesn't matter
+        std::chrono::microseconds min_repetition_time{2000};
+    };
+
+    struct BenchmarkResult
+    {
+        std::string                 name;
+        std::uint64_t               bytes      = 0;
+        std::uint64_t               iterations = 0;
+
+        // Picoseconds per iteration of every measured repetition, the fastest iterations take
+        // just a few nanoseconds
+        Component::LatencyHistogram picoseconds;
+    };
+
+    std::vector<BenchmarkResult> run_benchmarks(const std::vector<Benchmark> &benchmarks, const BenchmarkOptions &options);
+
+    // One benchmark per line, so the reports of two builds diff line by line. The `context` goes
+    // as is into the report(the kernels the build picked and so on).
+    std::string format_report(const std::vector<BenchmarkResult> &results,
+                              const std::vector<std::pair<std::string, std::string>> &context);
+
+    // Compare the medians with the ones of the `baseline` report, the benchmark that is slower
+    // by more than `threshold_percents` is the regression. Prints the comparison to the stderr,
+    // returns false if there is any regression or the baseline can't be read.
+    bool compare_with_baseline(const std::vector<BenchmarkResult> &results, const std::string &baseline,
+                               double threshold_percents);
+
+    // The suites
+    void add_protocol_benchmarks(std::vector<Benchmark> &benchmarks);
+
+    void add_sort_benchmarks(std::vector<Benchmark> &benchmarks);
+}
+
+#endif // __OZZY_BENCHMARK__
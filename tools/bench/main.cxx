@@ -0,0 +1,172 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+
+#include "benchmark.h"
+#include "protocol.h"
+#include "LibFS/sort_pool.h"
+#include "LibUDP/generator.h"
+
+int main(int argc, char** argv)
+{
+    Ozzy::Tools::BenchmarkOptions options;
+
+    boost::program_options::options_description description("Ozzy benchmark options");
+    description.add_options()
+    (
+        "help", "Display this message"
+    )
+    (
+        "list", "Print the benchmark names and exit"
+    )
+    (
+        "filter",
+        boost::program_options::value<std::string>(&options.filter),
+        "Run only the benchmarks with this in their names"
+    )
+    (
+        "repetitions",
+        boost::program_options::value<std::size_t>(&options.repetitions)->default_value(options.repetitions),
+        "Measured repetitions of every benchmark"
+    )
+    (
+        "warmup",
+        boost::program_options::value<std::size_t>(&options.warmup)->default_value(options.warmup),
+        "Repetitions before the measured ones"
+    )
+    (
+        "min-time-us",
+        boost::program_options::value<std::int64_t>()->default_value(options.min_repetition_time.count()),
+        "Shortest repetition(in microseconds), the fast benchmarks run more iterations per repetition"
+    )
+    (
+        "output",
+        boost::program_options::value<std::string>(),
+        "File the JSON report is written to(standard output if not set)"
+    )
+    (
+        "baseline",
+        boost::program_options::value<std::string>(),
+        "Report of the previous run to compare the medians with, the exit code is 1 on the regression"
+    )
+    (
+        "threshold",
+        boost::program_options::value<double>()->default_value(5.0),
+        "Slowdown of the median(in percents) that is the regression"
+    )
+    (
+        "workdir",
+        boost::program_options::value<std::string>(),
+        "Directory for the files of the sort benchmarks(the new temporary one if not set)"
+    );
+
+    boost::program_options::variables_map variables_map;
+    try
+    {
+        boost::program_options::store (boost::program_options::parse_command_line(argc, argv, description), variables_map);
+        boost::program_options::notify(variables_map);
+    }
+    catch(const boost::program_options::error& e)
+    {
+        std::cerr << "Error parsing command-line arguments: " << e.what() << std::endl;
+        exit(-1);
+    }
+
+    if (variables_map.contains("help"))
+    {
+        std::cerr << description << std::endl;
+        return 0;
+    }
+
+    options.min_repetition_time = std::chrono::microseconds(variables_map["min-time-us"].as<std::int64_t>());
+
+    // The reports are relative to where we are started, the benchmark files are not
+    const std::filesystem::path output   = variables_map.contains("output")
+                                           ? std::filesystem::absolute(variables_map["output"].as<std::string>())
+                                           : std::filesystem::path();
+    const std::filesystem::path baseline = variables_map.contains("baseline")
+                                           ? std::filesystem::absolute(variables_map["baseline"].as<std::string>())
+                                           : std::filesystem::path();
+
+    const bool temporary_workdir = !variables_map.contains("workdir");
+    const std::filesystem::path workdir = temporary_workdir
+                                          ? std::filesystem::temp_directory_path() /
+                                            ("ozzy_bench_" + std::to_string(::getpid()))
+                                          : std::filesystem::path(variables_map["workdir"].as<std::string>());
+    const std::filesystem::path initial_path = std::filesystem::current_path();
+
+    std::error_code error_code;
+    std::filesystem::create_directories(workdir, error_code);
+    std::filesystem::current_path(workdir, error_code);
+    if (error_code)
+    {
+        std::cerr << "Unable to use " << workdir << " as the working directory: " << error_code.message() << std::endl;
+        return -1;
+    }
+
+    std::string report;
+    std::vector<Ozzy::Tools::BenchmarkResult> results;
+    {
+        std::vector<Ozzy::Tools::Benchmark> benchmarks;
+        Ozzy::Tools::add_protocol_benchmarks(benchmarks);
+        Ozzy::Tools::add_sort_benchmarks    (benchmarks);
+
+        if (variables_map.contains("list"))
+        {
+            for (const auto &benchmark: benchmarks)
+            {
+                std::cout << benchmark.name << std::endl;
+            }
+        }
+        else
+        {
+            results = Ozzy::Tools::run_benchmarks(benchmarks, options);
+            report  = Ozzy::Tools::format_report(results,
+            {
+                {"checksum_xor",    Ozzy::Proto::checksum_kernel_name(Ozzy::Proto::v3::CHECKSUM_XOR)},
+                {"checksum_crc32c", Ozzy::Proto::checksum_kernel_name(Ozzy::Proto::v3::CHECKSUM_CRC32C)},
+                {"uniform",         Ozzy::LibUDP::uniform_kernel_name()},
+                {"sort",            OZZY_USE_RADIX_SORT ? "radix" : "std::sort"},
+                {"sort_threads",    std::to_string(Ozzy::LibFS::sort_threads_count())},
+            });
+        }
+    }
+
+    // Every benchmark file is removed by now
+    std::filesystem::current_path(initial_path, error_code);
+    if (temporary_workdir)
+    {
+        std::filesystem::remove_all(workdir, error_code);
+    }
+
+    if (variables_map.contains("list"))
+    {
+        return 0;
+    }
+
+    if (output.empty())
+    {
+        std::cout << report;
+    }
+    else
+    {
+        std::ofstream output_file(output);
+        output_file << report;
+        if (!output_file)
+        {
+            std::cerr << "Unable to write the report to " << output << std::endl;
+            return -1;
+        }
+    }
+
+    if (!baseline.empty() &&
+        !Ozzy::Tools::compare_with_baseline(results, baseline.string(), variables_map["threshold"].as<double>()))
+    {
+        return 1;
+    }
+
+    return 0;
+}
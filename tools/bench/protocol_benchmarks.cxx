@@ -0,0 +1,216 @@
+#include "benchmark.h"
+#include "LibUDP/networking.h"
+#include "LibUDP/codec.h"
+#include "LibUDP/generator.h"
+
+#include <memory>
+
+namespace Ozzy::Tools
+{
+    namespace
+    {
+        // The frame the path MTU is unknown for, the one that fits into the jumbo frame and the
+        // largest one of the loopback
+        constexpr std::size_t DATAGRAM_SIZES[] = {Proto::v3::DEFAULT_DATAGRAM_SIZE, 8192, Proto::v3::MAX_DATAGRAM_SIZE};
+
+        constexpr double X = 10.0;
+
+        // The swap is a no-op if the host is already in that order
+        constexpr bool TO_FOREIGN_ORDER = TARGET_DEVICE_LITTLE_ENDIAN;
+
+        const char *checksum_name(const Proto::v3::Checksum checksum) noexcept
+        {
+            return checksum == Proto::v3::CHECKSUM_CRC32C ? "crc32c" : "xor";
+        }
+
+        const char *codec_name(const Proto::v3::Codec codec) noexcept
+        {
+            return codec == Proto::v3::CODEC_SHUFFLE_XOR ? "shuffle_xor" : "identity";
+        }
+
+        // The frame of `datagram_size` bytes, the part of the payload past sizeof(Proto::v3::Frame)
+        // is in the same storage right after it
+        class FrameStorage
+        {
+        public:
+            explicit FrameStorage(const std::size_t datagram_size)
+                : m_payload_count(Proto::v3::frame_payload_count(datagram_size)),
+                  m_storage((std::max(datagram_size, sizeof(Proto::v3::Frame)) + 7) / 8)
+            {
+                LibUDP::UniformGenerator(1).fill(frame().payload, m_payload_count, -X, X);
+                frame().length = static_cast<std::uint16_t>(m_payload_count);
+            }
+
+            Proto::v3::Frame &frame() noexcept
+            {
+                return *reinterpret_cast<Proto::v3::Frame*>(m_storage.data());
+            }
+
+            std::size_t payload_count() const noexcept
+            {
+                return m_payload_count;
+            }
+
+        private:
+            std::size_t                m_payload_count;
+            std::vector<std::uint64_t> m_storage;
+        };
+
+        void add_checksum_benchmarks(std::vector<Benchmark> &benchmarks)
+        {
+            auto v2_frame = std::make_shared<Proto::Frame>();
+            LibUDP::UniformGenerator(1).fill(v2_frame->payload, Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK, -X, X);
+            v2_frame->length = Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK;
+
+            benchmarks.push_back({"checksum/v2", Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK * sizeof(double), {}, [v2_frame]
+            {
+                keep_value(Proto::calculate_frame_checksum(*v2_frame));
+            }});
+
+            for (std::uint8_t i = 0; i < Proto::v3::CHECKSUM_COUNT; ++i)
+            {
+                const auto checksum = static_cast<Proto::v3::Checksum>(i);
+                if (!(Proto::supported_checksums() & Proto::v3::checksum_bit(checksum)))
+                {
+                    continue;
+                }
+
+                for (const std::size_t datagram_size: DATAGRAM_SIZES)
+                {
+                    auto storage = std::make_shared<FrameStorage>(datagram_size);
+
+                    benchmarks.push_back({std::string("checksum/") + checksum_name(checksum) + "/" +
+                                          std::to_string(datagram_size),
+                                          storage->payload_count() * sizeof(double), {}, [storage, checksum]
+                    {
+                        keep_value(Proto::calculate_frame_checksum(storage->frame(), checksum, storage->payload_count()));
+                    }});
+                }
+            }
+        }
+
+        void add_swap_benchmarks(std::vector<Benchmark> &benchmarks)
+        {
+            auto v2_frame = std::make_shared<Proto::Frame>();
+            LibUDP::UniformGenerator(1).fill(v2_frame->payload, Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK, -X, X);
+            v2_frame->length = Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK;
+
+            benchmarks.push_back({"swap_endianess/v2_frame", sizeof(Proto::Frame), {}, [v2_frame]
+            {
+                LibUDP::swap_endianess(*v2_frame, TO_FOREIGN_ORDER);
+                keep_value(*v2_frame);
+            }});
+
+            for (const std::size_t datagram_size: DATAGRAM_SIZES)
+            {
+                auto storage = std::make_shared<FrameStorage>(datagram_size);
+
+                benchmarks.push_back({"swap_endianess/v3_frame/" + std::to_string(datagram_size), datagram_size, {},
+                                      [storage]
+                {
+                    // The length is swapped as well, and the payload count is taken from it
+                    storage->frame().length = static_cast<std::uint16_t>(storage->payload_count());
+                    LibUDP::swap_endianess(storage->frame(), TO_FOREIGN_ORDER);
+                    keep_value(storage->frame());
+                }});
+            }
+
+            auto acknowledgement = std::make_shared<Proto::v3::Acknowledgement>();
+            acknowledgement->cumulative  = 12345;
+            acknowledgement->selective[0] = 0xF0F0F0F0F0F0F0F0ULL;
+
+            benchmarks.push_back({"swap_endianess/acknowledgement", sizeof(Proto::v3::Acknowledgement), {},
+                                  [acknowledgement]
+            {
+                LibUDP::swap_endianess(*acknowledgement, TO_FOREIGN_ORDER);
+                keep_value(*acknowledgement);
+            }});
+
+            auto request = std::make_shared<Proto::v3::SessionRequest>();
+            request->doubles_count = 1000000;
+            request->x_upper_bound = X;
+
+            benchmarks.push_back({"swap_endianess/session_request", sizeof(Proto::v3::SessionRequest), {}, [request]
+            {
+                LibUDP::swap_endianess(*request, TO_FOREIGN_ORDER);
+                keep_value(*request);
+            }});
+        }
+
+        // Same steps as send_frame_array() of the v3 server takes for every frame: top the values
+        // up from the generator, encode as much of them as fit into the frame, and sum it up
+        void add_frame_generation_benchmarks(std::vector<Benchmark> &benchmarks)
+        {
+            const Proto::v3::Checksum checksum = Proto::supported_checksums() & Proto::v3::checksum_bit(Proto::v3::CHECKSUM_CRC32C)
+                                                 ? Proto::v3::CHECKSUM_CRC32C
+                                                 : Proto::v3::CHECKSUM_XOR;
+
+            for (const std::size_t datagram_size: DATAGRAM_SIZES)
+            {
+                auto generator = std::make_shared<LibUDP::UniformGenerator>(1);
+                auto values    = std::make_shared<std::vector<double>>(Proto::v3::frame_payload_count(datagram_size));
+
+                benchmarks.push_back({"generation/uniform/" + std::to_string(values->size()),
+                                      values->size() * sizeof(double), {}, [generator, values]
+                {
+                    generator->fill(values->data(), values->size(), -X, X);
+                    keep_value(values->data());
+                }});
+            }
+
+            for (std::uint8_t i = 0; i < Proto::v3::CODEC_COUNT; ++i)
+            {
+                const auto codec = static_cast<Proto::v3::Codec>(i);
+                if (!(LibUDP::supported_codecs() & Proto::v3::codec_bit(codec)))
+                {
+                    continue;
+                }
+
+                for (const std::size_t datagram_size: DATAGRAM_SIZES)
+                {
+                    auto storage   = std::make_shared<FrameStorage>(datagram_size);
+                    auto generator = std::make_shared<LibUDP::UniformGenerator>(1);
+                    auto values    = std::make_shared<std::vector<double>>();
+
+                    const bool        coded            = codec != Proto::v3::CODEC_IDENTITY;
+                    const std::size_t payload_count    = storage->payload_count();
+                    const std::size_t values_per_frame = coded ? Proto::v3::codec_max_values(payload_count) : payload_count;
+
+                    values->reserve(values_per_frame);
+
+                    benchmarks.push_back({std::string("frame_generation/") + codec_name(codec) + "/" +
+                                          std::to_string(datagram_size), datagram_size, {},
+                                          [storage, generator, values, codec, coded, checksum, payload_count,
+                                           values_per_frame, sequence = std::uint32_t(0)]() mutable
+                    {
+                        Proto::v3::Frame &frame = storage->frame();
+
+                        const std::size_t offset = values->size();
+                        values->resize(values_per_frame);
+                        generator->fill(values->data() + offset, values_per_frame - offset, -X, X);
+
+                        std::size_t encoded_size = 0;
+                        frame.length   = static_cast<std::uint16_t>(LibUDP::payload_codec(codec).encode(
+                            *values, std::span(reinterpret_cast<std::uint8_t*>(frame.payload),
+                                               payload_count * sizeof(double)),
+                            encoded_size));
+                        frame.sequence = sequence++;
+                        frame.flags    = coded ? Proto::v3::FRAME_FLAG_CODED : Proto::v3::FRAME_FLAG_NONE;
+
+                        values->erase(values->begin(), values->begin() + frame.length);
+
+                        frame.checksum = Proto::calculate_frame_checksum(frame, checksum, payload_count);
+                        keep_value(frame);
+                    }});
+                }
+            }
+        }
+    }
+
+    void add_protocol_benchmarks(std::vector<Benchmark> &benchmarks)
+    {
+        add_checksum_benchmarks(benchmarks);
+        add_swap_benchmarks(benchmarks);
+        add_frame_generation_benchmarks(benchmarks);
+    }
+}
@@ -0,0 +1,154 @@
+#include "benchmark.h"
+#include "LibFS/thread_cache_file.h"
+#include "LibFS/result_file.h"
+#include "LibUDP/generator.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+namespace Ozzy::Tools
+{
+    namespace
+    {
+        // Values of the chunk sorted in one go, up to the default chunk arena
+        constexpr std::size_t CHUNK_SIZES[] = {1 << 16, 1 << 20, 1 << 22};
+
+        // Chunks of the same session merged into the result file
+        constexpr std::size_t MERGE_VALUES   = 1 << 20;
+        constexpr std::size_t MERGE_CHUNKS[] = {2, 8, 32, 128};
+
+        // Files of the benchmarks, removed together with the last benchmark that uses them
+        class ScratchFiles
+        {
+        public:
+            ScratchFiles() = default;
+
+            ScratchFiles(const ScratchFiles&) = delete;
+
+            ScratchFiles &operator=(const ScratchFiles&) = delete;
+
+            ~ScratchFiles()
+            {
+                std::error_code error_code;
+                for (const auto &filename: m_filenames)
+                {
+                    std::filesystem::remove(filename, error_code);
+                }
+            }
+
+            // Write the random values(sorted if asked) into the new file
+            std::string create(const std::string &filename, const std::size_t count, const bool sorted)
+            {
+                std::vector<double> values(count);
+                LibUDP::UniformGenerator(count).fill(values.data(), values.size(), -10.0, 10.0);
+                if (sorted)
+                {
+                    std::sort(values.begin(), values.end());
+                }
+
+                std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+                file.write(reinterpret_cast<const char*>(values.data()),
+                           static_cast<std::streamsize>(values.size() * sizeof(double)));
+
+                return track(filename);
+            }
+
+            std::string track(const std::string &filename)
+            {
+                m_filenames.push_back(filename);
+                return filename;
+            }
+
+        private:
+            std::vector<std::string> m_filenames;
+        };
+
+        // Chunk file written by the last repetition
+        struct ChunkFile
+        {
+            ~ChunkFile()
+            {
+                clear();
+            }
+
+            void clear()
+            {
+                std::error_code error_code;
+                if (!filename.empty())
+                {
+                    std::filesystem::remove(filename, error_code);
+                    filename.clear();
+                }
+            }
+
+            std::string filename;
+        };
+
+        void add_chunk_benchmarks(std::vector<Benchmark> &benchmarks, const std::shared_ptr<ScratchFiles> &files)
+        {
+            for (const std::size_t count: CHUNK_SIZES)
+            {
+                const std::string cache_file = files->create("bench_cache_" + std::to_string(count) + ".bin", count, false);
+                auto              chunk_file = std::make_shared<ChunkFile>();
+
+                benchmarks.push_back({"sort_and_write_chunk/" + std::to_string(count), count * sizeof(double),
+                                      [chunk_file]
+                {
+                    chunk_file->clear();
+                },
+                [files, cache_file, chunk_file, count]
+                {
+                    LibFS::ThreadCacheFile::sort_and_write_chunk(cache_file, 0, count, chunk_file->filename);
+                }});
+            }
+        }
+
+        void add_merge_benchmarks(std::vector<Benchmark> &benchmarks, const std::shared_ptr<ScratchFiles> &files)
+        {
+            for (const std::size_t chunks_count: MERGE_CHUNKS)
+            {
+                // Every repetition merges the copies of these, the merge removes its chunk files
+                std::vector<std::string> sorted_chunks;
+                std::vector<std::string> chunk_files;
+
+                for (std::size_t i = 0; i < chunks_count; ++i)
+                {
+                    const std::string prefix = "bench_merge_" + std::to_string(chunks_count) + "_" + std::to_string(i);
+
+                    sorted_chunks.push_back(files->create(prefix + "_sorted.bin", MERGE_VALUES / chunks_count, true));
+                    chunk_files  .push_back(files->track (prefix + "_chunk.bin"));
+                }
+
+                benchmarks.push_back({"merge_and_delete_chunk_caches/" + std::to_string(chunks_count) + "x" +
+                                      std::to_string(MERGE_VALUES / chunks_count), MERGE_VALUES * sizeof(double),
+                                      [sorted_chunks, chunk_files]
+                {
+                    for (std::size_t i = 0; i < sorted_chunks.size(); ++i)
+                    {
+                        std::filesystem::copy_file(sorted_chunks[i], chunk_files[i],
+                                                   std::filesystem::copy_options::overwrite_existing);
+                    }
+
+                    // Every merge appends the session, the result file starts from scratch
+                    std::filesystem::remove(LibFS::RESULT_FILE_NAME);
+                },
+                [files, chunk_files]
+                {
+                    LibFS::ThreadCacheFile::merge_and_delete_chunk_caches(chunk_files, MERGE_VALUES);
+                }});
+            }
+
+            files->track(LibFS::RESULT_FILE_NAME);
+        }
+    }
+
+    void add_sort_benchmarks(std::vector<Benchmark> &benchmarks)
+    {
+        auto files = std::make_shared<ScratchFiles>();
+
+        add_chunk_benchmarks(benchmarks, files);
+        add_merge_benchmarks(benchmarks, files);
+    }
+}
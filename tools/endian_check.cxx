@@ -0,0 +1,299 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "protocol.h"
+#include "LibUDP/byteswap.h"
+#include "LibUDP/networking.h"
+
+// Round trip of the messages between the host and the client of the other byte order. The
+// foreign client is emulated by building its datagrams by hand(every multi-octet field reversed),
+// so the check runs on any single host.
+namespace
+{
+    using namespace Ozzy;
+
+#if TARGET_DEVICE_LITTLE_ENDIAN
+    constexpr bool HOST_BIG_ENDIAN = false;
+#else
+    constexpr bool HOST_BIG_ENDIAN = true;
+#endif
+
+    // Order of the emulated client
+    constexpr bool FOREIGN_BIG_ENDIAN = !HOST_BIG_ENDIAN;
+
+    std::size_t failures = 0;
+
+    void expect(const bool condition, const std::string &what)
+    {
+        if (!condition)
+        {
+            std::cerr << "FAILED: " << what << std::endl;
+            ++failures;
+        }
+    }
+
+    // Reverse the `size` octets at the `offset` of the message
+    template<typename T>
+    void reverse_field(T &message, const std::size_t offset, const std::size_t size)
+    {
+        auto *bytes = reinterpret_cast<std::uint8_t*>(std::addressof(message));
+        std::reverse(bytes + offset, bytes + offset + size);
+    }
+
+    void check_byteswap()
+    {
+        // Guard words around the array catch the kernels that run past its end
+        constexpr std::uint64_t guard = 0xA5A5A5A5A5A5A5A5ULL;
+
+        for (std::size_t count = 0; count <= 200; ++count)
+        {
+            std::vector<std::uint64_t> words(count + 2, guard);
+            std::vector<std::uint64_t> expected(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                words[i + 1] = 0x0102030405060708ULL * (i + 1);
+                expected[i]  = __builtin_bswap64(words[i + 1]);
+            }
+
+            LibUDP::byteswap_64(words.data() + 1, count);
+            expect(std::equal(expected.begin(), expected.end(), words.begin() + 1) &&
+                   words.front() == guard && words.back() == guard,
+                   "byteswap_64 of " + std::to_string(count) + " words");
+
+            std::vector<std::uint32_t> halves(count + 2, static_cast<std::uint32_t>(guard));
+            std::vector<std::uint32_t> expected_halves(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                halves[i + 1]      = 0x01020304u * static_cast<std::uint32_t>(i + 1);
+                expected_halves[i] = __builtin_bswap32(halves[i + 1]);
+            }
+
+            LibUDP::byteswap_32(halves.data() + 1, count);
+            expect(std::equal(expected_halves.begin(), expected_halves.end(), halves.begin() + 1) &&
+                   halves.front() == static_cast<std::uint32_t>(guard) &&
+                   halves.back()  == static_cast<std::uint32_t>(guard),
+                   "byteswap_32 of " + std::to_string(count) + " words");
+        }
+    }
+
+    void check_endian_marker()
+    {
+        bool big_endian = !HOST_BIG_ENDIAN;
+
+        // Our own handshake is in the host order
+        Proto::Handshake handshake;
+        auto *bytes = reinterpret_cast<const std::uint8_t*>(&handshake);
+        expect(LibUDP::detect_endianess(bytes, sizeof(handshake), big_endian) && big_endian == HOST_BIG_ENDIAN,
+               "endian marker of the host handshake");
+        expect(bytes[Proto::HANDSHAKE_TYPE_OFFSET] == Proto::MESSAGE_TYPE_HANDSHAKE, "type of the host handshake");
+
+        // The foreign one has the marker octets the other way around
+        const std::uint8_t foreign[] = {bytes[1], bytes[0], Proto::MESSAGE_TYPE_HANDSHAKE};
+        expect(LibUDP::detect_endianess(foreign, sizeof(foreign), big_endian) && big_endian == FOREIGN_BIG_ENDIAN,
+               "endian marker of the foreign handshake");
+
+        // The old single octet marker, garbage and truncated messages have no marker
+        const std::uint8_t old_marker[] = {1, Proto::MESSAGE_TYPE_HANDSHAKE};
+        const std::uint8_t garbage[]    = {0xFF, 0x00, Proto::MESSAGE_TYPE_HANDSHAKE};
+        expect(!LibUDP::detect_endianess(old_marker, sizeof(old_marker), big_endian), "single octet marker is rejected");
+        expect(!LibUDP::detect_endianess(garbage,    sizeof(garbage),    big_endian), "garbage marker is rejected");
+        expect(!LibUDP::detect_endianess(bytes, 1, big_endian), "truncated marker is rejected");
+    }
+
+    void check_session_request()
+    {
+        Proto::v3::SessionRequest sent;
+        sent.offered.checksums     = Proto::supported_checksums();
+        sent.offered.codecs        = 3;
+        sent.offered.datagram_size = 9000 - 28;
+        sent.doubles_count         = 0x0000000102030405ULL;
+        sent.x_upper_bound         = -1234.5678;
+
+        // What the foreign client puts on the wire
+        Proto::v3::SessionRequest wire = sent;
+        reverse_field(wire, offsetof(Proto::v3::SessionRequest, endian), sizeof(std::uint16_t));
+        reverse_field(wire, offsetof(Proto::v3::SessionRequest, offered) + offsetof(Proto::v3::Negotiation, datagram_size),
+                      sizeof(std::uint32_t));
+        reverse_field(wire, offsetof(Proto::v3::SessionRequest, doubles_count), sizeof(std::uint64_t));
+        reverse_field(wire, offsetof(Proto::v3::SessionRequest, x_upper_bound), sizeof(double));
+
+        // Server side(look at the v2::UdpServer::handle_message)
+        const auto *message = reinterpret_cast<const std::uint8_t*>(&wire);
+        bool to_big_endian = HOST_BIG_ENDIAN;
+        expect(LibUDP::detect_endianess(message, sizeof(wire), to_big_endian) && to_big_endian == FOREIGN_BIG_ENDIAN,
+               "session request endian marker");
+        expect(message[Proto::HANDSHAKE_TYPE_OFFSET] == Proto::MESSAGE_TYPE_SESSION_REQUEST, "session request type");
+
+        Proto::v3::SessionRequest received;
+        std::memcpy(&received, message, sizeof(received));
+        LibUDP::swap_endianess(received, to_big_endian);
+
+        expect(received.version                == sent.version,                "session request version");
+        expect(received.offered.checksums      == sent.offered.checksums,      "session request checksums");
+        expect(received.offered.codecs         == sent.offered.codecs,         "session request codecs");
+        expect(received.offered.datagram_size  == sent.offered.datagram_size,  "session request datagram size");
+        expect(received.doubles_count          == sent.doubles_count,          "session request doubles count");
+        expect(std::memcmp(&received.x_upper_bound, &sent.x_upper_bound, sizeof(double)) == 0,
+               "session request x bound keeps its bit pattern");
+
+        // The host client's request is taken as it is
+        Proto::v3::SessionRequest own = sent;
+        expect(LibUDP::detect_endianess(reinterpret_cast<const std::uint8_t*>(&own), sizeof(own), to_big_endian) &&
+               to_big_endian == HOST_BIG_ENDIAN, "host session request endian marker");
+        LibUDP::swap_endianess(own, to_big_endian);
+        expect(std::memcmp(&own, &sent, sizeof(own)) == 0, "host session request is not converted");
+    }
+
+    void check_session_answer()
+    {
+        Proto::v3::SessionAnswer sent;
+        sent.picked.checksums     = Proto::v3::checksum_bit(Proto::v3::CHECKSUM_CRC32C);
+        sent.picked.datagram_size = 1472;
+        sent.doubles_count        = 1000000;
+
+        Proto::v3::SessionAnswer expected = sent;
+        reverse_field(expected, offsetof(Proto::v3::SessionAnswer, picked) + offsetof(Proto::v3::Negotiation, datagram_size),
+                      sizeof(std::uint32_t));
+        reverse_field(expected, offsetof(Proto::v3::SessionAnswer, doubles_count), sizeof(std::uint64_t));
+
+        Proto::v3::SessionAnswer wire = sent;
+        LibUDP::swap_endianess(wire, FOREIGN_BIG_ENDIAN);
+        expect(std::memcmp(&wire, &expected, sizeof(wire)) == 0, "session answer in the foreign order");
+    }
+
+    void check_frames()
+    {
+        // v3 frame, the header fields and every double of the payload are reversed
+        Proto::v3::Frame frame;
+        frame.flags    = Proto::v3::FRAME_FLAG_END_OF_STREAM;
+        frame.length   = 100;
+        frame.sequence = 0x01020304;
+        for (std::size_t i = 0; i < frame.length; ++i)
+        {
+            frame.payload[i] = static_cast<double>(i) * -0.25 + 1e-300;
+        }
+        frame.checksum = Proto::calculate_frame_checksum(frame, Proto::v3::CHECKSUM_CRC32C);
+
+        Proto::v3::Frame expected = frame;
+        reverse_field(expected, offsetof(Proto::v3::Frame, length),   sizeof(std::uint16_t));
+        reverse_field(expected, offsetof(Proto::v3::Frame, sequence), sizeof(std::uint32_t));
+        reverse_field(expected, offsetof(Proto::v3::Frame, checksum), sizeof(std::uint64_t));
+        for (std::size_t i = 0; i < frame.length; ++i)
+        {
+            reverse_field(expected, offsetof(Proto::v3::Frame, payload) + i * sizeof(double), sizeof(double));
+        }
+
+        Proto::v3::Frame wire = frame;
+        LibUDP::swap_endianess(wire, FOREIGN_BIG_ENDIAN);
+        expect(std::memcmp(&wire, &expected, sizeof(wire)) == 0, "v3 frame in the foreign order");
+
+        Proto::v3::Frame own = frame;
+        LibUDP::swap_endianess(own, HOST_BIG_ENDIAN);
+        expect(std::memcmp(&own, &frame, sizeof(own)) == 0, "v3 frame in the host order is not converted");
+
+        // v2 frame, the type and the length are single octets, the 48 bit checksum is reversed
+        Proto::Frame v2_frame;
+        v2_frame.length   = 175;
+        v2_frame.checksum = 0x0000010203040506ULL;
+        for (std::size_t i = 0; i < Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK; ++i)
+        {
+            v2_frame.payload[i] = static_cast<double>(i) / 3.0;
+        }
+
+        Proto::Frame v2_expected = v2_frame;
+        reverse_field(v2_expected, 2, 6);
+        for (std::size_t i = 0; i < Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK; ++i)
+        {
+            reverse_field(v2_expected, offsetof(Proto::Frame, payload) + i * sizeof(double), sizeof(double));
+        }
+
+        Proto::Frame v2_wire = v2_frame;
+        LibUDP::swap_endianess(v2_wire, FOREIGN_BIG_ENDIAN);
+        expect(std::memcmp(&v2_wire, &v2_expected, sizeof(v2_wire)) == 0, "v2 frame in the foreign order");
+
+        // Acknowledgement goes the other way, from the foreign client to us
+        Proto::v3::Acknowledgement acknowledgement;
+        acknowledgement.answer     = Proto::v1::ACK;
+        acknowledgement.cumulative = 0x0A0B0C0D;
+        for (std::size_t i = 0; i < Proto::v3::ACK_SELECTIVE_WORDS; ++i)
+        {
+            acknowledgement.selective[i] = 0x8000000000000001ULL >> i;
+        }
+
+        Proto::v3::Acknowledgement acknowledgement_wire = acknowledgement;
+        reverse_field(acknowledgement_wire, offsetof(Proto::v3::Acknowledgement, cumulative), sizeof(std::uint32_t));
+        for (std::size_t i = 0; i < Proto::v3::ACK_SELECTIVE_WORDS; ++i)
+        {
+            reverse_field(acknowledgement_wire, offsetof(Proto::v3::Acknowledgement, selective) + i * sizeof(std::uint64_t),
+                          sizeof(std::uint64_t));
+        }
+
+        LibUDP::swap_endianess(acknowledgement_wire, FOREIGN_BIG_ENDIAN);
+        expect(std::memcmp(&acknowledgement_wire, &acknowledgement, sizeof(acknowledgement)) == 0,
+               "acknowledgement from the foreign client");
+
+        double x = -0.1;
+        double x_wire = x;
+        reverse_field(x_wire, 0, sizeof(double));
+        LibUDP::swap_endianess(x_wire, FOREIGN_BIG_ENDIAN);
+        expect(std::memcmp(&x, &x_wire, sizeof(double)) == 0, "double keeps its bit pattern");
+    }
+
+    void check_wire_checksums()
+    {
+        boost::asio::io_context context;
+
+        for (const bool big_endian: {HOST_BIG_ENDIAN, FOREIGN_BIG_ENDIAN})
+        {
+            for (std::size_t algorithm = 0; algorithm < Proto::v3::CHECKSUM_COUNT; ++algorithm)
+            {
+                LibUDP::Session session(context);
+                session.to_big_endian = big_endian;
+                session.checksum      = static_cast<Proto::v3::Checksum>(algorithm);
+
+                Proto::v3::Frame frame;
+                frame.length = 150;
+                for (std::size_t i = 0; i < frame.length; ++i)
+                {
+                    frame.payload[i] = static_cast<double>(i) * 1.5 - 7.0;
+                }
+
+                // Server side(look at the v3::UdpServer::send_window)
+                frame.checksum = LibUDP::calculate_wire_checksum(session, frame, Proto::OZZY_PAYLOAD_COUNT_PER_CHUNK);
+                const std::uint64_t checksum = frame.checksum;
+                const std::uint16_t length   = frame.length;
+                LibUDP::swap_endianess(frame, big_endian);
+
+                // The client checks the payload bytes as they came
+                const std::string name = std::string(Proto::checksum_kernel_name(session.checksum)) +
+                                         (big_endian == HOST_BIG_ENDIAN ? " frame in the host order"
+                                                                        : " frame in the foreign order");
+                expect(Proto::calculate_payload_checksum(session.checksum, frame.payload, length) == checksum,
+                       name + " passes the client's check");
+            }
+        }
+    }
+}
+
+int main()
+{
+    check_byteswap();
+    check_endian_marker();
+    check_session_request();
+    check_session_answer();
+    check_frames();
+    check_wire_checksums();
+
+    if (failures != 0)
+    {
+        std::cerr << failures << " endianness checks failed" << std::endl;
+        return -1;
+    }
+
+    std::cout << "Endianness checks passed(" << Ozzy::LibUDP::byteswap_kernel_name() << " kernel)" << std::endl;
+    return 0;
+}
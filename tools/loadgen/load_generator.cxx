@@ -0,0 +1,504 @@
+#include "load_generator.h"
+#include "LibLog/logging.h"
+#include "LibUDP/codec.h"
+#include "LibUDP/impairment.h"
+#include "LibFS/thread_cache_file.h"
+
+#include <cmath>
+#include <random>
+#include <sstream>
+
+namespace Ozzy::Tools
+{
+    namespace
+    {
+        std::uint64_t to_microseconds(const std::chrono::steady_clock::duration duration) noexcept
+        {
+            return static_cast<std::uint64_t>(
+                std::max<std::int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+        }
+
+        void write_histogram(std::ostringstream &stream, const std::string &name,
+                             const Component::LatencyHistogram &histogram, const bool last)
+        {
+            stream << "    \"" << name << "\": {"
+                   << "\"count\": " << histogram.count()
+                   << ", \"min\": " << histogram.min()
+                   << ", \"mean\": " << static_cast<std::uint64_t>(histogram.mean())
+                   << ", \"p50\": " << histogram.percentile(50.0)
+                   << ", \"p90\": " << histogram.percentile(90.0)
+                   << ", \"p99\": " << histogram.percentile(99.0)
+                   << ", \"p999\": " << histogram.percentile(99.9)
+                   << ", \"max\": " << histogram.max() << "}" << (last ? "\n" : ",\n");
+        }
+    }
+
+    LoadGenerator::LoadGenerator(const std::string &config_path, const std::string logger_name, const LoadOptions &options)
+        : Informative(logger_name), m_options(options)
+    {
+        if (!config_load(config_path))
+        {
+            LibLog::log_print(m_logger_name, "Failed starting load generator(error loading config file)");
+            return;
+        }
+
+        if (!config_contains({"server_port", "server_ip_address"}))
+        {
+            LibLog::log_print(m_logger_name, "Failed starting load generator(error parsing config file)");
+            return;
+        }
+
+        try
+        {
+            boost::asio::io_context resolver_context;
+            auto resolver  = udp::resolver(resolver_context);
+            auto endpoints = resolver.resolve(udp::v4(), m_config["server_ip_address"], m_config["server_port"]);
+
+            m_server_endpoint = *endpoints.begin();
+        }
+        catch (const boost::system::system_error &)
+        {
+            LibLog::log_print(m_logger_name, "Unable to resolve the server address");
+            return;
+        }
+
+        // Every session offers the same frame size, so the path is probed only once
+        const std::size_t probed_size = LibUDP::probe_datagram_size(m_server_endpoint);
+        m_options.datagram_size = m_options.datagram_size == 0 ? probed_size
+                                                                : std::min(m_options.datagram_size, probed_size);
+        m_options.threads       = std::max<std::size_t>(1, m_options.threads);
+        m_options.concurrency   = std::max<std::size_t>(1, m_options.concurrency);
+        m_worker_concurrency    = (m_options.concurrency + m_options.threads - 1) / m_options.threads;
+
+        for (std::size_t i = 0; i < m_options.threads; ++i)
+        {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        if (m_options.sort_threads != 0)
+        {
+            m_sort_pool = std::make_unique<boost::asio::thread_pool>(m_options.sort_threads);
+        }
+
+        m_initialized = true;
+    }
+
+    void LoadGenerator::Statistics::merge(const Statistics &other) noexcept
+    {
+        handshake.merge(other.handshake);
+        transfer .merge(other.transfer);
+        sort     .merge(other.sort);
+        total    .merge(other.total);
+
+        completed  += other.completed;
+        rejected   += other.rejected;
+        unanswered += other.unanswered;
+        failed     += other.failed;
+        shed       += other.shed;
+        values     += other.values;
+    }
+
+    void LoadGenerator::schedule_arrivals(const time_point_t start)
+    {
+        // Poisson arrivals, the gaps between the sessions are exponential with the mean of 1 / rate
+        std::mt19937_64                  engine(m_options.seed);
+        std::exponential_distribution<>  gap(m_options.rate);
+
+        double offset = 0.0;
+        for (std::uint64_t i = 0; i < m_options.sessions_count; ++i)
+        {
+            m_workers[i % m_workers.size()]->arrivals.push_back(
+                start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                            std::chrono::duration<double>(offset)));
+            offset += gap(engine);
+        }
+    }
+
+    std::string LoadGenerator::run()
+    {
+        if (!m_initialized)
+        {
+            return {};
+        }
+
+        LibLog::log_print(m_logger_name, "Running " + std::to_string(m_options.sessions_count) + " sessions against " +
+                                         LibLog::serialize_endpoint(m_server_endpoint) + " with " +
+                                         std::to_string(m_options.datagram_size) + " bytes frames");
+
+        const time_point_t start = std::chrono::steady_clock::now();
+
+        if (m_options.rate > 0.0)
+        {
+            schedule_arrivals(start);
+        }
+
+        for (auto &worker: m_workers)
+        {
+            if (m_options.rate > 0.0)
+            {
+                boost::asio::co_spawn(worker->io_context, open_loop(*worker), boost::asio::detached);
+                continue;
+            }
+
+            for (std::size_t i = 0; i < m_worker_concurrency; ++i)
+            {
+                boost::asio::co_spawn(worker->io_context, closed_loop(*worker), boost::asio::detached);
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for (auto &worker: m_workers)
+        {
+            threads.emplace_back([&worker]
+            {
+                worker->io_context.run();
+            });
+        }
+
+        for (auto &thread: threads)
+        {
+            thread.join();
+        }
+
+        const auto duration = std::chrono::steady_clock::now() - start;
+
+        Statistics statistics;
+        for (const auto &worker: m_workers)
+        {
+            statistics.merge(worker->statistics);
+        }
+
+        return report(statistics, duration);
+    }
+
+    boost::asio::awaitable<void> LoadGenerator::open_loop(Worker &worker)
+    {
+        boost::asio::steady_timer timer(worker.io_context);
+
+        for (const time_point_t scheduled_at: worker.arrivals)
+        {
+            timer.expires_at(scheduled_at);
+            co_await timer.async_wait(boost::asio::use_awaitable);
+
+            // The open loop never waits for the sessions, but the sockets and the memory are finite
+            if (worker.in_flight >= m_worker_concurrency)
+            {
+                ++worker.statistics.shed;
+                continue;
+            }
+
+            boost::asio::co_spawn(worker.io_context, measure_session(worker, scheduled_at), boost::asio::detached);
+        }
+    }
+
+    boost::asio::awaitable<void> LoadGenerator::closed_loop(Worker &worker)
+    {
+        while (m_started.fetch_add(1, std::memory_order_relaxed) < m_options.sessions_count)
+        {
+            co_await measure_session(worker, std::chrono::steady_clock::now());
+        }
+    }
+
+    boost::asio::awaitable<void> LoadGenerator::measure_session(Worker &worker, const time_point_t scheduled_at)
+    {
+        ++worker.in_flight;
+
+        Outcome outcome = Outcome::FAILED;
+        try
+        {
+            outcome = co_await run_session(worker, scheduled_at);
+        }
+        catch (const std::exception &)
+        {
+        }
+
+        switch (outcome)
+        {
+            case Outcome::COMPLETED:  ++worker.statistics.completed;  break;
+            case Outcome::REJECTED:   ++worker.statistics.rejected;   break;
+            case Outcome::UNANSWERED: ++worker.statistics.unanswered; break;
+            case Outcome::FAILED:     ++worker.statistics.failed;     break;
+        }
+
+        --worker.in_flight;
+    }
+
+    boost::asio::awaitable<LoadGenerator::Outcome> LoadGenerator::run_session(Worker &worker,
+                                                                              const time_point_t scheduled_at)
+    {
+        auto session = std::make_shared<LibUDP::Session>(worker.io_context, m_server_endpoint);
+#if TARGET_DEVICE_LITTLE_ENDIAN
+        session->to_big_endian = false;
+#else
+        session->to_big_endian = true;
+#endif
+
+        Proto::v3::SessionRequest request;
+        request.version                = Proto::VERSION_3;
+        request.offered.checksums      = Proto::supported_checksums();
+        request.offered.codecs         = LibUDP::supported_codecs();
+        request.offered.datagram_size  = static_cast<std::uint32_t>(
+            LibUDP::reserve_receive_buffer(session->socket, m_options.datagram_size, OZZY_ARQ_WINDOW_SIZE));
+        request.doubles_count          = m_options.doubles_count;
+        request.x_upper_bound          = m_options.x;
+
+        // 1. Handshake
+        Proto::v3::SessionAnswer answer;
+        if (!co_await request_session(session, request, answer))
+        {
+            co_return Outcome::UNANSWERED;
+        }
+
+        if (answer.answer != Proto::v1::ACK)
+        {
+            co_return Outcome::REJECTED;
+        }
+
+        const time_point_t answered_at = std::chrono::steady_clock::now();
+        worker.statistics.handshake.record(to_microseconds(answered_at - scheduled_at));
+
+        Proto::v3::Acknowledgement drop;
+        drop.answer = Proto::v1::DROP;
+
+        if (!accept_session_parameters(*session, request.offered, answer.picked))
+        {
+            co_await LibUDP::async_send_data(session, drop);
+            co_return Outcome::FAILED;
+        }
+
+        boost::system::error_code error;
+        session->socket.connect(session->endpoint, error);
+
+        // 2. Transfer, the values go to the cache file only when they are sorted afterwards
+        std::unique_ptr<LibFS::ThreadCacheFile> cache_file;
+        if (m_sort_pool)
+        {
+            cache_file = std::make_unique<LibFS::ThreadCacheFile>();
+            if (!cache_file->initialized_sucessfully())
+            {
+                co_await LibUDP::async_send_data(session, drop);
+                co_return Outcome::FAILED;
+            }
+        }
+
+        std::uint64_t values_count = 0;
+        const auto write_values = [&cache_file, &values_count](const double *values, const std::size_t count)
+        {
+            values_count += count;
+            if (cache_file)
+            {
+                cache_file->write_values(values, count);
+            }
+        };
+
+        const bool received = co_await receive_frames(session, write_values);
+        session->close();
+
+        if (!received || values_count != answer.doubles_count)
+        {
+            co_return Outcome::FAILED;
+        }
+
+        const time_point_t transferred_at = std::chrono::steady_clock::now();
+        worker.statistics.transfer.record(to_microseconds(transferred_at - answered_at));
+        worker.statistics.values += values_count;
+
+        // 3. Sort, it blocks the thread for long, so it runs on the sort pool
+        if (cache_file)
+        {
+            co_await boost::asio::co_spawn(*m_sort_pool, [&cache_file]() -> boost::asio::awaitable<void>
+            {
+                cache_file->sort_file();
+                co_return;
+            }, boost::asio::use_awaitable);
+
+            worker.statistics.sort.record(to_microseconds(std::chrono::steady_clock::now() - transferred_at));
+        }
+
+        worker.statistics.total.record(to_microseconds(std::chrono::steady_clock::now() - scheduled_at));
+        co_return Outcome::COMPLETED;
+    }
+
+    boost::asio::awaitable<bool> LoadGenerator::request_session(std::shared_ptr<LibUDP::Session> &session,
+                                                                const Proto::v3::SessionRequest &request,
+                                                                Proto::v3::SessionAnswer &answer)
+    {
+        const auto retransmit_timeout = std::chrono::milliseconds(Proto::Constant::PacketRetransmitWaitTimestamp);
+        const auto idle_timeout       = retransmit_timeout * (Proto::Constant::PacketRetransmitMaxAttempts + 1);
+
+        for (std::size_t attempts = 0; attempts < Proto::PacketRetransmitMaxAttempts; ++attempts)
+        {
+            session->endpoint = m_server_endpoint;
+            if (!co_await LibUDP::async_send_data(session, Proto::v3::SessionRequest(request)))
+            {
+                boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor, retransmit_timeout);
+                co_await timer.async_wait(boost::asio::use_awaitable);
+                continue;
+            }
+
+            bool session_running = false;
+            while (co_await LibUDP::async_wait_readable(session, session_running ? idle_timeout : retransmit_timeout))
+            {
+                // Only the beginning of the frame is read, that's enough to skip it
+                Proto::v3::SessionAnswer received;
+                boost::system::error_code error;
+
+                const std::size_t size = session->socket.receive_from(boost::asio::buffer(&received, sizeof(received)),
+                                                                      session->endpoint, 0, error);
+                if (error)
+                {
+                    break;
+                }
+
+                if (size == sizeof(received) && received.type == Proto::MESSAGE_TYPE_SESSION_ANSWER)
+                {
+                    LibUDP::swap_endianess(received, session->to_big_endian);
+                    answer = received;
+                    co_return true;
+                }
+
+                // The server without the single round-trip handshake answers with the bare v1/v2 answer
+                if (size < sizeof(received))
+                {
+                    answer.answer = Proto::v1::ERR_VERSIONS_INCOMPATIBLE;
+                    co_return true;
+                }
+
+                session_running = true;
+            }
+        }
+
+        co_return false;
+    }
+
+    bool LoadGenerator::accept_session_parameters(LibUDP::Session &session, const Proto::v3::Negotiation &offered,
+                                                  const Proto::v3::Negotiation &picked) const noexcept
+    {
+        if (picked.checksums >= Proto::v3::CHECKSUM_COUNT ||
+            !(offered.checksums & Proto::v3::checksum_bit(static_cast<Proto::v3::Checksum>(picked.checksums))))
+        {
+            return false;
+        }
+
+        if (picked.codecs >= Proto::v3::CODEC_COUNT ||
+            !(offered.codecs & Proto::v3::codec_bit(static_cast<Proto::v3::Codec>(picked.codecs))))
+        {
+            return false;
+        }
+
+        if (picked.datagram_size < Proto::v3::DEFAULT_DATAGRAM_SIZE || picked.datagram_size > offered.datagram_size ||
+            (picked.datagram_size - Proto::v3::FRAME_HEADER_SIZE) % sizeof(double) != 0)
+        {
+            return false;
+        }
+
+        session.checksum      = static_cast<Proto::v3::Checksum>(picked.checksums);
+        session.codec         = static_cast<Proto::v3::Codec>(picked.codecs);
+        session.datagram_size = picked.datagram_size;
+        return true;
+    }
+
+    boost::asio::awaitable<bool> LoadGenerator::receive_frames(std::shared_ptr<LibUDP::Session> &session,
+                                                               const LibUDP::FrameReceiver::sink_t &sink)
+    {
+        const auto idle_timeout = std::chrono::milliseconds(
+            Proto::Constant::PacketRetransmitWaitTimestamp * (Proto::Constant::PacketRetransmitMaxAttempts + 1));
+
+        LibUDP::FrameReceiver receiver(*session);
+        LibUDP::MessageSlots<Proto::v3::Frame> frames(session->datagram_size,
+                                                      LibUDP::receive_batch_capacity(session->datagram_size, false));
+
+        for (;;)
+        {
+            // The close frame may be lost, but we already have everything
+            const bool finished = receiver.complete();
+
+            if (!co_await LibUDP::async_wait_readable(session, idle_timeout))
+            {
+                co_return finished;
+            }
+
+            const std::size_t frames_received = LibUDP::receive_data_batch(session, frames);
+            if (frames_received == 0)
+            {
+                continue;
+            }
+
+            for (std::size_t frame_index = 0; frame_index < frames_received; ++frame_index)
+            {
+                switch (receiver.take(frames[frame_index], sink))
+                {
+                    case LibUDP::FrameReceiver::Status::CLOSED:
+                    {
+                        // The server re-sends the close frame until it's acknowledged
+                        co_await LibUDP::async_send_data(session, receiver.acknowledgement());
+                        co_return receiver.complete();
+                    }
+
+                    case LibUDP::FrameReceiver::Status::UNDECODABLE:
+                    {
+                        co_return false;
+                    }
+
+                    case LibUDP::FrameReceiver::Status::CORRUPTED:
+                    case LibUDP::FrameReceiver::Status::ACCEPTED:
+                    {
+                        break;
+                    }
+                }
+            }
+
+            co_await LibUDP::async_send_data(session, receiver.acknowledgement());
+        }
+    }
+
+    std::string LoadGenerator::report(const Statistics &statistics, const std::chrono::nanoseconds duration) const
+    {
+        const double seconds = std::chrono::duration<double>(duration).count();
+
+        // Only what this process sent, the server impairs its own datagrams
+        const LibUDP::ImpairedLink &link = LibUDP::impaired_link();
+
+        // One key per line in the fixed order, so the reports of two builds diff line by line
+        std::ostringstream stream;
+        stream.precision(6);
+        stream << std::fixed;
+        stream << "{\n"
+               << "  \"sessions\": " << m_options.sessions_count << ",\n"
+               << "  \"rate\": " << m_options.rate << ",\n"
+               << "  \"concurrency\": " << m_options.concurrency << ",\n"
+               << "  \"threads\": " << m_options.threads << ",\n"
+               << "  \"sort_threads\": " << m_options.sort_threads << ",\n"
+               << "  \"x\": " << m_options.x << ",\n"
+               << "  \"doubles\": " << m_options.doubles_count << ",\n"
+               << "  \"datagram_size\": " << m_options.datagram_size << ",\n"
+               << "  \"seed\": " << m_options.seed << ",\n"
+               << "  \"impairment\": \""
+               << (link.enabled() ? LibUDP::describe_link_impairment(link.impairment()) : "none") << "\",\n"
+               << "  \"duration_s\": " << seconds << ",\n"
+               << "  \"completed\": " << statistics.completed << ",\n"
+               << "  \"rejected\": " << statistics.rejected << ",\n"
+               << "  \"unanswered\": " << statistics.unanswered << ",\n"
+               << "  \"failed\": " << statistics.failed << ",\n"
+               << "  \"shed\": " << statistics.shed << ",\n"
+               << "  \"sessions_per_s\": " << (seconds > 0.0 ? statistics.completed / seconds : 0.0) << ",\n"
+               << "  \"goodput_mib_per_s\": "
+               << (seconds > 0.0 ? statistics.values * sizeof(double) / seconds / (1024.0 * 1024.0) : 0.0) << ",\n"
+               << "  \"link\": {\"datagrams\": " << link.statistics().datagrams.load()
+               << ", \"lost\": "       << link.statistics().lost.load()
+               << ", \"overflowed\": " << link.statistics().overflowed.load()
+               << ", \"reordered\": "  << link.statistics().reordered.load()
+               << ", \"duplicated\": " << link.statistics().duplicated.load()
+               << ", \"corrupted\": "  << link.statistics().corrupted.load() << "},\n"
+               << "  \"latency_us\": {\n";
+
+        write_histogram(stream, "handshake", statistics.handshake, false);
+        write_histogram(stream, "transfer",  statistics.transfer,  false);
+        write_histogram(stream, "sort",      statistics.sort,      false);
+        write_histogram(stream, "total",     statistics.total,     true);
+
+        stream << "  }\n"
+               << "}\n";
+        return stream.str();
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef __OZZY_LOAD_GENERATOR__
+#define __OZZY_LOAD_GENERATOR__
+
+#include <utility>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "LibUDP/networking.h"
+#include "LibUDP/receiver.h"
+#include "LibTT/configurable.h"
+#include "LibTT/informative.h"
+#include "LibTT/histogram.h"
+
+namespace Ozzy::Tools
+{
+    using boost::asio::ip::udp;
+
+    struct LoadOptions
+    {
+        // Sessions to run in total
+        std::uint64_t sessions_count = 1000;
+
+        // New sessions per second(open loop, the sessions start on schedule no matter how the
+        // previous ones are doing), with zero every slot starts the next session as soon as the
+        // previous one is over(closed loop)
+        double        rate           = 0.0;
+
+        // Sessions running at once, the open loop arrivals above it are shed
+        std::size_t   concurrency    = 100;
+
+        // Event loop threads, each one runs its own share of the sessions
+        std::size_t   threads        = 2;
+
+        // Threads the received sessions are sorted on, no sort with zero
+        std::size_t   sort_threads   = 2;
+
+        // What every session requests from the server, the server default for zero doubles
+        double        x              = 1.0;
+        std::uint64_t doubles_count  = 0;
+
+        // Largest frame datagram the sessions offer, the probed path MTU for zero
+        std::size_t   datagram_size  = 0;
+
+        // Seed of the open loop arrival times
+        std::uint64_t seed           = 1;
+    };
+
+    // Drives many Proto::v3 sessions at once from a few event loop threads. Every session is
+    // a coroutine that does what the client does(single round-trip handshake, sliding window
+    // receive and the sort), the time of every phase goes to the histograms of its thread.
+    class LoadGenerator : public Component::Configurable, public Component::Informative
+    {
+    public:
+        LoadGenerator(const std::string &config_path, const std::string logger_name, const LoadOptions &options);
+
+        // Run every session and return the report as JSON, empty if the server is unknown
+        std::string run();
+
+    private:
+        using time_point_t = std::chrono::steady_clock::time_point;
+
+        enum class Outcome
+        {
+            COMPLETED,
+
+            // Server answered with anything but ACK(busy or incompatible)
+            REJECTED,
+
+            // Server never answered the request
+            UNANSWERED,
+
+            // Negotiation, transfer or sort failed, or not every double has arrived
+            FAILED,
+        };
+
+        struct Statistics
+        {
+            // Microseconds from the scheduled start to the answer, from the answer to the last
+            // frame, of the sort, and from the scheduled start to the end of the sort
+            Component::LatencyHistogram handshake;
+            Component::LatencyHistogram transfer;
+            Component::LatencyHistogram sort;
+            Component::LatencyHistogram total;
+
+            std::uint64_t completed  = 0;
+            std::uint64_t rejected   = 0;
+            std::uint64_t unanswered = 0;
+            std::uint64_t failed     = 0;
+            std::uint64_t shed       = 0;
+            std::uint64_t values     = 0;
+
+            void merge(const Statistics &other) noexcept;
+        };
+
+        // Only its own thread touches everything in here
+        struct Worker
+        {
+            boost::asio::io_context   io_context{1};
+            Statistics                statistics;
+            std::size_t               in_flight = 0;
+            std::vector<time_point_t> arrivals;
+        };
+
+        // Every `threads`th open loop arrival goes to the same worker
+        void schedule_arrivals(time_point_t start);
+
+        boost::asio::awaitable<void> open_loop(Worker &worker);
+
+        boost::asio::awaitable<void> closed_loop(Worker &worker);
+
+        // Run the session and count its outcome
+        boost::asio::awaitable<void> measure_session(Worker &worker, time_point_t scheduled_at);
+
+        // Latencies are measured from the `scheduled_at`, so the late start of the session is
+        // not hidden from them
+        boost::asio::awaitable<Outcome> run_session(Worker &worker, time_point_t scheduled_at);
+
+        // Same as the client does, but without blocking the thread
+        boost::asio::awaitable<bool> request_session(std::shared_ptr<LibUDP::Session> &session,
+                                                     const Proto::v3::SessionRequest &request,
+                                                     Proto::v3::SessionAnswer &answer);
+
+        bool accept_session_parameters(LibUDP::Session &session, const Proto::v3::Negotiation &offered,
+                                       const Proto::v3::Negotiation &picked) const noexcept;
+
+        // Hands the values over to the `sink` in order, true once every frame is there
+        boost::asio::awaitable<bool> receive_frames(std::shared_ptr<LibUDP::Session> &session,
+                                                    const LibUDP::FrameReceiver::sink_t &sink);
+
+        std::string report(const Statistics &statistics, std::chrono::nanoseconds duration) const;
+
+    private:
+        LoadOptions                          m_options;
+        udp::endpoint                        m_server_endpoint;
+        bool                                 m_initialized = false;
+
+        std::vector<std::unique_ptr<Worker>> m_workers;
+        std::size_t                          m_worker_concurrency = 1;
+
+        // Closed loop sessions started so far by all the workers
+        std::atomic<std::uint64_t>           m_started{0};
+
+        std::unique_ptr<boost::asio::thread_pool> m_sort_pool;
+    };
+}
+
+#endif // __OZZY_LOAD_GENERATOR__
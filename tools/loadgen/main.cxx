@@ -0,0 +1,141 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <boost/program_options.hpp>
+
+#include "load_generator.h"
+#include "LibUDP/impairment.h"
+
+int main(int argc, char** argv)
+{
+    Ozzy::Tools::LoadOptions options;
+
+    boost::program_options::options_description description("Ozzy load generator options");
+    description.add_options()
+    (
+        "help", "Display this message"
+    )
+    (
+        "config",
+        boost::program_options::value<std::string>()->default_value("config/client_cfg.cfg"),
+        "Client config file with the server address"
+    )
+    (
+        "sessions",
+        boost::program_options::value<std::uint64_t>(&options.sessions_count)->default_value(options.sessions_count),
+        "Count of the sessions to run"
+    )
+    (
+        "rate",
+        boost::program_options::value<double>(&options.rate)->default_value(options.rate),
+        "New sessions per second(Poisson arrivals), the next session starts right after the previous one if zero"
+    )
+    (
+        "concurrency",
+        boost::program_options::value<std::size_t>(&options.concurrency)->default_value(options.concurrency),
+        "Sessions running at once, the arrivals above it are shed"
+    )
+    (
+        "threads",
+        boost::program_options::value<std::size_t>(&options.threads)->default_value(options.threads),
+        "Event loop threads"
+    )
+    (
+        "sort-threads",
+        boost::program_options::value<std::size_t>(&options.sort_threads)->default_value(options.sort_threads),
+        "Threads the sessions are sorted on, the received doubles are not sorted if zero"
+    )
+    (
+        "x",
+        boost::program_options::value<double>(&options.x)->default_value(options.x),
+        "Up bound for the doubles set"
+    )
+    (
+        "doubles",
+        boost::program_options::value<std::uint64_t>(&options.doubles_count)->default_value(options.doubles_count),
+        "Count of the doubles every session requests(as much as the server sends by default if zero)"
+    )
+    (
+        "datagram-size",
+        boost::program_options::value<std::size_t>(&options.datagram_size)->default_value(options.datagram_size),
+        "Largest frame datagram the sessions offer(the path MTU if zero)"
+    )
+    (
+        "seed",
+        boost::program_options::value<std::uint64_t>(&options.seed)->default_value(options.seed),
+        "Seed of the arrival times"
+    )
+    (
+        "output",
+        boost::program_options::value<std::string>(),
+        "File the JSON report is written to(standard output if not set)"
+    )
+    (
+        "impair",
+        boost::program_options::value<std::string>(),
+        "Impair the sent datagrams like the lossy link does, e.g. \"loss=0.01,delay=20,jitter=5,rate=100\"(see README)"
+    );
+
+    boost::program_options::variables_map variables_map;
+    try
+    {
+        boost::program_options::store (boost::program_options::parse_command_line(argc, argv, description), variables_map);
+        boost::program_options::notify(variables_map);
+    }
+    catch(const boost::program_options::error& e)
+    {
+        std::cerr << "Error parsing command-line arguments: " << e.what() << std::endl;
+        exit(-1);
+    }
+
+    if (variables_map.contains("help"))
+    {
+        std::cerr << description << std::endl;
+        return 0;
+    }
+
+    if (variables_map.contains("impair"))
+    {
+        Ozzy::LibUDP::LinkImpairment impairment;
+        if (!Ozzy::LibUDP::parse_link_impairment(variables_map["impair"].as<std::string>(), impairment))
+        {
+            std::cerr << "Invalid link impairment " << variables_map["impair"].as<std::string>() << std::endl;
+            return -1;
+        }
+
+        Ozzy::LibUDP::impaired_link().configure(impairment);
+    }
+
+    // Every session takes a socket
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    Ozzy::Tools::LoadGenerator generator(variables_map["config"].as<std::string>(), "LoadGenerator", options);
+
+    const std::string report = generator.run();
+    if (report.empty())
+    {
+        return -1;
+    }
+
+    if (!variables_map.contains("output"))
+    {
+        std::cout << report;
+        return 0;
+    }
+
+    std::ofstream output(variables_map["output"].as<std::string>());
+    output << report;
+    if (!output)
+    {
+        std::cerr << "Unable to write the report to " << variables_map["output"].as<std::string>() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
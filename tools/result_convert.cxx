@@ -0,0 +1,71 @@
+#include <iostream>
+#include <string>
+#include <boost/program_options.hpp>
+
+#include "LibFS/result_file.h"
+
+int main(int argc, char** argv)
+{
+    boost::program_options::options_description description("Ozzy result file converter options");
+    description.add_options()
+    (
+        "help", "Display this message"
+    )
+    (
+        "from",
+        boost::program_options::value<std::string>(),
+        "Version 1 result file to convert"
+    )
+    (
+        "to",
+        boost::program_options::value<std::string>(),
+        "Version 2 result file to write(the sessions are appended to it)"
+    );
+
+    boost::program_options::variables_map variables_map;
+    try
+    {
+        boost::program_options::store (boost::program_options::parse_command_line(argc, argv, description), variables_map);
+        boost::program_options::notify(variables_map);
+    }
+    catch(const boost::program_options::error& e)
+    {
+        std::cerr << "Error parsing command-line arguments: " << e.what() << std::endl;
+        exit(-1);
+    }
+
+    if (variables_map.contains("help") || !variables_map.contains("from") || !variables_map.contains("to"))
+    {
+        std::cerr << description << std::endl;
+        return variables_map.contains("help") ? 0 : -1;
+    }
+
+    const std::string from = variables_map["from"].as<std::string>();
+    const std::string to   = variables_map["to"].as<std::string>();
+
+    if (from == to)
+    {
+        std::cerr << "The version 2 file has to be the different file" << std::endl;
+        return -1;
+    }
+
+    if (!Ozzy::LibFS::convert_result_file_v1(from, to))
+    {
+        std::cerr << "Failed converting " << from << std::endl;
+        return -1;
+    }
+
+    // Make sure that everything can be read back
+    Ozzy::LibFS::ResultFileReader reader(to);
+    for (std::size_t i = 0; i < reader.sessions().size(); ++i)
+    {
+        if (!reader.verify_session(i))
+        {
+            std::cerr << "Session " << i << " of " << to << " is corrupted" << std::endl;
+            return -1;
+        }
+    }
+
+    std::cerr << to << " has " << reader.sessions().size() << " sessions" << std::endl;
+    return 0;
+}